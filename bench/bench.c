@@ -0,0 +1,356 @@
+/*
+ * Benchmark for the parsing/matching stages, against synthetic languages.
+ *
+ * Includes the library source directly so that the internal stages
+ * (find_space, parse_keyword, parse_int) can be timed individually.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../serial_cli.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_HAVE_CYCLES
+#define bench_cycles() __rdtsc()
+#else
+#define bench_cycles() 0ULL
+#endif
+
+/* Commands in each generated corpus */
+#define CORPUS_SIZE (1024)
+
+/* Minimum run time per measurement */
+#define MIN_RUN_NS (20000000ULL)
+
+/* Longest generated keyword */
+#define MAX_WORD (12)
+
+/* Longest generated command line */
+#define MAX_LINE ((MAX_WORD + 1) * CLI_MAX_TOKENS)
+
+struct bench_config
+{
+    int keywords;
+    int commands;
+    /* Number of leading tokens drawn from a small shared set */
+    int prefix_depth;
+};
+
+struct bench_language
+{
+    char words[CLI_RANGE_KEYWORD][MAX_WORD + 1];
+    cli_keyword keywords[CLI_RANGE_KEYWORD + 1];
+    struct cli_command_definition commands[CLI_MAX_COMMANDS + 1];
+    struct cli_keyword_index_node keyword_nodes[CLI_KEYWORD_INDEX_NODES(CLI_RANGE_KEYWORD * MAX_WORD)];
+    struct cli_keyword_index keyword_index;
+    struct cli_command_tree_node command_nodes[CLI_COMMAND_TREE_NODES(CLI_MAX_COMMANDS)];
+    struct cli_command_tree command_tree;
+    struct cli_match_cache match_cache;
+    /* Same keywords as a length-prefixed pool */
+    unsigned char keyword_pool[1 + CLI_RANGE_KEYWORD * (MAX_WORD + 1) + 1];
+    /* Same tables, with and without the precompiled indices or dispatch cache */
+    struct cli_language_definition linear;
+    struct cli_language_definition indexed;
+    struct cli_language_definition cached;
+    struct cli_language_definition pooled;
+};
+
+struct bench_corpus
+{
+    char lines[CORPUS_SIZE][MAX_LINE + 1];
+    const char *line_end[CORPUS_SIZE];
+    cli_expression bytecode[CORPUS_SIZE];
+    /* Word ranges, split in advance for the per-token stages */
+    const char *word_begin[CORPUS_SIZE * CLI_MAX_TOKENS];
+    const char *word_end[CORPUS_SIZE * CLI_MAX_TOKENS];
+    int words;
+    const char *number_begin[CORPUS_SIZE * CLI_MAX_TOKENS];
+    const char *number_end[CORPUS_SIZE * CLI_MAX_TOKENS];
+    int numbers;
+};
+
+/* Defeat dead-code elimination */
+static volatile unsigned long bench_sink;
+
+static unsigned long bench_random_state = 1;
+
+static unsigned long bench_random(void)
+{
+    bench_random_state = bench_random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (bench_random_state >> 33) & 0x7fffffff;
+}
+
+static CLI_COMMAND_HANDLER(bench_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    return cli_command_success;
+}
+
+static unsigned long long bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Generate a language: unique lowercase keywords of varied length, and
+ * commands whose leading tokens are drawn from a small shared set
+ */
+static void generate_language(struct bench_language *lang, const struct bench_config *config)
+{
+    for (int i = 0; i < config->keywords; ++i) {
+        char *word = lang->words[i];
+        bool unique;
+        do {
+            int length = 2 + bench_random() % (MAX_WORD - 1);
+            for (int j = 0; j < length; ++j) {
+                word[j] = 'a' + bench_random() % 26;
+            }
+            word[length] = '\0';
+            unique = TRUE;
+            for (int j = 0; j < i; ++j) {
+                unique = unique && strcmp(word, lang->words[j]) != 0;
+            }
+        } while (!unique);
+        lang->keywords[i] = word;
+    }
+    lang->keywords[config->keywords] = NULL;
+
+    int shared = config->keywords < 4 ? config->keywords : 4;
+    for (int i = 0; i < config->commands; ++i) {
+        syntax_token syntax[CLI_MAX_TOKENS] = { 0 };
+        int length = config->prefix_depth + 1 + bench_random() % 3;
+        if (length > CLI_MAX_TOKENS) {
+            length = CLI_MAX_TOKENS;
+        }
+        for (int j = 0; j < length; ++j) {
+            int keyword = j < config->prefix_depth ? bench_random() % shared : bench_random() % config->keywords;
+            syntax[j] = CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(keyword);
+        }
+        if (length > 1 && bench_random() % 2) {
+            syntax[length - 1] = CLI_SPEC_NUMBER;
+        }
+        struct cli_command_definition def = {
+            .syntax = {
+                syntax[0], syntax[1], syntax[2], syntax[3],
+                syntax[4], syntax[5], syntax[6], syntax[7],
+            },
+            .handler = bench_handler,
+        };
+        memcpy(&lang->commands[i], &def, sizeof(def));
+    }
+    memset(&lang->commands[config->commands], 0, sizeof(lang->commands[0]));
+
+    build_keyword_index(lang->keywords, lang->keyword_nodes, sizeof(lang->keyword_nodes) / sizeof(lang->keyword_nodes[0]), &lang->keyword_index);
+    build_command_tree(lang->commands, lang->command_nodes, sizeof(lang->command_nodes) / sizeof(lang->command_nodes[0]), &lang->command_tree);
+    lang->linear = (struct cli_language_definition) {
+        .keywords = lang->keywords,
+        .commands = lang->commands,
+    };
+    lang->indexed = lang->linear;
+    lang->indexed.keyword_index = &lang->keyword_index;
+    lang->indexed.command_tree = &lang->command_tree;
+    lang->match_cache = (struct cli_match_cache) { 0 };
+    lang->cached = lang->linear;
+    lang->cached.match_cache = &lang->match_cache;
+
+    unsigned char *pool = lang->keyword_pool;
+    *pool++ = 0;
+    for (int i = 0; i < config->keywords; ++i) {
+        *pool = strlen(lang->words[i]);
+        memcpy(pool + 1, lang->words[i], *pool);
+        pool += *pool + 1;
+    }
+    *pool = 0;
+    lang->pooled = lang->linear;
+    lang->pooled.keywords = NULL;
+    lang->pooled.keyword_pool = lang->keyword_pool;
+}
+
+/*
+ * Generate a corpus: valid commands of the language, with one in sixteen
+ * having an unknown word substituted
+ */
+static void generate_corpus(struct bench_corpus *corpus, const struct bench_language *lang, const struct bench_config *config)
+{
+    corpus->words = 0;
+    corpus->numbers = 0;
+    for (int i = 0; i < CORPUS_SIZE; ++i) {
+        const struct cli_command_definition *def = &lang->commands[bench_random() % config->commands];
+        char *out = corpus->lines[i];
+        for (const syntax_token *token = def->syntax; token != def->syntax + CLI_MAX_TOKENS && !CLI_SPEC_IS_TERMINAL(*token); ++token) {
+            if (out != corpus->lines[i]) {
+                *out++ = CLI_LONG_SPACE;
+            }
+            const char *word_begin = out;
+            if (bench_random() % (16 * CLI_MAX_TOKENS) == 0) {
+                out += sprintf(out, "zzz");
+            } else if (CLI_SPEC_IS_KEYWORD(*token)) {
+                out += sprintf(out, "%s", lang->keywords[CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(*token)]);
+            } else {
+                out += sprintf(out, "%d", (int) (bench_random() % CLI_RANGE_NUMBER) + CLI_NUMBER_MIN);
+                corpus->number_begin[corpus->numbers] = word_begin;
+                corpus->number_end[corpus->numbers++] = out;
+            }
+            corpus->word_begin[corpus->words] = word_begin;
+            corpus->word_end[corpus->words++] = out;
+        }
+        *out = '\0';
+        corpus->line_end[i] = out;
+        if (parse_long_command(&lang->linear, corpus->lines[i], out, &corpus->bytecode[i]) != parse_long_command_success) {
+            corpus->bytecode[i][0] = CLI_EXPR_TERMINAL;
+        }
+    }
+}
+
+/* Stages which are timed */
+enum bench_stage
+{
+    stage_tokenize,
+    stage_parse_keyword,
+    stage_parse_int,
+    stage_match_command,
+    stage_pipeline,
+    stage_count,
+};
+
+static const char *stage_names[stage_count] = {
+    [stage_tokenize] = "tokenize",
+    [stage_parse_keyword] = "parse_keyword",
+    [stage_parse_int] = "parse_int",
+    [stage_match_command] = "match_command",
+    [stage_pipeline] = "pipeline",
+};
+
+/*
+ * Run one pass of a stage over the whole corpus
+ */
+static unsigned long run_stage(enum bench_stage stage, const struct cli_language_definition *language, const struct bench_corpus *corpus)
+{
+    unsigned long check = 0;
+    switch (stage) {
+    case stage_tokenize:
+        for (int i = 0; i < CORPUS_SIZE; ++i) {
+            const char *it = corpus->lines[i];
+            const char *word_begin;
+            while ((word_begin = find_space(it, corpus->line_end[i], FALSE))) {
+                it = find_space(word_begin, corpus->line_end[i], TRUE);
+                check += it - word_begin;
+            }
+        }
+        break;
+    case stage_parse_keyword:
+        for (int i = 0; i < corpus->words; ++i) {
+            expression_token token = 0;
+            parse_keyword(&token, corpus->word_begin[i], corpus->word_end[i], language);
+            check += token;
+        }
+        break;
+    case stage_parse_int:
+        for (int i = 0; i < corpus->numbers; ++i) {
+            expression_token token = 0;
+            parse_int(&token, corpus->number_begin[i], corpus->number_end[i]);
+            check += token;
+        }
+        break;
+    case stage_match_command:
+        for (int i = 0; i < CORPUS_SIZE; ++i) {
+            const struct cli_command_definition *def;
+            check += match_command(language, &corpus->bytecode[i], &def);
+            check += (unsigned long) def;
+        }
+        break;
+    case stage_pipeline:
+        for (int i = 0; i < CORPUS_SIZE; ++i) {
+            const struct cli_command_definition *def = NULL;
+            cli_expression bytecode;
+            if (parse_long_command(language, corpus->lines[i], corpus->line_end[i], &bytecode) == parse_long_command_success) {
+                check += match_command(language, &bytecode, &def);
+            }
+            check += (unsigned long) def;
+        }
+        break;
+    default:
+        break;
+    }
+    return check;
+}
+
+/*
+ * Time a stage, report per-command cost
+ */
+static void measure(enum bench_stage stage, const char *engine, const struct cli_language_definition *language, const struct bench_corpus *corpus, const struct bench_config *config)
+{
+    unsigned long passes = 0;
+    unsigned long long start_ns = bench_now_ns();
+    unsigned long long start_cycles = bench_cycles();
+    unsigned long long elapsed_ns;
+    do {
+        bench_sink += run_stage(stage, language, corpus);
+        ++passes;
+        elapsed_ns = bench_now_ns() - start_ns;
+    } while (elapsed_ns < MIN_RUN_NS);
+    unsigned long long elapsed_cycles = bench_cycles() - start_cycles;
+    double commands = (double) passes * CORPUS_SIZE;
+    printf("%4d %4d %3d  %-14s %-8s %10.1f", config->keywords, config->commands, config->prefix_depth, stage_names[stage], engine, elapsed_ns / commands);
+#ifdef BENCH_HAVE_CYCLES
+    printf(" %10.1f" PRINTF_LINEBREAK, elapsed_cycles / commands);
+#else
+    (void) elapsed_cycles;
+    printf(" %10s" PRINTF_LINEBREAK, "-");
+#endif
+}
+
+static const struct bench_config configs[] = {
+    { .keywords = 8, .commands = 8, .prefix_depth = 1 },
+    { .keywords = 16, .commands = 16, .prefix_depth = 1 },
+    { .keywords = 32, .commands = 32, .prefix_depth = 2 },
+    { .keywords = 64, .commands = 32, .prefix_depth = 2 },
+    { .keywords = 64, .commands = 64, .prefix_depth = 1 },
+    { .keywords = 64, .commands = 64, .prefix_depth = 3 },
+    { .keywords = 64, .commands = 64, .prefix_depth = 5 },
+};
+
+int main(int argc, char *argv[])
+{
+    (void) argc;
+    (void) argv;
+    static struct bench_language lang;
+    static struct bench_corpus corpus;
+#if defined(CLI_TOKENIZER_SWAR)
+    printf("Tokenizer: swar" PRINTF_LINEBREAK);
+#elif defined(CLI_TOKENIZER_SSE2)
+    printf("Tokenizer: sse2" PRINTF_LINEBREAK);
+#else
+    printf("Tokenizer: scalar" PRINTF_LINEBREAK);
+#endif
+    printf("%4s %4s %3s  %-14s %-8s %10s %10s" PRINTF_LINEBREAK, "kw", "cmd", "pfx", "stage", "engine", "ns/cmd", "cyc/cmd");
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+        const struct bench_config *config = &configs[i];
+        generate_language(&lang, config);
+        generate_corpus(&corpus, &lang, config);
+        measure(stage_tokenize, "-", &lang.linear, &corpus, config);
+        measure(stage_parse_int, "-", &lang.linear, &corpus, config);
+        for (enum bench_stage stage = stage_parse_keyword; stage < stage_count; ++stage) {
+            if (stage == stage_parse_int) {
+                continue;
+            }
+            measure(stage, "linear", &lang.linear, &corpus, config);
+            measure(stage, "indexed", &lang.indexed, &corpus, config);
+            if (stage == stage_match_command) {
+                measure(stage, "cached", &lang.cached, &corpus, config);
+            } else {
+                measure(stage, "pooled", &lang.pooled, &corpus, config);
+            }
+        }
+        printf("Dispatch cache: %lu hits, %lu misses" PRINTF_LINEBREAK, lang.match_cache.hits, lang.match_cache.misses);
+    }
+    return 0;
+}
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serial_cli.h"
+#include "serial_cli_batch.h"
+#include "serial_cli_stream.h"
+#include "host_language.h"
+
+/*
+ * Checks command scripts against a language before they are sent to a
+ * device: every non-blank line must parse and match a command.  Scripts are
+ * memory-mapped and split at line breaks across worker threads, each of
+ * which runs parse_batch over its part.
+ *
+ *   cli_check [-j threads] [-l image] script...
+ *
+ * Errors are reported as file:line, in order.  Exits with 1 if any line
+ * failed, 2 if a script could not be read.  The language is the linked one
+ * or an image, see host_language.h.
+ */
+
+static const struct cli_language_definition *check_language;
+
+/* Lines per parse_batch call */
+#define CHECK_BATCH_SIZE (1024)
+
+/* Smallest part worth a thread of its own */
+#define CHECK_MIN_PART_SIZE (64 * 1024)
+
+#define CHECK_MAX_THREADS (64)
+
+/* A failed line */
+struct check_error
+{
+    /* Line number within the part */
+    size_t line;
+    const char *text;
+    unsigned char parse;
+    unsigned char match;
+};
+
+/* Part of a script, checked by one thread */
+struct check_part
+{
+    const struct cli_language_definition *language;
+    const char *begin;
+    const char *end;
+    size_t lines;
+    struct check_error *errors;
+    size_t error_count;
+    size_t error_capacity;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *check_part(void *arg)
+{
+    struct check_part *part = arg;
+    struct cli_batch_line *lines = malloc(CHECK_BATCH_SIZE * sizeof(*lines));
+    const char *it = part->begin;
+    while (lines && it != part->end) {
+        const char *line_begin = it;
+        size_t count = parse_batch(part->language, it, part->end, lines, CHECK_BATCH_SIZE, &it);
+        for (size_t i = 0; i < count; ++i) {
+            const struct cli_batch_line *line = &lines[i];
+            const char *text = line_begin;
+            line_begin = memchr(line_begin, CLI_STREAM_LINE_BREAK, part->end - line_begin);
+            line_begin = line_begin ? line_begin + 1 : part->end;
+            if (line->match == match_command_success || (line->parse == parse_long_command_success && CLI_EXPR_IS_TERMINAL(line->bytecode[0]))) {
+                continue;
+            }
+            if (part->error_count == part->error_capacity) {
+                part->error_capacity = part->error_capacity ? part->error_capacity * 2 : 64;
+                part->errors = realloc(part->errors, part->error_capacity * sizeof(*part->errors));
+                if (!part->errors) {
+                    fprintf(stderr, "Out of memory\n");
+                    exit(2);
+                }
+            }
+            part->errors[part->error_count++] = (struct check_error) {
+                .line = part->lines + i,
+                .text = text,
+                .parse = line->parse,
+                .match = line->match,
+            };
+        }
+        part->lines += count;
+    }
+    free(lines);
+    return NULL;
+}
+
+static const char *check_error_text(const struct check_error *error)
+{
+    switch (error->parse) {
+    case parse_long_command_success:
+        return error->match == match_command_invalid_token ? "invalid token" : "no matching command";
+    case parse_long_command_too_many_tokens:
+        return "too many tokens";
+    default:
+        return "invalid token";
+    }
+}
+
+/*
+ * Check one script, returns the number of failed lines or -1 if it could not be read
+ */
+static long check_script(const char *name, int threads, size_t *line_count)
+{
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(name);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    size_t size = st.st_size;
+    const char *data = NULL;
+    if (size) {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror(name);
+            close(fd);
+            return -1;
+        }
+        madvise((void *) data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    /* Matching may update the language's cache, so each part gets a copy without one */
+    struct cli_language_definition language = *check_language;
+    language.match_cache = NULL;
+
+    int part_count = size / CHECK_MIN_PART_SIZE + 1;
+    if (part_count > threads) {
+        part_count = threads;
+    }
+    struct check_part parts[CHECK_MAX_THREADS];
+    pthread_t workers[CHECK_MAX_THREADS];
+    bool threaded[CHECK_MAX_THREADS] = { false };
+    const char *it = data;
+    const char *end = data + size;
+    for (int i = 0; i < part_count; ++i) {
+        const char *part_end = i == part_count - 1 ? end : it + (end - it) / (part_count - i);
+        const char *line_break = part_end != end ? memchr(part_end, CLI_STREAM_LINE_BREAK, end - part_end) : NULL;
+        part_end = line_break ? line_break + 1 : end;
+        parts[i] = (struct check_part) {
+            .language = &language,
+            .begin = it,
+            .end = part_end,
+        };
+        it = part_end;
+        if (i) {
+            threaded[i] = pthread_create(&workers[i], NULL, check_part, &parts[i]) == 0;
+            if (!threaded[i]) {
+                check_part(&parts[i]);
+            }
+        }
+    }
+    check_part(&parts[0]);
+
+    long errors = 0;
+    size_t line_base = 0;
+    for (int i = 0; i < part_count; ++i) {
+        if (threaded[i]) {
+            pthread_join(workers[i], NULL);
+        }
+        for (size_t e = 0; e < parts[i].error_count; ++e) {
+            const struct check_error *error = &parts[i].errors[e];
+            const char *text_end = memchr(error->text, CLI_STREAM_LINE_BREAK, end - error->text);
+            int length = (text_end ? text_end : end) - error->text;
+            if (length && error->text[length - 1] == '\r') {
+                --length;
+            }
+            printf("%s:%zu: %s: %.*s\n", name, line_base + error->line + 1, check_error_text(error), length, error->text);
+        }
+        errors += parts[i].error_count;
+        line_base += parts[i].lines;
+        free(parts[i].errors);
+    }
+    *line_count += line_base;
+    if (size) {
+        munmap((void *) data, size);
+    }
+    return errors;
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *image = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:l:")) != -1) {
+        if (opt == 'j') {
+            threads = atoi(optarg);
+        } else if (opt == 'l') {
+            image = optarg;
+        } else {
+            fprintf(stderr, "Usage: %s [-j threads] [-l image] script...\n", argv[0]);
+            return 2;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    } else if (threads > CHECK_MAX_THREADS) {
+        threads = CHECK_MAX_THREADS;
+    }
+    if (optind == argc) {
+        fprintf(stderr, "Usage: %s [-j threads] [-l image] script...\n", argv[0]);
+        return 2;
+    }
+
+    check_language = host_language(image);
+    if (!check_language) {
+        return 2;
+    }
+
+    double start = now();
+    size_t lines = 0;
+    long errors = 0;
+    bool unreadable = false;
+    for (int i = optind; i < argc; ++i) {
+        long result = check_script(argv[i], threads, &lines);
+        if (result < 0) {
+            unreadable = true;
+        } else {
+            errors += result;
+        }
+    }
+    fprintf(stderr, "%zu lines, %ld errors, %.3f s (%d threads)\n", lines, errors, now() - start, threads);
+    return unreadable ? 2 : errors ? 1 : 0;
+}
@@ -0,0 +1,195 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli_client.h"
+
+/* Seconds to wait for a reply while the window is full */
+#define SUBMIT_TIMEOUT (1.0)
+
+/* Received bytes buffered while looking for frames */
+#define INPUT_SIZE (4096)
+
+struct cli_client
+{
+    int fd;
+    int window;
+    cli_client_callback *callback;
+    void *context;
+    /* Oldest request without a reply, and the next sequence number */
+    unsigned char oldest;
+    unsigned char next;
+    int in_flight;
+    /* Requests queued but not written yet, the newest of those in flight */
+    int unsent;
+    /* When each request in flight was written */
+    double sent[0x100];
+    unsigned char output[CLI_CLIENT_MAX_WINDOW * CLI_FRAME_REQUEST_MAX_SIZE];
+    size_t output_used;
+    unsigned char input[INPUT_SIZE];
+    size_t input_used;
+    struct cli_client_stats stats;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct cli_client *client_create(int fd, int window, cli_client_callback *callback, void *context)
+{
+    if (window < 1 || window > CLI_CLIENT_MAX_WINDOW) {
+        return NULL;
+    }
+    struct cli_client *client = calloc(1, sizeof(*client));
+    if (!client) {
+        return NULL;
+    }
+    client->fd = fd;
+    client->window = window;
+    client->callback = callback;
+    client->context = context;
+    return client;
+}
+
+void client_destroy(struct cli_client *client)
+{
+    free(client);
+}
+
+int client_in_flight(const struct cli_client *client)
+{
+    return client->in_flight;
+}
+
+void client_stats(const struct cli_client *client, struct cli_client_stats *stats)
+{
+    *stats = client->stats;
+}
+
+int client_flush(struct cli_client *client)
+{
+    for (size_t done = 0; done < client->output_used;) {
+        ssize_t written = write(client->fd, client->output + done, client->output_used - done);
+        if (written < 0 && errno != EINTR) {
+            return -1;
+        }
+        done += written > 0 ? written : 0;
+    }
+    double time = now();
+    for (; client->unsent; --client->unsent) {
+        client->sent[(unsigned char) (client->next - client->unsent)] = time;
+    }
+    client->output_used = 0;
+    return 0;
+}
+
+/*
+ * Retire requests up to the one with a reply (NULL to retire all as lost)
+ */
+static void client_retire(struct cli_client *client, const struct cli_reply *reply)
+{
+    double time = now();
+    int count = reply ? (unsigned char) (reply->sequence - client->oldest) + 1 : client->in_flight;
+    for (int i = 0; i < count; ++i, ++client->oldest, --client->in_flight) {
+        bool answered = reply && client->oldest == reply->sequence;
+        if (answered) {
+            ++client->stats.replies;
+        } else {
+            ++client->stats.lost;
+        }
+        if (client->callback) {
+            client->callback(client->context, client->oldest, answered ? reply : NULL, time - client->sent[client->oldest]);
+        }
+    }
+}
+
+/*
+ * Handle complete frames in the input buffer
+ */
+static void client_parse(struct cli_client *client)
+{
+    size_t offset = 0;
+    while (offset < client->input_used) {
+        size_t size = CLI_FRAME_SIZE(client->input[offset]);
+        if (client->input_used - offset < size) {
+            break;
+        }
+        const unsigned char *frame = client->input + offset;
+        unsigned char crc = 0;
+        for (size_t i = 0; i + 1 < size; ++i) {
+            crc = cli_crc8(crc, frame[i]);
+        }
+        if (crc != frame[size - 1]) {
+            /* Not at a frame boundary, or corrupted: resynchronise */
+            ++client->stats.skipped;
+            ++offset;
+            continue;
+        }
+        struct cli_reply reply;
+        if (decode_reply_frame(frame, size, &reply) == receive_frame_success && (unsigned char) (reply.sequence - client->oldest) < client->in_flight) {
+            client_retire(client, &reply);
+        }
+        offset += size;
+    }
+    memmove(client->input, client->input + offset, client->input_used - offset);
+    client->input_used -= offset;
+}
+
+int client_poll(struct cli_client *client, double timeout)
+{
+    struct pollfd pfd = { .fd = client->fd, .events = POLLIN };
+    int ready = poll(&pfd, 1, (int) (timeout * 1000));
+    if (ready <= 0) {
+        return ready < 0 && errno != EINTR ? -1 : 0;
+    }
+    ssize_t size = read(client->fd, client->input + client->input_used, INPUT_SIZE - client->input_used);
+    if (size <= 0) {
+        return size < 0 && errno == EINTR ? 0 : -1;
+    }
+    client->input_used += size;
+    client_parse(client);
+    return 1;
+}
+
+int client_submit(struct cli_client *client, const cli_expression *bytecode)
+{
+    while (client->in_flight == client->window) {
+        if (client_flush(client) < 0 || client_poll(client, SUBMIT_TIMEOUT) <= 0) {
+            client_retire(client, NULL);
+            return -1;
+        }
+    }
+    unsigned char size;
+    if (encode_request_frame(bytecode, client->next, client->output + client->output_used, CLI_FRAME_REQUEST_MAX_SIZE, &size) != encode_frame_success) {
+        return -2;
+    }
+    client->output_used += size;
+    ++client->next;
+    ++client->in_flight;
+    ++client->unsent;
+    ++client->stats.sent;
+    return 0;
+}
+
+int client_drain(struct cli_client *client, double timeout)
+{
+    if (client_flush(client) < 0) {
+        return -1;
+    }
+    while (client->in_flight) {
+        if (client_poll(client, timeout) <= 0) {
+            client_retire(client, NULL);
+            return -1;
+        }
+    }
+    return 0;
+}
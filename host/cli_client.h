@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * Pipelining host client: sends commands as request frames (see
+ * serial_cli_frame.h) with a window of requests in flight, and matches the
+ * reply frames up by sequence number.  Throughput is then limited by link
+ * bandwidth instead of round trip time.
+ *
+ * Devices answer requests in order, so a reply to a later request means the
+ * earlier ones were lost (dropped on a bad CRC); they are reported as such.
+ * Other frames on the link (telemetry) are skipped.
+ */
+
+#include "serial_cli.h"
+#include "serial_cli_frame.h"
+
+/* Most requests in flight, half the sequence number space */
+#define CLI_CLIENT_MAX_WINDOW (128)
+
+struct cli_client;
+
+/*
+ * Called for each request: with its reply, or with NULL if it was lost.
+ * latency is seconds from submission to the reply.
+ */
+typedef void cli_client_callback(void *context, unsigned char sequence, const struct cli_reply *reply, double latency);
+
+struct cli_client_stats
+{
+    unsigned long sent;
+    unsigned long replies;
+    unsigned long lost;
+    /* Bytes skipped on the way to a valid frame */
+    unsigned long skipped;
+};
+
+/*
+ * Create a client on a blocking file descriptor (not owned), returns NULL on failure
+ */
+struct cli_client *client_create(int fd, int window, cli_client_callback *callback, void *context);
+
+/*
+ * Queue a command, waiting for replies while the window is full.  Returns
+ * -1 on I/O error or timeout, -2 if the command cannot be framed.
+ */
+int client_submit(struct cli_client *client, const cli_expression *bytecode);
+
+/*
+ * Send queued requests and wait for all replies, returns -1 on I/O error or
+ * if no reply came for timeout seconds (outstanding requests are then lost)
+ */
+int client_drain(struct cli_client *client, double timeout);
+
+/*
+ * Write queued requests without waiting for the window to fill, returns -1 on I/O error
+ */
+int client_flush(struct cli_client *client);
+
+/*
+ * Wait up to timeout for replies and handle them, returns 1 if any bytes
+ * arrived, 0 on timeout, -1 on I/O error
+ */
+int client_poll(struct cli_client *client, double timeout);
+
+/*
+ * Requests in flight (queued or written, without a reply)
+ */
+int client_in_flight(const struct cli_client *client);
+
+void client_stats(const struct cli_client *client, struct cli_client_stats *stats);
+
+void client_destroy(struct cli_client *client);
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serial_cli_request.h"
+#include "serial_cli_stream.h"
+#include "cli_server.h"
+#include "cli_device.h"
+
+/* Bytes read per system call */
+#define READ_CHUNK (256)
+
+/* Replies waiting for their time to be sent */
+#define PENDING_REPLIES (1024)
+
+/* Longest reply, text or frame */
+#define REPLY_SIZE (32)
+
+/* Longest wait between checks for a stop request, seconds */
+#define IDLE_WAIT (0.05)
+
+struct pending_reply
+{
+    /* When the last byte of the reply leaves the device */
+    double due;
+    unsigned char size;
+    unsigned char data[REPLY_SIZE];
+};
+
+struct cli_device
+{
+    int fd;
+    /* pty slave held open by the device, or -1 */
+    int slave_fd;
+    pthread_t thread;
+    atomic_bool running;
+    struct cli_device_config config;
+    /* Seconds per byte on the link, zero if unlimited */
+    double byte_time;
+    const struct cli_language_definition *language;
+    struct cli_request_server server;
+    struct cli_stream_parser parser;
+    cli_expression bytecode;
+    /* When the link will have delivered the bytes read so far, and sent the replies queued so far */
+    double input_clock;
+    double output_clock;
+    struct pending_reply pending[PENDING_REPLIES];
+    unsigned int pending_head;
+    unsigned int pending_tail;
+    pthread_mutex_t lock;
+    struct cli_device_stats stats;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Queue a reply to leave after the latency, at the link rate
+ */
+static void device_queue_reply(struct cli_device *device, const void *data, unsigned char size, double received)
+{
+    if (device->pending_head - device->pending_tail == PENDING_REPLIES) {
+        /* Host is far behind, like a full UART FIFO */
+        pthread_mutex_lock(&device->lock);
+        ++device->stats.overflowed;
+        pthread_mutex_unlock(&device->lock);
+        return;
+    }
+    double start = received + device->config.latency;
+    if (start < device->output_clock) {
+        start = device->output_clock;
+    }
+    device->output_clock = start + size * device->byte_time;
+    struct pending_reply *reply = &device->pending[device->pending_head++ % PENDING_REPLIES];
+    reply->due = device->output_clock;
+    reply->size = size;
+    memcpy(reply->data, data, size);
+}
+
+/*
+ * Send replies which are due, in one write
+ */
+static void device_send_due(struct cli_device *device, double time)
+{
+    unsigned char buffer[PENDING_REPLIES * REPLY_SIZE];
+    size_t used = 0;
+    while (device->pending_tail != device->pending_head && device->pending[device->pending_tail % PENDING_REPLIES].due <= time) {
+        struct pending_reply *reply = &device->pending[device->pending_tail++ % PENDING_REPLIES];
+        memcpy(buffer + used, reply->data, reply->size);
+        used += reply->size;
+    }
+    for (size_t done = 0; done < used;) {
+        ssize_t written = write(device->fd, buffer + done, used - done);
+        if (written < 0 && errno != EINTR) {
+            break;
+        }
+        done += written > 0 ? written : 0;
+    }
+    pthread_mutex_lock(&device->lock);
+    device->stats.bytes_out += used;
+    pthread_mutex_unlock(&device->lock);
+}
+
+/*
+ * Handle one received byte, returns whether it completed a command with an error
+ */
+static bool device_receive_byte(struct cli_device *device, unsigned char byte, bool *answered)
+{
+    *answered = false;
+    if (device->config.protocol == cli_device_framed) {
+        unsigned char reply[CLI_FRAME_REPLY_SIZE];
+        if (!serve_request(&device->server, byte, reply)) {
+            return false;
+        }
+        *answered = true;
+        device_queue_reply(device, reply, CLI_FRAME_REPLY_SIZE, device->input_clock);
+        return reply[3] != cli_reply_executed;
+    }
+    enum stream_parser_result result = stream_parser_feed(&device->parser, byte);
+    if (result == stream_parser_pending) {
+        return false;
+    }
+    bool error;
+    const char *reply = server_execute_line(device->language, result, &device->bytecode, &error);
+    if (reply) {
+        *answered = true;
+        device_queue_reply(device, reply, strlen(reply), device->input_clock);
+    }
+    return error;
+}
+
+static void device_receive(struct cli_device *device, const unsigned char *data, size_t size, double time)
+{
+    unsigned long dropped = device->server.dropped;
+    unsigned long requests = 0;
+    unsigned long errors = 0;
+    for (size_t i = 0; i < size; ++i) {
+        /* Byte arrives once the link has carried it */
+        device->input_clock = (device->input_clock > time ? device->input_clock : time) + device->byte_time;
+        bool answered;
+        errors += device_receive_byte(device, data[i], &answered);
+        requests += answered;
+    }
+    pthread_mutex_lock(&device->lock);
+    device->stats.bytes_in += size;
+    device->stats.requests += requests;
+    device->stats.errors += errors;
+    device->stats.dropped += device->server.dropped - dropped;
+    pthread_mutex_unlock(&device->lock);
+}
+
+static void *device_run(void *arg)
+{
+    struct cli_device *device = arg;
+    while (device->running) {
+        double time = now();
+        device_send_due(device, time);
+
+        /* Wait for the next reply to fall due, and read only what the link has delivered */
+        double wait = IDLE_WAIT;
+        if (device->pending_tail != device->pending_head) {
+            double due = device->pending[device->pending_tail % PENDING_REPLIES].due - time;
+            wait = due < wait ? due : wait;
+        }
+        bool link_busy = device->input_clock > time;
+        if (link_busy && device->input_clock - time < wait) {
+            wait = device->input_clock - time;
+        }
+        struct pollfd pfd = { .fd = device->fd, .events = link_busy ? 0 : POLLIN };
+        int ready = poll(&pfd, 1, wait > 0 ? (int) (wait * 1000 + 0.999) : 0);
+        if (ready > 0 && (pfd.revents & (POLLHUP | POLLERR)) && !(pfd.revents & POLLIN)) {
+            break;
+        }
+        if (ready > 0 && (pfd.revents & POLLIN)) {
+            unsigned char buffer[READ_CHUNK];
+            ssize_t size = read(device->fd, buffer, sizeof(buffer));
+            if (size == 0) {
+                break;
+            }
+            if (size > 0) {
+                device_receive(device, buffer, size, now());
+            }
+        }
+    }
+    return NULL;
+}
+
+static struct cli_device *device_create(const struct cli_language_definition *language, int fd, int slave_fd, const struct cli_device_config *config)
+{
+    struct cli_device *device = calloc(1, sizeof(*device));
+    if (!device) {
+        return NULL;
+    }
+    device->fd = fd;
+    device->slave_fd = slave_fd;
+    device->config = *config;
+    device->byte_time = config->baud ? 10.0 / config->baud : 0;
+    device->language = language;
+    device->running = true;
+    request_server_init(&device->server, language);
+    stream_parser_init(&device->parser, language, &device->bytecode);
+    pthread_mutex_init(&device->lock, NULL);
+    if (pthread_create(&device->thread, NULL, device_run, device) != 0) {
+        pthread_mutex_destroy(&device->lock);
+        free(device);
+        return NULL;
+    }
+    return device;
+}
+
+struct cli_device *device_start(const struct cli_language_definition *language, int fd, const struct cli_device_config *config)
+{
+    return device_create(language, fd, -1, config);
+}
+
+struct cli_device *device_start_pty(const struct cli_language_definition *language, const struct cli_device_config *config, char *path, size_t path_size)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0 || ptsname_r(master, path, path_size) != 0) {
+        if (master >= 0) {
+            close(master);
+        }
+        return NULL;
+    }
+    int slave = open(path, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        close(master);
+        return NULL;
+    }
+    /* Raw on both sides: no echo, no line editing, no newline translation */
+    struct termios tio;
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    struct cli_device *device = device_create(language, master, slave, config);
+    if (!device) {
+        close(slave);
+        close(master);
+    }
+    return device;
+}
+
+void device_stop(struct cli_device *device)
+{
+    device->running = false;
+    pthread_join(device->thread, NULL);
+    close(device->fd);
+    if (device->slave_fd >= 0) {
+        close(device->slave_fd);
+    }
+    pthread_mutex_destroy(&device->lock);
+    free(device);
+}
+
+void device_stats(struct cli_device *device, struct cli_device_stats *stats)
+{
+    pthread_mutex_lock(&device->lock);
+    *stats = device->stats;
+    pthread_mutex_unlock(&device->lock);
+}
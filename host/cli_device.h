@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * Simulated device: serves a language behind a file descriptor (socket, pipe
+ * or pty) on a thread of its own, the way firmware would behind a serial
+ * link.  Commands are text lines answered like host/cli_server.h, or request
+ * frames (see serial_cli_request.h).  The link is modelled by a byte rate and
+ * a fixed reply latency, so that host-side tools and protocols can be
+ * measured end to end without hardware.
+ */
+
+#include <stddef.h>
+
+#include "serial_cli.h"
+
+struct cli_device;
+
+enum cli_device_protocol
+{
+    /* Lines in, reply lines out */
+    cli_device_text,
+    /* Request frames in, reply frames out */
+    cli_device_framed,
+};
+
+struct cli_device_config
+{
+    enum cli_device_protocol protocol;
+    /* Link speed in bits per second (10 bits per byte each way), zero for unlimited */
+    unsigned long baud;
+    /* Seconds from receiving the last byte of a request to sending its reply */
+    double latency;
+};
+
+struct cli_device_stats
+{
+    /* Commands answered, and those answered with an error (no match, bad frame or line) */
+    unsigned long requests;
+    unsigned long errors;
+    /* Frames dropped by the device (bad length or CRC) */
+    unsigned long dropped;
+    /* Replies discarded because the host fell too far behind reading them */
+    unsigned long overflowed;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+};
+
+/*
+ * Start serving on fd, which the device takes ownership of.  Returns NULL on failure.
+ */
+struct cli_device *device_start(const struct cli_language_definition *language, int fd, const struct cli_device_config *config);
+
+/*
+ * Start serving on a new pty, whose slave path is written to path.  The
+ * device holds the slave open, so peers may come and go.
+ */
+struct cli_device *device_start_pty(const struct cli_language_definition *language, const struct cli_device_config *config, char *path, size_t path_size);
+
+/*
+ * Stop the device thread, close its descriptor and free it
+ */
+void device_stop(struct cli_device *device);
+
+/*
+ * Counters so far
+ */
+void device_stats(struct cli_device *device, struct cli_device_stats *stats);
@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli_client.h"
+#include "cli_device.h"
+#include "host_language.h"
+
+/*
+ * Replays captured serial logs against a device, and reports throughput,
+ * latency percentiles and a breakdown of the replies:
+ *
+ *   cli_replay [-f] [-t] [-w window] [-d device] [-b baud] [-L latency ms] [-l image] log...
+ *
+ * Logs hold one command per line, optionally prefixed with a timestamp in
+ * seconds as serial capture tools write it ("[12.345678] get led 3"); blank
+ * lines and lines starting with '#' are skipped.  Commands are sent as fast
+ * as a window of outstanding commands allows, or with -t at their recorded
+ * times.  -f sends request frames (commands are parsed here) instead of
+ * text lines.
+ *
+ * The device is a serial port or pty (e.g. from cli_sim) given with -d, or
+ * else a simulated device run in-process, with the link set by -b and -L.
+ */
+
+/* Most commands in flight in text mode */
+#define MAX_WINDOW (4096)
+
+/* Longest command sent in text mode, so that any line fits in one write */
+#define MAX_LINE (8191)
+
+/* Seconds without a reply before outstanding commands count as lost */
+#define REPLY_TIMEOUT (2.0)
+
+/* Classes of the reply breakdown */
+enum replay_outcome
+{
+    replay_ok,
+    replay_fail,
+    replay_invalid_argument,
+    replay_pending,
+    replay_unknown_command,
+    replay_invalid_token,
+    replay_too_many_tokens,
+    /* Reply line not in the protocol */
+    replay_unrecognised,
+    replay_lost,
+    replay_outcome_count,
+};
+
+static const char *const outcome_names[] = {
+    [replay_ok] = "OK",
+    [replay_fail] = "FAIL",
+    [replay_invalid_argument] = "INVALID ARGUMENT",
+    [replay_pending] = "PENDING",
+    [replay_unknown_command] = "ERROR UNKNOWN COMMAND",
+    [replay_invalid_token] = "ERROR INVALID TOKEN",
+    [replay_too_many_tokens] = "ERROR TOO MANY TOKENS",
+    [replay_unrecognised] = "unrecognised reply",
+    [replay_lost] = "lost (no reply)",
+};
+
+struct replay_line
+{
+    const char *text;
+    size_t length;
+    /* Recorded time in seconds, negative if the line had none */
+    double time;
+};
+
+struct replay
+{
+    int fd;
+    int window;
+    bool timed;
+    struct replay_line *lines;
+    size_t count;
+    double *latencies;
+    size_t latency_count;
+    unsigned long outcomes[replay_outcome_count];
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Read a log and append its commands, returns -1 if it cannot be read
+ */
+static int load_log(struct replay *replay, const char *name)
+{
+    FILE *file = fopen(name, "r");
+    if (!file) {
+        perror(name);
+        return -1;
+    }
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t lines_capacity = replay->count;
+    while ((length = getline(&line, &capacity, file)) >= 0) {
+        while (length && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = 0;
+        }
+        char *text = line;
+        double time = -1;
+        if (*text == '[') {
+            char *end;
+            time = strtod(text + 1, &end);
+            if (*end != ']') {
+                fprintf(stderr, "%s: bad timestamp: %s\n", name, line);
+                continue;
+            }
+            text = end + 1;
+        }
+        while (*text == ' ') {
+            ++text;
+        }
+        if (!*text || *text == '#') {
+            continue;
+        }
+        if (strlen(text) > MAX_LINE) {
+            fprintf(stderr, "%s: line longer than %d characters skipped\n", name, MAX_LINE);
+            continue;
+        }
+        if (replay->count == lines_capacity) {
+            lines_capacity = lines_capacity ? lines_capacity * 2 : 1024;
+            replay->lines = realloc(replay->lines, lines_capacity * sizeof(*replay->lines));
+        }
+        replay->lines[replay->count++] = (struct replay_line) {
+            .text = strdup(text),
+            .length = strlen(text),
+            .time = time,
+        };
+    }
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+static void record(struct replay *replay, enum replay_outcome outcome, double latency)
+{
+    ++replay->outcomes[outcome];
+    if (outcome != replay_lost && latency >= 0) {
+        replay->latencies[replay->latency_count++] = latency;
+    }
+}
+
+/*
+ * When a line is due relative to the start of the replay, or zero if it may go now
+ */
+static double line_due(const struct replay *replay, size_t index, double start)
+{
+    if (!replay->timed || replay->lines[index].time < 0 || replay->lines[0].time < 0) {
+        return 0;
+    }
+    return start + replay->lines[index].time - replay->lines[0].time;
+}
+
+static enum replay_outcome text_outcome(const char *reply, size_t length)
+{
+    for (int i = 0; i < replay_unrecognised; ++i) {
+        if (strlen(outcome_names[i]) == length && memcmp(reply, outcome_names[i], length) == 0) {
+            return i;
+        }
+    }
+    return replay_unrecognised;
+}
+
+static int replay_text(struct replay *replay)
+{
+    static double sent[MAX_WINDOW];
+    size_t oldest = 0;
+    size_t next = 0;
+    char input[4096];
+    size_t input_used = 0;
+    double start = now();
+    double progress = start;
+    while (oldest < replay->count) {
+        /* Send what the window and the recorded timing allow, in one write */
+        char output[MAX_LINE + 1];
+        size_t output_used = 0;
+        size_t first = next;
+        double time = now();
+        while (next < replay->count && next - oldest < (size_t) replay->window && line_due(replay, next, start) <= time && output_used + replay->lines[next].length + 1 <= sizeof(output)) {
+            memcpy(output + output_used, replay->lines[next].text, replay->lines[next].length);
+            output_used += replay->lines[next].length;
+            output[output_used++] = '\n';
+            ++next;
+        }
+        for (size_t done = 0; done < output_used;) {
+            ssize_t written = write(replay->fd, output + done, output_used - done);
+            if (written < 0 && errno != EINTR) {
+                perror("write");
+                return -1;
+            }
+            done += written > 0 ? written : 0;
+        }
+        time = now();
+        for (size_t i = first; i < next; ++i) {
+            sent[i % MAX_WINDOW] = time;
+        }
+
+        /* Wait for replies, or until the next line is due */
+        double wait = REPLY_TIMEOUT;
+        if (next < replay->count && next - oldest < (size_t) replay->window) {
+            double due = line_due(replay, next, start) - time;
+            wait = due < wait ? (due > 0 ? due : 0) : wait;
+        }
+        struct pollfd pfd = { .fd = replay->fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, (int) (wait * 1000 + 0.999));
+        if (ready < 0 && errno != EINTR) {
+            perror("poll");
+            return -1;
+        }
+        time = now();
+        if (ready <= 0) {
+            if (next != oldest && time - progress > REPLY_TIMEOUT) {
+                break;
+            }
+            continue;
+        }
+        ssize_t size = read(replay->fd, input + input_used, sizeof(input) - input_used);
+        if (size <= 0) {
+            break;
+        }
+        input_used += size;
+        char *line = input;
+        char *end;
+        while ((end = memchr(line, '\n', input + input_used - line)) && oldest < next) {
+            size_t length = end - line - (end > line && end[-1] == '\r');
+            record(replay, text_outcome(line, length), time - sent[oldest % MAX_WINDOW]);
+            ++oldest;
+            progress = time;
+            line = end + 1;
+        }
+        input_used -= line - input;
+        memmove(input, line, input_used);
+        if (input_used == sizeof(input)) {
+            /* Garbage without line breaks */
+            input_used = 0;
+        }
+    }
+    replay->outcomes[replay_lost] += replay->count - oldest;
+    return 0;
+}
+
+static void framed_reply(void *context, unsigned char sequence, const struct cli_reply *reply, double latency)
+{
+    struct replay *replay = context;
+    (void) sequence;
+    if (!reply) {
+        record(replay, replay_lost, latency);
+    } else if (reply->status == cli_reply_executed) {
+        static const enum replay_outcome results[] = {
+            [cli_command_success] = replay_ok,
+            [cli_command_fail] = replay_fail,
+            [cli_command_invalid_argument] = replay_invalid_argument,
+            [cli_command_pending] = replay_pending,
+        };
+        record(replay, reply->code < sizeof(results) / sizeof(results[0]) ? results[reply->code] : replay_fail, latency);
+    } else {
+        record(replay, reply->status == cli_reply_no_match ? replay_unknown_command : replay_invalid_token, latency);
+    }
+}
+
+static int replay_framed(struct replay *replay, const struct cli_language_definition *language)
+{
+    struct cli_client *client = client_create(replay->fd, replay->window > CLI_CLIENT_MAX_WINDOW ? CLI_CLIENT_MAX_WINDOW : replay->window, framed_reply, replay);
+    if (!client) {
+        return -1;
+    }
+    double start = now();
+    int status = 0;
+    size_t i = 0;
+    for (; i < replay->count && status == 0; ++i) {
+        /* Commands which do not parse never leave the host */
+        cli_expression bytecode;
+        enum parse_long_command_result parsed = parse_long_command(language, replay->lines[i].text, replay->lines[i].text + replay->lines[i].length, &bytecode);
+        if (parsed != parse_long_command_success) {
+            record(replay, parsed == parse_long_command_too_many_tokens ? replay_too_many_tokens : replay_invalid_token, -1);
+            continue;
+        }
+        double due;
+        while ((due = line_due(replay, i, start)) > now()) {
+            if (client_flush(client) < 0 || client_poll(client, due - now()) < 0) {
+                status = -1;
+                break;
+            }
+        }
+        if (status == 0) {
+            status = client_submit(client, &bytecode) == -1 ? -1 : 0;
+        }
+        if (status == 0 && replay->timed) {
+            status = client_flush(client);
+        }
+    }
+    if (status == 0) {
+        client_drain(client, REPLY_TIMEOUT);
+    } else {
+        /* Device stopped answering, the rest was never sent */
+        replay->outcomes[replay_lost] += replay->count - i;
+    }
+    client_destroy(client);
+    return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const struct replay *replay, double fraction)
+{
+    size_t index = fraction * (replay->latency_count - 1) + 0.5;
+    return replay->latencies[index] * 1000;
+}
+
+static void report(struct replay *replay, double elapsed)
+{
+    unsigned long answered = replay->latency_count;
+    printf("%zu commands in %.3f s: %.0f commands/s\n", replay->count, elapsed, answered / elapsed);
+    if (answered) {
+        qsort(replay->latencies, answered, sizeof(double), compare_latency);
+        printf("latency ms: min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+            percentile(replay, 0), percentile(replay, 0.5), percentile(replay, 0.9), percentile(replay, 0.99), percentile(replay, 1));
+    }
+    for (int i = 0; i < replay_outcome_count; ++i) {
+        if (replay->outcomes[i]) {
+            printf("%10lu  %s\n", replay->outcomes[i], outcome_names[i]);
+        }
+    }
+}
+
+/*
+ * Open a serial port or pty in raw mode
+ */
+static int open_port(const char *path)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIOFLUSH);
+    }
+    return fd;
+}
+
+int main(int argc, char *argv[])
+{
+    struct replay replay = { .window = 16 };
+    struct cli_device_config config = {
+        .protocol = cli_device_text,
+        .baud = 115200,
+    };
+    const char *port = NULL;
+    const char *image = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "ftw:d:b:L:l:")) != -1) {
+        switch (opt) {
+        case 'f':
+            config.protocol = cli_device_framed;
+            break;
+        case 't':
+            replay.timed = true;
+            break;
+        case 'w':
+            replay.window = atoi(optarg);
+            break;
+        case 'd':
+            port = optarg;
+            break;
+        case 'b':
+            config.baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'L':
+            config.latency = atof(optarg) / 1000;
+            break;
+        case 'l':
+            image = optarg;
+            break;
+        default:
+            optind = argc;
+            break;
+        }
+    }
+    if (optind == argc || replay.window < 1) {
+        fprintf(stderr, "Usage: %s [-f] [-t] [-w window] [-d device] [-b baud] [-L latency ms] [-l image] log...\n", argv[0]);
+        return 2;
+    }
+    if (replay.timed || replay.window > MAX_WINDOW) {
+        replay.window = MAX_WINDOW;
+    }
+    const struct cli_language_definition *language = host_language(image);
+    if (!language) {
+        return 2;
+    }
+    for (int i = optind; i < argc; ++i) {
+        if (load_log(&replay, argv[i]) < 0) {
+            return 2;
+        }
+    }
+    replay.latencies = malloc((replay.count + 1) * sizeof(double));
+
+    struct cli_device *device = NULL;
+    if (port) {
+        replay.fd = open_port(port);
+    } else {
+        int fds[2];
+        replay.fd = socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0 ? fds[0] : -1;
+        device = replay.fd >= 0 ? device_start(language, fds[1], &config) : NULL;
+        if (!device) {
+            perror("device");
+            return 1;
+        }
+    }
+    if (replay.fd < 0 || !replay.latencies) {
+        return 1;
+    }
+
+    double start = now();
+    int status = config.protocol == cli_device_framed ? replay_framed(&replay, language) : replay_text(&replay);
+    double elapsed = now() - start;
+    report(&replay, elapsed);
+
+    if (device) {
+        struct cli_device_stats stats;
+        device_stats(device, &stats);
+        device_stop(device);
+        printf("device: %lu commands, %lu errors, %lu dropped, %lu overflowed, %lu bytes in, %lu bytes out\n",
+            stats.requests, stats.errors, stats.dropped, stats.overflowed, stats.bytes_in, stats.bytes_out);
+    }
+    close(replay.fd);
+    return status < 0 ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "serial_cli_stream.h"
+#include "cli_server.h"
+
+/* Pending reply bytes per session */
+#define SESSION_OUTPUT_SIZE (4096)
+
+/* Bytes read per system call */
+#define READ_CHUNK (1024)
+
+/* Events handled per epoll_wait */
+#define MAX_EVENTS (64)
+
+struct server_session
+{
+    int fd;
+    struct cli_stream_parser parser;
+    cli_expression bytecode;
+    char output[SESSION_OUTPUT_SIZE];
+    size_t output_used;
+    /* EPOLLOUT is registered */
+    bool writing;
+    unsigned long commands;
+    unsigned long errors;
+    unsigned long dropped;
+    struct server_session *next;
+};
+
+struct server_worker
+{
+    struct cli_server *server;
+    pthread_t thread;
+    int epoll_fd;
+    int wake_fd;
+    /* Protects session list and the totals of closed sessions */
+    pthread_mutex_t lock;
+    struct server_session *sessions;
+    struct cli_server_stats closed;
+};
+
+struct cli_server
+{
+    const struct cli_language_definition *language;
+    int running;
+    bool started;
+    int next_worker;
+    int worker_count;
+    struct server_worker workers[];
+};
+
+static const char *command_replies[] = {
+    [cli_command_success] = "OK\n",
+    [cli_command_fail] = "FAIL\n",
+    [cli_command_invalid_argument] = "INVALID ARGUMENT\n",
+    [cli_command_pending] = "PENDING\n",
+};
+
+static void counter_add(unsigned long *counter, unsigned long value)
+{
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+static unsigned long counter_get(const unsigned long *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/*
+ * Update epoll registration for whether output is pending
+ */
+static void session_set_writing(struct server_worker *worker, struct server_session *session, bool writing)
+{
+    if (session->writing == writing) {
+        return;
+    }
+    struct epoll_event event = {
+        .events = EPOLLIN | (writing ? EPOLLOUT : 0),
+        .data.ptr = session,
+    };
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, session->fd, &event);
+    session->writing = writing;
+}
+
+/*
+ * Write as much pending output as the peer accepts
+ */
+static void session_flush(struct server_worker *worker, struct server_session *session)
+{
+    size_t sent = 0;
+    while (sent < session->output_used) {
+        ssize_t n = write(session->fd, session->output + sent, session->output_used - sent);
+        if (n <= 0) {
+            break;
+        }
+        sent += n;
+    }
+    memmove(session->output, session->output + sent, session->output_used - sent);
+    session->output_used -= sent;
+    session_set_writing(worker, session, session->output_used != 0);
+}
+
+static void session_reply(struct server_session *session, const char *reply)
+{
+    size_t length = strlen(reply);
+    if (session->output_used + length > sizeof(session->output)) {
+        counter_add(&session->dropped, length);
+        return;
+    }
+    memcpy(session->output + session->output_used, reply, length);
+    session->output_used += length;
+}
+
+const char *server_execute_line(const struct cli_language_definition *language, enum stream_parser_result result, const cli_expression *bytecode, bool *error)
+{
+    *error = true;
+    if (result == stream_parser_success && CLI_EXPR_IS_TERMINAL((*bytecode)[0])) {
+        /* Blank line */
+        *error = false;
+        return NULL;
+    }
+    if (result != stream_parser_success) {
+        return result == stream_parser_too_many_tokens ? "ERROR TOO MANY TOKENS\n" : "ERROR INVALID TOKEN\n";
+    }
+    enum cli_command_result command_result;
+    if (execute_command(language, bytecode, &command_result) != match_command_success) {
+        return "ERROR UNKNOWN COMMAND\n";
+    }
+    *error = false;
+    return command_replies[command_result];
+}
+
+/*
+ * Execute a completed line and queue its reply
+ */
+static void session_line(struct cli_server *server, struct server_session *session, enum stream_parser_result result)
+{
+    bool error;
+    const char *reply = server_execute_line(server->language, result, &session->bytecode, &error);
+    if (!reply) {
+        return;
+    }
+    counter_add(&session->commands, 1);
+    if (error) {
+        counter_add(&session->errors, 1);
+    }
+    session_reply(session, reply);
+}
+
+static void session_close(struct server_worker *worker, struct server_session *session)
+{
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, session->fd, NULL);
+    close(session->fd);
+    pthread_mutex_lock(&worker->lock);
+    for (struct server_session **it = &worker->sessions; *it; it = &(*it)->next) {
+        if (*it == session) {
+            *it = session->next;
+            break;
+        }
+    }
+    worker->closed.commands += session->commands;
+    worker->closed.errors += session->errors;
+    worker->closed.dropped += session->dropped;
+    pthread_mutex_unlock(&worker->lock);
+    free(session);
+}
+
+/*
+ * Read available input, returns false if the session was closed
+ */
+static bool session_read(struct server_worker *worker, struct server_session *session)
+{
+    char buffer[READ_CHUNK];
+    while (1) {
+        ssize_t n = read(session->fd, buffer, sizeof(buffer));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+            break;
+        }
+        if (n <= 0) {
+            /* End of file, or EIO once a pty slave is closed */
+            session_close(worker, session);
+            return false;
+        }
+        const char *it = buffer;
+        const char *end = buffer + n;
+        while (it != end) {
+            enum stream_parser_result result = stream_parser_feed_chunk(&session->parser, it, end, &it);
+            if (result != stream_parser_pending) {
+                session_line(worker->server, session, result);
+            }
+        }
+    }
+    return true;
+}
+
+static void *worker_run(void *arg)
+{
+    struct server_worker *worker = arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (__atomic_load_n(&worker->server->running, __ATOMIC_ACQUIRE)) {
+        int count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1);
+        for (int i = 0; i < count; ++i) {
+            struct server_session *session = events[i].data.ptr;
+            if (!session) {
+                uint64_t value;
+                if (read(worker->wake_fd, &value, sizeof(value)) < 0) {
+                    /* Nothing to do, loop condition is checked next */
+                }
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!session_read(worker, session)) {
+                    continue;
+                }
+            }
+            session_flush(worker, session);
+        }
+    }
+    return NULL;
+}
+
+struct cli_server *server_create(const struct cli_language_definition *language, int workers)
+{
+    if (workers < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct cli_server *server = calloc(1, sizeof(*server) + workers * sizeof(server->workers[0]));
+    if (!server) {
+        return NULL;
+    }
+    server->language = language;
+    for (int i = 0; i < workers; ++i) {
+        struct server_worker *worker = &server->workers[i];
+        worker->server = server;
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        pthread_mutex_init(&worker->lock, NULL);
+        ++server->worker_count;
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = NULL,
+        };
+        if (worker->epoll_fd < 0 || worker->wake_fd < 0 || epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->wake_fd, &event) < 0) {
+            server_destroy(server);
+            return NULL;
+        }
+    }
+    return server;
+}
+
+int server_add_session(struct cli_server *server, int fd)
+{
+    struct server_session *session = calloc(1, sizeof(*session));
+    if (!session) {
+        return -1;
+    }
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        free(session);
+        return -1;
+    }
+    session->fd = fd;
+    stream_parser_init(&session->parser, server->language, &session->bytecode);
+    struct server_worker *worker = &server->workers[__atomic_fetch_add(&server->next_worker, 1, __ATOMIC_RELAXED) % server->worker_count];
+    pthread_mutex_lock(&worker->lock);
+    session->next = worker->sessions;
+    worker->sessions = session;
+    pthread_mutex_unlock(&worker->lock);
+    struct epoll_event event = {
+        .events = EPOLLIN,
+        .data.ptr = session,
+    };
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        pthread_mutex_lock(&worker->lock);
+        worker->sessions = session->next;
+        pthread_mutex_unlock(&worker->lock);
+        free(session);
+        return -1;
+    }
+    return 0;
+}
+
+int server_start(struct cli_server *server)
+{
+    __atomic_store_n(&server->running, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < server->worker_count; ++i) {
+        if (pthread_create(&server->workers[i].thread, NULL, worker_run, &server->workers[i]) != 0) {
+            server->worker_count = i;
+            server->started = true;
+            server_stop(server);
+            return -1;
+        }
+    }
+    server->started = true;
+    return 0;
+}
+
+void server_stop(struct cli_server *server)
+{
+    if (!server->started) {
+        return;
+    }
+    __atomic_store_n(&server->running, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < server->worker_count; ++i) {
+        uint64_t value = 1;
+        if (write(server->workers[i].wake_fd, &value, sizeof(value)) < 0) {
+            /* Counter is already non-zero */
+        }
+    }
+    for (int i = 0; i < server->worker_count; ++i) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+    server->started = false;
+}
+
+void server_destroy(struct cli_server *server)
+{
+    server_stop(server);
+    for (int i = 0; i < server->worker_count; ++i) {
+        struct server_worker *worker = &server->workers[i];
+        while (worker->sessions) {
+            session_close(worker, worker->sessions);
+        }
+        if (worker->epoll_fd >= 0) {
+            close(worker->epoll_fd);
+        }
+        if (worker->wake_fd >= 0) {
+            close(worker->wake_fd);
+        }
+        pthread_mutex_destroy(&worker->lock);
+    }
+    free(server);
+}
+
+void server_stats(struct cli_server *server, struct cli_server_stats *stats)
+{
+    *stats = (struct cli_server_stats) { 0 };
+    for (int i = 0; i < server->worker_count; ++i) {
+        struct server_worker *worker = &server->workers[i];
+        pthread_mutex_lock(&worker->lock);
+        stats->commands += worker->closed.commands;
+        stats->errors += worker->closed.errors;
+        stats->dropped += worker->closed.dropped;
+        for (struct server_session *session = worker->sessions; session; session = session->next) {
+            ++stats->sessions;
+            stats->commands += counter_get(&session->commands);
+            stats->errors += counter_get(&session->errors);
+            stats->dropped += counter_get(&session->dropped);
+        }
+        pthread_mutex_unlock(&worker->lock);
+    }
+}
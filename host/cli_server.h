@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * Host-side multi-session runtime: serves a language on many file descriptors
+ * (pty masters, serial ports, sockets) at once.  Each session has its own
+ * stream parser; sessions are sharded over worker threads, each running one
+ * epoll loop, so there is no thread per port.
+ *
+ * Replies are one line per command:
+ *
+ *   OK | FAIL | INVALID ARGUMENT | PENDING  handler result
+ *   ERROR TOO MANY TOKENS | ERROR INVALID TOKEN | ERROR UNKNOWN COMMAND
+ *
+ * Handlers run on worker threads, concurrently for different sessions.
+ */
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+#include "serial_cli_stream.h"
+
+struct cli_server;
+
+struct cli_server_stats
+{
+    int sessions;
+    /* Lines received */
+    unsigned long commands;
+    /* Lines which did not parse or match */
+    unsigned long errors;
+    /* Reply bytes dropped because a peer was not reading */
+    unsigned long dropped;
+};
+
+/*
+ * Create a server with given number of worker threads, returns NULL on failure
+ */
+struct cli_server *server_create(const struct cli_language_definition *language, int workers);
+
+/*
+ * Attach a file descriptor as a new session, the server takes ownership of it.
+ * May be called before or after server_start.  Returns -1 on failure.
+ */
+int server_add_session(struct cli_server *server, int fd);
+
+/*
+ * Start worker threads, returns -1 on failure
+ */
+int server_start(struct cli_server *server);
+
+/*
+ * Stop and join worker threads
+ */
+void server_stop(struct cli_server *server);
+
+/*
+ * Close all sessions and free the server (stops it first if running)
+ */
+void server_destroy(struct cli_server *server);
+
+/*
+ * Totals over all sessions
+ */
+void server_stats(struct cli_server *server, struct cli_server_stats *stats);
+
+/*
+ * Run a line completed by a stream parser, returns its reply line, or NULL
+ * for a blank line.  error is set if the line did not parse or match.
+ */
+const char *server_execute_line(const struct cli_language_definition *language, enum stream_parser_result result, const cli_expression *bytecode, bool *error);
@@ -0,0 +1,81 @@
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cli_device.h"
+#include "host_language.h"
+
+/*
+ * Simulated device on a pty, for host tools which expect a serial port:
+ *
+ *   cli_sim [-f] [-b baud] [-L latency ms] [-l image]
+ *
+ * Prints the pty path, then serves the language (see host_language.h) as
+ * text lines, or request frames with -f, until interrupted, and prints its
+ * counters on exit.
+ */
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal)
+{
+    (void) signal;
+    stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    struct cli_device_config config = {
+        .protocol = cli_device_text,
+        .baud = 115200,
+    };
+    const char *image = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "fb:L:l:")) != -1) {
+        switch (opt) {
+        case 'f':
+            config.protocol = cli_device_framed;
+            break;
+        case 'b':
+            config.baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'L':
+            config.latency = atof(optarg) / 1000;
+            break;
+        case 'l':
+            image = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-f] [-b baud] [-L latency ms] [-l image]\n", argv[0]);
+            return 2;
+        }
+    }
+    const struct cli_language_definition *language = host_language(image);
+    if (!language) {
+        return 2;
+    }
+    char path[256];
+    struct cli_device *device = device_start_pty(language, &config, path, sizeof(path));
+    if (!device) {
+        perror("pty");
+        return 1;
+    }
+    printf("%s\n", path);
+    fflush(stdout);
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    while (!stopping) {
+        pause();
+    }
+
+    struct cli_device_stats stats;
+    device_stats(device, &stats);
+    device_stop(device);
+    fprintf(stderr, "%lu commands, %lu errors, %lu dropped, %lu overflowed, %lu bytes in, %lu bytes out\n",
+        stats.requests, stats.errors, stats.dropped, stats.overflowed, stats.bytes_in, stats.bytes_out);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "serial_cli_image.h"
+#include "host_language.h"
+
+#ifndef CLI_HOST_LANGUAGE
+#define CLI_HOST_LANGUAGE test_language
+#endif
+
+extern const struct cli_language_definition CLI_HOST_LANGUAGE;
+
+static CLI_COMMAND_HANDLER(stub_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    return cli_command_success;
+}
+
+const struct cli_language_definition *host_language(const char *image)
+{
+    static cli_command_handler *handlers[0xff];
+    static struct cli_command_definition commands[CLI_MAX_COMMANDS + 1];
+    static struct cli_language_image loaded;
+    if (!image) {
+        return &CLI_HOST_LANGUAGE;
+    }
+    int fd = open(image, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(image);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+    const unsigned char *data = mmap(NULL, st.st_size ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(image);
+        return NULL;
+    }
+    for (int i = 0; i < 0xff; ++i) {
+        handlers[i] = stub_handler;
+    }
+    enum language_image_load_result result = language_image_load(&loaded, data, st.st_size, handlers, 0xff, commands, CLI_MAX_COMMANDS + 1);
+    if (result != language_image_load_success) {
+        fprintf(stderr, "%s: invalid language image (%d)\n", image, result);
+        return NULL;
+    }
+    return &loaded.language;
+}
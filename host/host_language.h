@@ -0,0 +1,16 @@
+#pragma once
+
+/*
+ * Language of the host tools: the one linked in (HOST_LANGUAGE in the
+ * Makefile, built with stub handlers), or one loaded from a language image
+ * (see serial_cli_image.h) with every handler ID bound to a stub.  Stub
+ * handlers succeed without doing anything.
+ */
+
+#include "serial_cli.h"
+
+/*
+ * Linked language if image is NULL, else the image's (memory-mapped).
+ * Returns NULL, with a message on stderr, if the image cannot be loaded.
+ */
+const struct cli_language_definition *host_language(const char *image);
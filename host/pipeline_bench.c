@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli_client.h"
+#include "cli_device.h"
+
+/*
+ * Runs the pipelining client against a simulated device over a local socket
+ * pair, with the link throttled to a baud rate and a fixed reply latency,
+ * and reports commands per second for a range of window sizes.  With a
+ * window of one, throughput is bound by the round trip; with a large enough
+ * window, by the link bandwidth.
+ *
+ *   pipeline_bench [commands] [baud] [latency ms]
+ */
+
+enum {
+    kw_get,
+    kw_set,
+    kw_led,
+};
+
+#define KWIDX(name) CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(kw_##name)
+
+static CLI_COMMAND_HANDLER(bench_handler, bytecode, arguments, definition)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) definition;
+    return cli_command_success;
+}
+
+static const struct cli_language_definition bench_language = {
+    .keywords = (const cli_keyword[]) { "get", "set", "led", NULL },
+    .commands = (const struct cli_command_definition[]) {
+        {
+            .syntax = { KWIDX(get), KWIDX(led), CLI_SPEC_NUMBER },
+            .handler = bench_handler,
+        },
+        {
+            .syntax = { KWIDX(set), KWIDX(led), CLI_SPEC_NUMBER, CLI_SPEC_NUMBER },
+            .handler = bench_handler,
+        },
+        {
+            .handler = NULL,
+        },
+    },
+};
+
+struct bench_totals
+{
+    unsigned long succeeded;
+    double latency;
+};
+
+static void count_reply(void *context, unsigned char sequence, const struct cli_reply *reply, double latency)
+{
+    struct bench_totals *totals = context;
+    (void) sequence;
+    if (reply && reply->status == cli_reply_executed && reply->code == cli_command_success) {
+        ++totals->succeeded;
+    }
+    totals->latency += latency;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int run(int count, const struct cli_device_config *config, int window)
+{
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    struct cli_device *device = device_start(&bench_language, fds[1], config);
+    struct bench_totals totals = { 0 };
+    struct cli_client *client = client_create(fds[0], window, count_reply, &totals);
+    if (!device || !client) {
+        perror("setup");
+        return -1;
+    }
+    cli_expression commands[2];
+    parse_long_command(&bench_language, "get led 3", NULL, &commands[0]);
+    parse_long_command(&bench_language, "set led 3 1", NULL, &commands[1]);
+
+    double start = now();
+    int status = 0;
+    for (int i = 0; i < count && status == 0; ++i) {
+        status = client_submit(client, &commands[i % 2]);
+    }
+    if (status == 0) {
+        status = client_drain(client, 1.0);
+    }
+    double elapsed = now() - start;
+
+    struct cli_client_stats stats;
+    client_stats(client, &stats);
+    printf("window %3d  %8.0f commands/s  mean latency %7.2f ms  (%lu sent, %lu ok, %lu lost)\n",
+        window, stats.replies / elapsed, stats.sent ? totals.latency / stats.sent * 1000 : 0, stats.sent, totals.succeeded, stats.lost);
+    client_destroy(client);
+    device_stop(device);
+    close(fds[0]);
+    return status == 0 && totals.succeeded == (unsigned long) count ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 2000;
+    struct cli_device_config config = {
+        .protocol = cli_device_framed,
+        .baud = argc > 2 ? strtoul(argv[2], NULL, 0) : 115200,
+        .latency = (argc > 3 ? atof(argv[3]) : 2.0) / 1000,
+    };
+    printf("%d commands, %lu baud, %.1f ms latency\n", count, config.baud, config.latency * 1000);
+    int status = 0;
+    for (int window = 1; window <= 64; window *= 2) {
+        status |= run(count, &config, window);
+    }
+    return status ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cli_server.h"
+
+/*
+ * Drives a server over local pty pairs: the server owns the masters, this
+ * program plays the devices' peers on the slaves with a window of outstanding
+ * commands per session, and reports commands per second for several worker
+ * counts.
+ *
+ *   server_bench [sessions] [commands per session] [window]
+ */
+
+enum {
+    kw_get,
+    kw_set,
+    kw_led,
+    kw_potato,
+    kw_count,
+};
+
+#define KWIDX(name) CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(kw_##name)
+
+enum {
+    cmd_get_led,
+    cmd_set_led,
+    cmd_get_potato_count,
+};
+
+static const cli_keyword bench_keywords[] = {
+    [kw_get] = "get",
+    [kw_set] = "set",
+    [kw_led] = "led",
+    [kw_potato] = "potato",
+    [kw_count] = "count",
+    NULL,
+};
+
+static CLI_COMMAND_HANDLER(bench_handler, bytecode, arguments, definition)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) definition;
+    return cli_command_success;
+}
+
+static const struct cli_command_definition bench_commands[] = {
+    [cmd_get_led] = {
+        .syntax = { KWIDX(get), KWIDX(led), CLI_SPEC_NUMBER },
+        .handler = bench_handler,
+    },
+    [cmd_set_led] = {
+        .syntax = { KWIDX(set), KWIDX(led), CLI_SPEC_NUMBER, CLI_SPEC_NUMBER },
+        .handler = bench_handler,
+    },
+    [cmd_get_potato_count] = {
+        .syntax = { KWIDX(get), KWIDX(potato), KWIDX(count) },
+        .handler = bench_handler,
+    },
+    {
+        .handler = NULL,
+    },
+};
+
+static const struct cli_language_definition bench_language = {
+    .keywords = bench_keywords,
+    .commands = bench_commands,
+};
+
+static const char *bench_lines[] = {
+    "get led 3\n",
+    "set led 3 1\n",
+    "get potato count\n",
+    "set led 0x10 -1\n",
+};
+
+#define BENCH_LINE_COUNT (sizeof(bench_lines) / sizeof(bench_lines[0]))
+
+struct client
+{
+    int fd;
+    int sent;
+    int received;
+    int line;
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Open a pty pair, returns master and sets *slave (raw mode, non-blocking)
+ */
+static int open_pty(int *slave)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        return -1;
+    }
+    *slave = open(ptsname(master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (*slave < 0) {
+        close(master);
+        return -1;
+    }
+    struct termios tio;
+    tcgetattr(*slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(*slave, TCSANOW, &tio);
+    /* The master side must not echo or translate either */
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+    return master;
+}
+
+static void client_send(struct client *client, int count, int window)
+{
+    while (client->sent < count && client->sent - client->received < window) {
+        const char *line = bench_lines[client->line];
+        if (write(client->fd, line, strlen(line)) < 0) {
+            return;
+        }
+        client->line = (client->line + 1) % BENCH_LINE_COUNT;
+        ++client->sent;
+    }
+}
+
+static int run(int workers, int sessions, int count, int window)
+{
+    struct cli_server *server = server_create(&bench_language, workers);
+    struct client *clients = calloc(sessions, sizeof(*clients));
+    int epoll_fd = epoll_create1(0);
+    if (!server || !clients || epoll_fd < 0) {
+        perror("setup");
+        return -1;
+    }
+    for (int i = 0; i < sessions; ++i) {
+        int master = open_pty(&clients[i].fd);
+        if (master < 0 || server_add_session(server, master) < 0) {
+            perror("pty");
+            return -1;
+        }
+        clients[i].line = i % BENCH_LINE_COUNT;
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &clients[i] };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, clients[i].fd, &event);
+    }
+    if (server_start(server) < 0) {
+        perror("start");
+        return -1;
+    }
+
+    double start = now();
+    for (int i = 0; i < sessions; ++i) {
+        client_send(&clients[i], count, window);
+    }
+    int done = 0;
+    struct epoll_event events[64];
+    while (done < sessions) {
+        int n = epoll_wait(epoll_fd, events, 64, 1000);
+        if (n == 0) {
+            fprintf(stderr, "timeout waiting for replies\n");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            struct client *client = events[i].data.ptr;
+            char buffer[4096];
+            ssize_t size = read(client->fd, buffer, sizeof(buffer));
+            for (ssize_t j = 0; j < size; ++j) {
+                client->received += buffer[j] == '\n';
+            }
+            client_send(client, count, window);
+            if (client->received == count && size > 0) {
+                ++done;
+            }
+        }
+    }
+    double elapsed = now() - start;
+
+    struct cli_server_stats stats;
+    server_stats(server, &stats);
+    printf("workers %2d  sessions %4d  window %3d  %10.0f commands/s  (%lu commands, %lu errors, %lu dropped)\n",
+        workers, stats.sessions, window, stats.commands / elapsed, stats.commands, stats.errors, stats.dropped);
+
+    server_destroy(server);
+    for (int i = 0; i < sessions; ++i) {
+        close(clients[i].fd);
+    }
+    close(epoll_fd);
+    free(clients);
+    return stats.errors == 0 && stats.commands == (unsigned long) sessions * count ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int sessions = argc > 1 ? atoi(argv[1]) : 32;
+    int count = argc > 2 ? atoi(argv[2]) : 5000;
+    int window = argc > 3 ? atoi(argv[3]) : 8;
+    int status = 0;
+    for (int workers = 1; workers <= 8; workers *= 2) {
+        status |= run(workers, sessions, count, window);
+    }
+    return status ? 1 : 0;
+}
@@ -1,30 +1,83 @@
-#include <stdbool.h>
-#include <stdio.h>
+#include "serial_cli_internal.h"
+#include "serial_cli_instrument.h"
 
-#include "serial_cli.h"
-
-#ifndef NULL
-#define NULL ((void *) 0)
+#if defined(CLI_TOKENIZER_SWAR) || defined(CLI_TOKENIZER_SSE2)
+#include <string.h>
+#define CLI_TOKENIZER_WIDE
 #endif
 
-/* Define bools if not done already in headers */
-#ifndef FALSE
-#define FALSE (0)
-#define TRUE (!(FALSE))
+#if defined(CLI_TOKENIZER_SWAR)
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "CLI_TOKENIZER_SWAR requires a little-endian target"
 #endif
 
-/* Delimiter in long-format commands */
-#define CLI_LONG_SPACE ' '
+/* Bytes per block */
+#define CLI_TOKENIZER_BLOCK (8)
+
+typedef unsigned long long tokenizer_block;
+
+/* Block with every byte set to value */
+#define SWAR_BYTES(value) (0x0101010101010101ULL * (unsigned char) (value))
+
+/* Flag (top bit) set in each zero byte, only the lowest flag is exact */
+#define SWAR_ZERO_BYTES(word) (((word) - SWAR_BYTES(0x01)) & ~(word) & SWAR_BYTES(0x80))
+
+/* Flag (top bit) set in each non-zero byte, exact */
+#define SWAR_NONZERO_BYTES(word) (((((word) & SWAR_BYTES(0x7f)) + SWAR_BYTES(0x7f)) | (word)) & SWAR_BYTES(0x80))
+
+/*
+ * Offset of first space/non-space (or null) in a block, or block size if none
+ */
+static int find_space_block(const char *it, bool space)
+{
+    tokenizer_block word;
+    memcpy(&word, it, sizeof(word));
+    tokenizer_block spaces = word ^ SWAR_BYTES(CLI_LONG_SPACE);
+    tokenizer_block mask = space ? SWAR_ZERO_BYTES(spaces) | SWAR_ZERO_BYTES(word) : SWAR_NONZERO_BYTES(spaces);
+    return mask ? __builtin_ctzll(mask) / 8 : CLI_TOKENIZER_BLOCK;
+}
+
+/*
+ * Test equality of two blocks
+ */
+static bool block_equal(const char *a, const char *b)
+{
+    tokenizer_block x;
+    tokenizer_block y;
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+    return x == y;
+}
+
+#elif defined(CLI_TOKENIZER_SSE2)
+
+#include <emmintrin.h>
+
+/* Bytes per block */
+#define CLI_TOKENIZER_BLOCK (16)
+
+/*
+ * Offset of first space/non-space (or null) in a block, or block size if none
+ */
+static int find_space_block(const char *it, bool space)
+{
+    __m128i block = _mm_loadu_si128((const __m128i *) it);
+    int spaces = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(CLI_LONG_SPACE)));
+    int mask = space ? spaces | _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_setzero_si128())) : ~spaces & 0xffff;
+    return mask ? __builtin_ctz(mask) : CLI_TOKENIZER_BLOCK;
+}
+
+/*
+ * Test equality of two blocks
+ */
+static bool block_equal(const char *a, const char *b)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *) a);
+    __m128i y = _mm_loadu_si128((const __m128i *) b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) == 0xffff;
+}
 
-/* Log CLI parse errors */
-#ifdef CLI_DEBUG_PARSER
-#define parse_error_printf(format, ...) printf(format "\n", ##__VA_ARGS__)
-#define parse_error_printf_str(format, begin, end, ...) parse_error_printf(format " (token: %*.*s)", ##__VA_ARGS__, (int) (end - begin), (int) (end - begin), begin)
-#define parse_error_printf_token(format, token, ...) parse_error_printf(format " (opcode: 0x%04x)", ##__VA_ARGS__, token)
-#else
-#define parse_error_printf(...) do { } while (0)
-#define parse_error_printf_str(...) do { } while (0)
-#define parse_error_printf_token(...) do { } while (0)
 #endif
 
 /*
@@ -35,8 +88,18 @@ static const char *find_space(const char *begin, const char *end, bool space)
     if (!begin) {
         return NULL;
     }
-    const char *it;
-    for (it = begin; it != end && *it; ++it) {
+    const char *it = begin;
+#ifdef CLI_TOKENIZER_WIDE
+    /* Whole blocks, only where the range is bounded */
+    for (; end && end - it >= CLI_TOKENIZER_BLOCK; it += CLI_TOKENIZER_BLOCK) {
+        int offset = find_space_block(it, space);
+        if (offset != CLI_TOKENIZER_BLOCK) {
+            it += offset;
+            return space || *it ? it : NULL;
+        }
+    }
+#endif
+    for (; it != end && *it; ++it) {
         if ((*it == CLI_LONG_SPACE) == space) {
             return it;
         }
@@ -52,6 +115,20 @@ static bool string_equal(const char *begin, const char *end, const char *other)
     if (!begin) {
         return FALSE;
     }
+#ifdef CLI_TOKENIZER_WIDE
+    if (end) {
+        /* Length check first, then both strings are known to be readable */
+        size_t length = end - begin;
+        if (strnlen(other, length + 1) != length) {
+            return FALSE;
+        }
+        for (; end - begin >= CLI_TOKENIZER_BLOCK; begin += CLI_TOKENIZER_BLOCK, other += CLI_TOKENIZER_BLOCK) {
+            if (!block_equal(begin, other)) {
+                return FALSE;
+            }
+        }
+    }
+#endif
     for (; begin != end && *other; ++begin, ++other) {
         if (*begin != *other) {
             return FALSE;
@@ -60,6 +137,7 @@ static bool string_equal(const char *begin, const char *end, const char *other)
     return begin == end && !*other;
 }
 
+#ifndef CLI_NO_NUMBERS
 enum parse_int_result
 {
     parse_int_success,
@@ -68,39 +146,88 @@ enum parse_int_result
 };
 
 /*
- * Parse an integer from string range, and return byte-code for it
+ * Value of a digit in given base, or base if not a digit
  */
-static enum parse_int_result parse_int(expression_token *result, const char *begin, const char *end)
+static unsigned char digit_value(char ch, unsigned char base)
+{
+    unsigned char digit = base;
+    if (ch >= '0' && ch <= '9') {
+        digit = ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+        digit = ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+        digit = ch - 'A' + 10;
+    }
+    return digit < base ? digit : base;
+}
+
+/*
+ * Parse an integer (decimal, or hexadecimal with 0x prefix) from string range
+ * in a single pass, checking the magnitude for overflow of the 32-bit wide
+ * number range, or of the bytecode range if not wide.  Wide hexadecimal values
+ * above 0x7fffffff wrap to negative, as 32-bit registers.
+ */
+static enum parse_int_result parse_number(long *result, const char *begin, const char *end, bool wide)
 {
     const char *it = begin;
     bool negative = *it == '-';
     if (negative) {
         ++it;
     }
-    int value = 0;
+    unsigned char base = 10;
+    unsigned long limit = negative ? -(unsigned long) CLI_WIDE_NUMBER_MIN : (unsigned long) CLI_WIDE_NUMBER_MAX;
+    if (!wide) {
+        /* As the stream parser: the magnitude is checked before narrowing */
+        limit = CLI_NUMBER_ABSMAX;
+    }
+    if (end - it > 2 && it[0] == '0' && (it[1] == 'x' || it[1] == 'X')) {
+        base = 16;
+        it += 2;
+        if (!negative && wide) {
+            limit = 0xffffffffUL;
+        }
+    }
+    unsigned long value = 0;
     for (; it != end; ++it) {
-        char ch = *it;
-        if (ch < '0' || ch > '9') {
-            parse_error_printf_str("Invalid digit: %c", begin, end, ch);
+        unsigned char digit = digit_value(*it, base);
+        if (digit == base) {
+            parse_error_printf_str("Invalid digit: %c", begin, end, *it);
             return parse_int_fail;
         }
-        value *= 10;
-        value += ch - '0';
-        if (value > CLI_NUMBER_ABSMAX) {
-            parse_error_printf_str("Numeric value out of range: %d", begin, end, value);
+        if (value > (limit - digit) / base) {
+            parse_error_printf_str("Numeric value out of range", begin, end);
             return parse_int_out_of_range;
         }
+        value = value * base + digit;
     }
     if (negative) {
-        value = -value;
+        *result = value ? -(long) (value - 1) - 1 : 0;
+    } else if (value > (unsigned long) CLI_WIDE_NUMBER_MAX) {
+        *result = -(long) (0xffffffffUL - value) - 1;
+    } else {
+        *result = value;
+    }
+    return parse_int_success;
+}
+
+/*
+ * Parse an integer from string range, and return byte-code for it
+ */
+static enum parse_int_result parse_int(expression_token *result, const char *begin, const char *end)
+{
+    long value;
+    enum parse_int_result parsed = parse_number(&value, begin, end, FALSE);
+    if (parsed != parse_int_success) {
+        return parsed;
     }
     if (value < CLI_NUMBER_MIN || value > CLI_NUMBER_MAX) {
-        parse_error_printf_str("Numeric value out of range: %d", begin, end, value);
+        parse_error_printf_str("Numeric value out of range: %ld", begin, end, value);
         return parse_int_out_of_range;
     }
     *result = CLI_INT_TO_EXPR_NUMBER(value);
     return parse_int_success;
 }
+#endif
 
 enum parse_keyword_result
 {
@@ -108,11 +235,105 @@ enum parse_keyword_result
     parse_keyword_fail,
 };
 
+#ifndef CLI_NO_KEYWORD_INDEX
+/*
+ * Find child of keyword index node by character, returns zero if not found
+ */
+unsigned short keyword_index_child(const struct cli_keyword_index_node *nodes, unsigned short node, char ch)
+{
+    const struct cli_keyword_index_node *first = nodes + nodes[node].child;
+    unsigned short count = nodes[node].children;
+    /* Children without gaps between their characters (always the case for one child) are indexed directly */
+    unsigned char offset = (unsigned char) ch - (unsigned char) first->ch;
+    if (offset < count && first[offset].ch == ch) {
+        return first + offset - nodes;
+    }
+    /* Binary search for the last child not after ch */
+    while (count > 1) {
+        unsigned short half = count / 2;
+        if ((unsigned char) first[half].ch <= (unsigned char) ch) {
+            first += half;
+        }
+        count -= half;
+    }
+    return count && first->ch == ch ? first - nodes : 0;
+}
+
+/*
+ * Parse a keyword from a string range via the keyword index: the word is
+ * walked down to the only keyword with its prefix, then compared as a whole
+ * when the keyword text is at hand
+ */
+static bool parse_keyword_indexed(expression_token *token, const char *begin, const char *end, const struct cli_language_definition *language)
+{
+    const struct cli_keyword_index_node *nodes = language->keyword_index->nodes;
+    const cli_keyword *keywords = language->keywords;
+    unsigned short node = 0;
+    for (const char *it = begin; it != end; ++it) {
+        if (nodes[node].unique && keywords) {
+            /* The characters so far are known to match */
+            if (!string_equal(it, end, keywords[nodes[node].unique - 1] + (it - begin))) {
+                return parse_keyword_fail;
+            }
+            *token = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(nodes[node].unique - 1);
+            return parse_keyword_success;
+        }
+        node = keyword_index_child(nodes, node, *it);
+        if (!node) {
+            return parse_keyword_fail;
+        }
+    }
+    if (!nodes[node].keyword) {
+        return parse_keyword_fail;
+    }
+    *token = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(nodes[node].keyword - 1);
+    return parse_keyword_success;
+}
+#endif
+
+/*
+ * Parse a keyword from a string range via the keyword pool, lengths are
+ * compared before any characters
+ */
+static bool parse_keyword_pooled(expression_token *token, const char *begin, const char *end, const unsigned char *pool)
+{
+    bool grouped = *pool & CLI_KEYWORD_POOL_GROUPED;
+    unsigned long length = end - begin;
+    unsigned char index = 0;
+    for (const unsigned char *entry = pool + 1; *entry; entry += *entry + 1, ++index) {
+        if (*entry == length) {
+            const char *it = begin;
+            const char *text = (const char *) entry + 1;
+            for (; it != end && *it == *text; ++it, ++text) {
+            }
+            if (it == end) {
+                *token = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(index);
+                return parse_keyword_success;
+            }
+        } else if (grouped && *entry > length) {
+            break;
+        }
+    }
+    return parse_keyword_fail;
+}
+
 /*
  * Parse a keyword from a string range, and return byte-code for it
  */
-static bool parse_keyword(expression_token *token, const char *begin, const char *end, const cli_keyword *keywords)
+static bool parse_keyword(expression_token *token, const char *begin, const char *end, const struct cli_language_definition *language)
 {
+    if (language->keyword_lookup) {
+        return language->keyword_lookup(token, begin, end) ? parse_keyword_success : parse_keyword_fail;
+    }
+#ifndef CLI_NO_KEYWORD_INDEX
+    if (language->keyword_index) {
+        return parse_keyword_indexed(token, begin, end, language);
+    }
+#endif
+    if (language->keyword_pool) {
+        return parse_keyword_pooled(token, begin, end, language->keyword_pool);
+    }
+    const cli_keyword *keywords = language->keywords;
     for (const cli_keyword *keyword = keywords; *keyword; ++keyword) {
         if (string_equal(begin, end, *keyword)) {
             *token = (keyword - keywords) + CLI_EXPR_KEYWORD_BEGIN;
@@ -122,69 +343,235 @@ static bool parse_keyword(expression_token *token, const char *begin, const char
     return parse_keyword_fail;
 }
 
-//enum cli_command_syntax_validation
-//{
-//    cli_next_invalid = 0x00,
-//    cli_next_terminal = 0x01,
-//    cli_next_keyword = 0x02,
-//    cli_next_number = 0x04,
-//};
-//
-///*
-// * Return set of valid token types that can follow the current prefix
-// */
-// enum cli_command_syntax_validation next_token(const cli_command_syntax *command_specs, const cli_expression *prefix, int length)
-// {
-//     if (length > CLI_MAX_TOKENS) {
-//         return 0x00;
-//     }
-//     const expression_token * const prefix_end = *prefix + length;
-//     enum cli_command_syntax_validation next = 0x00;
-//     /* Iterate over command specificatoins */
-//     for (const cli_command_syntax *specs_it = command_specs; *specs_it; ++specs_it) {
-//         /* Iterate over tokens of command specification and tokens of prefix */
-//         const syntax_token *spec_it = *specs_it;
-//         const expression_token *prefix_it = *prefix;
-//         while (prefix_it != prefix_end) {
-//             syntax_token spec_token = *spec_it;
-//             expression_token prefix_token = *prefix_it;
-//             if (CLI_SPEC_IS_TERMINAL(spec_token)) {
-//                 /* Reached end of command spec before end of prefix */
-//                 break;
-//             } else if (CLI_SPEC_IS_KEYWORD(spec_token) && spec_token != CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(prefix_token)) {
-//                 /* Keyword is not the same as in the spec */
-//                 break;
-//             } else if (CLI_SPEC_IS_NUMBER(spec_token) && !CLI_EXPR_IS_NUMBER(prefix_token)) {
-//                 /* Not anumber but a number is in the spec */
-//                 break;
-//             }
-//             ++spec_it;
-//             ++prefix_it;
-//             if (prefix_it == prefix_end) {
-//                 /* Reached end of prefix, study next token of command spec */
-//                 spec_token = *spec_it;
-//                 if (CLI_SPEC_IS_TERMINAL(spec_token)) {
-//                     next |= cli_next_terminal;
-//                 } else if (CLI_SPEC_IS_KEYWORD(spec_token)) {
-//                     next |= cli_next_keyword;
-//                 } else if (CLI_SPEC_IS_NUMBER(spec_token)) {
-//                     next |= cli_next_number;
-//                 }
-//             }
-//         }
-//     }
-//     return next;
-// }
+/*
+ * Text of a keyword by index, from either keyword storage
+ */
+const char *keyword_text(const struct cli_language_definition *language, int index, unsigned char *length)
+{
+    if (language->keyword_pool) {
+        const unsigned char *entry = language->keyword_pool + 1;
+        for (; *entry && index; entry += *entry + 1, --index) {
+        }
+        if (!*entry) {
+            return NULL;
+        }
+        *length = *entry;
+        return (const char *) entry + 1;
+    }
+    const cli_keyword *keyword = language->keywords;
+    for (; *keyword && index; ++keyword, --index) {
+    }
+    if (!*keyword) {
+        return NULL;
+    }
+    for (*length = 0; (*keyword)[*length]; ++*length) {
+    }
+    return *keyword;
+}
+
+/*
+ * Bytecode of a single keyword, via the same lookup as the parser (but not
+ * counted as a parse)
+ */
+expression_token keyword_token(const struct cli_language_definition *language, const char *word)
+{
+    const char *end = word;
+    for (; *end; ++end) {
+    }
+    expression_token token;
+    if (parse_keyword(&token, word, end, language) != parse_keyword_success) {
+        return CLI_EXPR_TERMINAL;
+    }
+    return token;
+}
 
+#ifndef CLI_NO_KEYWORD_INDEX
 /*
- * Parse a long command to bytecode
+ * Test whether a keyword starts with the first length characters of prefix
  */
-enum parse_long_command_result parse_long_command(const struct cli_language_definition *spec, const char *command, const char *command_end, cli_expression *parsed)
+static bool keyword_has_prefix(const char *keyword, const char *prefix, unsigned short length)
+{
+    for (; length; --length, ++keyword, ++prefix) {
+        if (*keyword != *prefix) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Create keyword index nodes breadth-first, so that the children of each node
+ * are consecutive and sorted by character.  With dense_root, the children of
+ * the root include fillers (without a character, which no word contains) for
+ * the characters between theirs.  Returns the node count, zero if capacity is
+ * exceeded.
+ */
+static unsigned short keyword_index_nodes(const cli_keyword *keywords, struct cli_keyword_index_node *nodes, unsigned short capacity, bool dense_root)
+{
+    unsigned short count = 1;
+    nodes[0] = (struct cli_keyword_index_node) { 0 };
+    /* Until a node is expanded, unique holds a keyword which it is a prefix of and child the length of that prefix */
+    for (unsigned short node = 0; node < count; ++node) {
+        if (node && !nodes[node].ch) {
+            continue;
+        }
+        const char *prefix = keywords[nodes[node].unique];
+        unsigned short length = nodes[node].child;
+        unsigned short first = count;
+        bool matched = FALSE;
+        nodes[node].unique = 0;
+        for (const cli_keyword *keyword = keywords; *keyword; ++keyword) {
+            if (!keyword_has_prefix(*keyword, prefix, length)) {
+                continue;
+            }
+            /* Duplicates count as several keywords, the walk then finds the first */
+            nodes[node].unique = matched ? 0 : (keyword - keywords) + 1;
+            matched = TRUE;
+            /* First definition wins, as with the linear search */
+            if (!(*keyword)[length] && !nodes[node].keyword) {
+                nodes[node].keyword = (keyword - keywords) + 1;
+            }
+        }
+        for (unsigned char last = 0;;) {
+            const cli_keyword *next = NULL;
+            for (const cli_keyword *keyword = keywords; *keyword; ++keyword) {
+                if (keyword_has_prefix(*keyword, prefix, length) && (unsigned char) (*keyword)[length] > last && (!next || (unsigned char) (*keyword)[length] < (unsigned char) (*next)[length])) {
+                    next = keyword;
+                }
+            }
+            if (!next) {
+                break;
+            }
+            unsigned char ch = (*next)[length];
+            for (; dense_root && !node && count > first && ++last < ch; ++count) {
+                if (count == capacity) {
+                    return 0;
+                }
+                nodes[count] = (struct cli_keyword_index_node) { 0 };
+            }
+            if (count == capacity) {
+                return 0;
+            }
+            nodes[count++] = (struct cli_keyword_index_node) {
+                .ch = ch,
+                .unique = next - keywords,
+                .child = length + 1,
+            };
+            last = ch;
+        }
+        nodes[node].child = count > first ? first : 0;
+        nodes[node].children = count - first;
+    }
+    return count;
+}
+
+/*
+ * Build a keyword index for a keywords list, into caller-provided nodes
+ */
+enum build_keyword_index_result build_keyword_index(const cli_keyword *keywords, struct cli_keyword_index_node *nodes, unsigned short capacity, struct cli_keyword_index *index)
+{
+    for (const cli_keyword *keyword = keywords; *keyword; ++keyword) {
+        if (keyword - keywords >= CLI_RANGE_KEYWORD) {
+            return build_keyword_index_too_many_keywords;
+        }
+    }
+    unsigned short count = capacity ? keyword_index_nodes(keywords, nodes, capacity, FALSE) : 0;
+    if (!count) {
+        return build_keyword_index_too_many_nodes;
+    }
+    /*
+     * The root has the most children: index them directly where capacity
+     * allows, and at most half of them would be fillers
+     */
+    unsigned short children = nodes[0].children;
+    unsigned short range = children ? (unsigned char) nodes[children].ch - (unsigned char) nodes[1].ch + 1 : 0;
+    if (range > children && range <= 2 * children && range - children <= capacity - count) {
+        count = keyword_index_nodes(keywords, nodes, capacity, TRUE);
+    }
+    index->nodes = nodes;
+    index->count = count;
+    return build_keyword_index_success;
+}
+#endif
+
+#ifndef CLI_NO_COMMAND_TREE
+/*
+ * Find child of command tree node by syntax token, returns zero if not found
+ */
+static unsigned short command_tree_child(const struct cli_command_tree_node *nodes, unsigned short node, syntax_token token)
+{
+    unsigned short child;
+    for (child = nodes[node].child; child && nodes[child].token != token; child = nodes[child].sibling) {
+    }
+    return child;
+}
+
+/*
+ * Build a command tree for a commands list, into caller-provided nodes
+ */
+enum build_command_tree_result build_command_tree(const struct cli_command_definition *commands, struct cli_command_tree_node *nodes, unsigned short capacity, struct cli_command_tree *tree)
+{
+    if (capacity == 0) {
+        return build_command_tree_too_many_nodes;
+    }
+    unsigned short count = 1;
+    nodes[0] = (struct cli_command_tree_node) { 0 };
+    for (const struct cli_command_definition *command_it = commands; command_it->handler; ++command_it) {
+        if (command_it - commands >= CLI_MAX_COMMANDS) {
+            return build_command_tree_too_many_commands;
+        }
+        unsigned short node = 0;
+        for (
+            const syntax_token *syntax_it = &command_it->syntax[0], *syntax_end = syntax_it + CLI_MAX_TOKENS;
+            syntax_it != syntax_end && !CLI_SPEC_IS_TERMINAL(*syntax_it);
+            ++syntax_it
+        ) {
+            if (!CLI_SPEC_IS_KEYWORD(*syntax_it) && !CLI_SPEC_IS_NUMBER(*syntax_it)) {
+                return build_command_tree_invalid_token;
+            }
+            unsigned short child = command_tree_child(nodes, node, *syntax_it);
+            if (!child) {
+                if (count == capacity) {
+                    return build_command_tree_too_many_nodes;
+                }
+                child = count++;
+                nodes[child] = (struct cli_command_tree_node) {
+                    .token = *syntax_it,
+                    .sibling = nodes[node].child,
+                };
+                nodes[node].child = child;
+            }
+            node = child;
+        }
+        /* First definition wins, as with the linear search */
+        if (!nodes[node].command) {
+            nodes[node].command = (command_it - commands) + 1;
+        }
+    }
+    tree->nodes = nodes;
+    tree->count = count;
+    return build_command_tree_success;
+}
+#endif
+
+/*
+ * Parse a long command to bytecode, with optional side array for wide numbers
+ */
+static enum parse_long_command_result parse_long_command_numbers(const struct cli_language_definition *spec, const char *command, const char *command_end, cli_expression *parsed, struct cli_number_slots *numbers)
 {
     const char *it = command;
     expression_token *out_it = *parsed;
     expression_token *out_end = *parsed + CLI_MAX_TOKENS;
     const char *word_begin;
+    if (numbers) {
+        numbers->count = 0;
+    }
+#ifdef CLI_TOKENIZER_WIDE
+    /* Blocks are only used for bounded ranges */
+    if (command && !command_end) {
+        command_end = command + strlen(command);
+    }
+#endif
     while ((word_begin = find_space(it, command_end, FALSE))) {
         if (out_it == out_end) {
             /* Max tokens already parsed */
@@ -195,10 +582,23 @@ enum parse_long_command_result parse_long_command(const struct cli_language_defi
         parse_error_printf_str("Token:", word_begin, word_end);
         it = word_end;
         expression_token token = 0;
-        if (parse_keyword(&token, word_begin, word_end, spec->keywords) == parse_keyword_success) {
+#ifndef CLI_NO_NUMBERS
+        long value;
+#endif
+        if (parse_keyword(&token, word_begin, word_end, spec) == parse_keyword_success) {
             /* Keyword matches have highest precedence */
-        } else if (parse_int(&token, word_begin, word_end) == parse_int_success) {
+#ifndef CLI_NO_NUMBERS
+        } else if (!numbers && parse_int(&token, word_begin, word_end) == parse_int_success) {
             /* Integer value */
+        } else if (numbers && parse_number(&value, word_begin, word_end, TRUE) == parse_int_success) {
+            /* Integer value, in side array if it does not fit in the bytecode */
+            if (value >= CLI_NUMBER_MIN && value <= CLI_NUMBER_MAX && CLI_EXPR_IS_NUMBER(CLI_INT_TO_EXPR_NUMBER(value))) {
+                token = CLI_INT_TO_EXPR_NUMBER(value);
+            } else {
+                token = CLI_INDEX_TO_EXPR_SLOT(numbers->count);
+                numbers->value[numbers->count++] = value;
+            }
+#endif
         } else {
             parse_error_printf_str("Unrecognised token:", word_begin, word_end);
             return parse_long_command_invalid_token;
@@ -212,103 +612,400 @@ enum parse_long_command_result parse_long_command(const struct cli_language_defi
 }
 
 /*
- * Match a bytecode command to the respective definition
+ * Parse a long command to bytecode
  */
-enum match_command_result match_command(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result)
+enum parse_long_command_result parse_long_command(const struct cli_language_definition *spec, const char *command, const char *command_end, cli_expression *parsed)
 {
-    *result = NULL;
+    CLI_INSTRUMENT_START(start);
+    return CLI_INSTRUMENT_PARSE(spec, start, parse_long_command_numbers(spec, command, command_end, parsed, NULL));
+}
+
+/*
+ * Parse a long command to bytecode, numbers outside the bytecode range go to a side array
+ */
+enum parse_long_command_result parse_long_command_wide(const struct cli_language_definition *spec, const char *command, const char *command_end, struct cli_wide_expression *parsed)
+{
+    CLI_INSTRUMENT_START(start);
+    return CLI_INSTRUMENT_PARSE(spec, start, parse_long_command_numbers(spec, command, command_end, &parsed->bytecode, &parsed->numbers));
+}
+
+/*
+ * Value of number token at position, from bytecode or from the wide number side array
+ */
+long expression_number(const cli_expression *bytecode, int position)
+{
+    expression_token token = (*bytecode)[position];
+    if (CLI_EXPR_IS_SLOT(token)) {
+        /* Slot tokens only exist in wide expressions, of which bytecode is the first member */
+        const struct cli_wide_expression *wide = (const struct cli_wide_expression *) bytecode;
+        return wide->numbers.value[CLI_EXPR_SLOT_TO_INDEX(token)];
+    }
+    return CLI_EXPR_NUMBER_TO_INT(token);
+}
+
+/*
+ * Copy part of a command, wide numbers keep their slots
+ */
+void copy_expression(const cli_expression *value, int begin, int end, struct cli_wide_expression *copy)
+{
+    int length = 0;
+    copy->numbers.count = 0;
+    for (int i = begin; i < end && !CLI_EXPR_IS_TERMINAL((*value)[i]); ++i) {
+        expression_token token = (*value)[i];
+        copy->bytecode[length++] = token;
+        if (CLI_EXPR_IS_SLOT(token)) {
+            /* Slot tokens only exist in wide expressions, of which bytecode is the first member */
+            const struct cli_wide_expression *wide = (const struct cli_wide_expression *) value;
+            int slot = CLI_EXPR_SLOT_TO_INDEX(token);
+            copy->numbers.value[slot] = wide->numbers.value[slot];
+            if (slot >= copy->numbers.count) {
+                copy->numbers.count = slot + 1;
+            }
+        }
+    }
+    for (; length < CLI_MAX_TOKENS; ++length) {
+        copy->bytecode[length] = CLI_EXPR_TERMINAL;
+    }
+}
+
+#ifndef CLI_NO_COMMAND_TREE
+/*
+ * Match a bytecode command to the respective definition via the command tree
+ */
+static enum match_command_result match_command_tree(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result)
+{
+    const struct cli_command_tree_node *nodes = language->command_tree->nodes;
+    unsigned short node = 0;
+    for (
+        const expression_token *value_it = *value, *value_end = value_it + CLI_MAX_TOKENS;
+        value_it != value_end && !CLI_EXPR_IS_TERMINAL(*value_it);
+        ++value_it
+    ) {
+        syntax_token token;
+        if (CLI_EXPR_IS_KEYWORD(*value_it)) {
+            token = CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(*value_it);
+        } else if (CLI_EXPR_IS_ANY_NUMBER(*value_it)) {
+            token = CLI_SPEC_NUMBER;
+        } else {
+            return match_command_fail;
+        }
+        node = command_tree_child(nodes, node, token);
+        if (!node) {
+            return match_command_fail;
+        }
+    }
+    if (!nodes[node].command) {
+        return match_command_fail;
+    }
+    *result = &language->commands[nodes[node].command - 1];
+    return match_command_success;
+}
+#endif
+
+/*
+ * Match a bytecode command against one command definition
+ */
+static enum match_command_result match_syntax(const struct cli_command_definition *command, const cli_expression *value)
+{
+    /* Iterate over tokens of command specification and tokens of command */
+    const syntax_token *syntax_it = &command->syntax[0];
+    const syntax_token *syntax_end = syntax_it + CLI_MAX_TOKENS;
+    const expression_token *value_it = *value;
+    const expression_token *value_end = value_it + CLI_MAX_TOKENS;
+    while (1) {
+        bool syntax_terminal = syntax_it == syntax_end || CLI_SPEC_IS_TERMINAL(*syntax_it);
+        bool value_terminal = value_it == value_end || CLI_EXPR_IS_TERMINAL(*value_it);
+        if (syntax_terminal || value_terminal) {
+            /* Lengths differ */
+            if (syntax_terminal != value_terminal) {
+                return match_command_fail;
+            }
+            return match_command_success;
+        } else if (CLI_SPEC_IS_KEYWORD(*syntax_it)) {
+            /* Keyword */
+            if (*syntax_it != CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(*value_it)) {
+                /* Keyword is not the same as in the spec */
+                return match_command_fail;
+            }
+        } else if (CLI_SPEC_IS_NUMBER(*syntax_it)) {
+            /* Number */
+            if (!CLI_EXPR_IS_ANY_NUMBER(*value_it)) {
+                /* Not a number but a number is in the spec */
+                return match_command_fail;
+            }
+        } else {
+            /* Invalid token */
+            parse_error_printf_token("Unrecognised token: ", *value_it);
+            return match_command_invalid_token;
+        }
+        ++syntax_it;
+        ++value_it;
+    }
+}
+
+/*
+ * Match a bytecode command to the respective definition, without the cache
+ */
+static enum match_command_result match_command_uncached(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result)
+{
+    if (language->command_lookup) {
+        *result = language->command_lookup(value);
+        return *result ? match_command_success : match_command_fail;
+    }
+#ifndef CLI_NO_COMMAND_TREE
+    if (language->command_tree) {
+        return match_command_tree(language, value, result);
+    }
+#endif
     /* Iterate over command specificatoins */
     for (const struct cli_command_definition *command_it = &language->commands[0]; command_it->handler; ++command_it) {
-        /* Iterate over tokens of command specification and tokens of command */
-        const syntax_token *syntax_it = &command_it->syntax[0];
-        const syntax_token *syntax_end = syntax_it + CLI_MAX_TOKENS;
-        const expression_token *value_it = *value;
-        const expression_token *value_end = value_it + CLI_MAX_TOKENS;
-        while (1) {
-            bool syntax_terminal = syntax_it == syntax_end || CLI_SPEC_IS_TERMINAL(*syntax_it);
-            bool value_terminal = value_it == value_end || CLI_EXPR_IS_TERMINAL(*value_it);
-            if (syntax_terminal || value_terminal) {
-                /* Lengths differ */
-                if (syntax_terminal != value_terminal) {
-                    break;
-                }
+        enum match_command_result match = match_syntax(command_it, value);
+        if (match != match_command_fail) {
+            if (match == match_command_success) {
                 *result = command_it;
-                return match_command_success;
-            } else if (CLI_SPEC_IS_KEYWORD(*syntax_it)) {
-                /* Keyword */
-                if (*syntax_it != CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(*value_it)) {
-                    /* Keyword is not the same as in the spec */
-                    break;
-                }
-            } else if (CLI_SPEC_IS_NUMBER(*syntax_it)) {
-                /* Number */
-                if (!CLI_EXPR_IS_NUMBER(*value_it)) {
-                    /* Not a number but a number is in the spec */
-                    break;
-                }
-            } else {
-                /* Invalid token */
-                parse_error_printf_token("Unrecognised token: ", *value_it);
-                return match_command_invalid_token;
             }
-            ++syntax_it;
-            ++value_it;
+            return match;
         }
     }
     return match_command_fail;
 }
 
+#ifndef CLI_NO_MATCH_CACHE
+/*
+ * Hash of the shape of a bytecode command: keywords, and positions of numbers
+ */
+static unsigned short expression_shape_hash(const cli_expression *value)
+{
+    unsigned short hash = 0;
+    for (
+        const expression_token *value_it = *value, *value_end = value_it + CLI_MAX_TOKENS;
+        value_it != value_end && !CLI_EXPR_IS_TERMINAL(*value_it);
+        ++value_it
+    ) {
+        hash = hash * 31 + (CLI_EXPR_IS_ANY_NUMBER(*value_it) ? CLI_SPEC_NUMBER : *value_it);
+    }
+    return hash ^ (hash >> 8);
+}
+
+/*
+ * Match a bytecode command to the respective definition, via the dispatch cache if any
+ */
+static enum match_command_result match_command_cached(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result)
+{
+    *result = NULL;
+    struct cli_match_cache *cache = language->match_cache;
+    if (!cache) {
+        return match_command_uncached(language, value, result);
+    }
+    /* Cached definition is verified, so hash collisions cannot give a wrong match */
+    unsigned short hash = expression_shape_hash(value);
+    struct cli_match_cache_entry *entry = &cache->entries[hash % CLI_MATCH_CACHE_SIZE];
+    if (entry->command && entry->hash == hash) {
+        const struct cli_command_definition *command = &language->commands[entry->command - 1];
+        if (match_syntax(command, value) == match_command_success) {
+            ++cache->hits;
+            *result = command;
+            return match_command_success;
+        }
+    }
+    ++cache->misses;
+    enum match_command_result match = match_command_uncached(language, value, result);
+    if (match == match_command_success) {
+        entry->hash = hash;
+        entry->command = (*result - language->commands) + 1;
+    }
+    return match;
+}
+#endif
+
+/*
+ * Match a bytecode command to the respective handler callback
+ */
+enum match_command_result match_command(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result)
+{
+    CLI_INSTRUMENT_START(start);
+#ifdef CLI_NO_MATCH_CACHE
+    return CLI_INSTRUMENT_MATCH(language, start, match_command_uncached(language, value, result));
+#else
+    return CLI_INSTRUMENT_MATCH(language, start, match_command_cached(language, value, result));
+#endif
+}
+
 /*
- * Debug print bytecode command
+ * Match a bytecode command, and collect its number arguments
  */
-void _print_bytecode(const struct cli_language_definition *language, const cli_expression *bytecode)
+enum match_command_result match_command_arguments(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result, struct cli_arguments *arguments)
 {
-    const expression_token * const begin = *bytecode;
-    const expression_token * const end = begin + CLI_MAX_TOKENS;
-    printf("Bytecode dump: \"");
-    for (const expression_token *it = begin; it != end && !CLI_EXPR_IS_TERMINAL(*it); ++it) {
-        if (it != *bytecode) {
-            printf("%c", CLI_LONG_SPACE);
+    enum match_command_result match = match_command(language, value, result);
+    if (match != match_command_success || !arguments) {
+        return match;
+    }
+    /* A matched command has numbers exactly where its syntax does */
+    arguments->count = 0;
+    for (int i = 0; i < CLI_MAX_TOKENS && !CLI_EXPR_IS_TERMINAL((*value)[i]); ++i) {
+        if (CLI_EXPR_IS_ANY_NUMBER((*value)[i])) {
+            arguments->value[arguments->count++] = expression_number(value, i);
         }
+    }
+    return match;
+}
+
+/*
+ * Match a bytecode command and run its handler with the argument view
+ */
+enum match_command_result execute_command(const struct cli_language_definition *language, const cli_expression *value, enum cli_command_result *result)
+{
+    const struct cli_command_definition *def;
+    struct cli_arguments arguments;
+    enum match_command_result match = match_command_arguments(language, value, &def, &arguments);
+    if (match == match_command_success) {
+        CLI_INSTRUMENT_START(start);
+        *result = CLI_INSTRUMENT_HANDLER(language, def, start, def->handler(value, &arguments, def));
+    }
+    return match;
+}
+
+/*
+ * Match the command of a call and run its handler with the argument view
+ */
+enum match_command_result execute_call(const struct cli_language_definition *language, struct cli_call *call, enum cli_command_result *result)
+{
+    const struct cli_command_definition *def;
+    enum match_command_result match = match_command_arguments(language, &call->expression.bytecode, &def, &call->arguments);
+    if (match == match_command_success) {
+        CLI_INSTRUMENT_START(start);
+        *result = CLI_INSTRUMENT_HANDLER(language, def, start, def->handler(&call->expression.bytecode, &call->arguments, def));
+    }
+    return match;
+}
+
+#ifndef CLI_NO_COMPLETION
+/*
+ * Add a syntax token to a next-token set
+ */
+static void next_tokens_add(struct cli_next_tokens *next, syntax_token token)
+{
+    if (CLI_SPEC_IS_KEYWORD(token)) {
+        int index = CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(token);
+        next->types |= cli_next_keyword;
+        next->keywords[index / 8] |= 1 << (index % 8);
+    } else if (CLI_SPEC_IS_NUMBER(token)) {
+        next->types |= cli_next_number;
+    }
+}
+
+#ifndef CLI_NO_COMMAND_TREE
+/*
+ * Next-token set via the command tree
+ */
+static void next_tokens_tree(const struct cli_language_definition *language, const cli_expression *prefix, int length, struct cli_next_tokens *next)
+{
+    const struct cli_command_tree_node *nodes = language->command_tree->nodes;
+    unsigned short node = 0;
+    for (const expression_token *it = *prefix, *end = it + length; it != end; ++it) {
+        syntax_token token;
         if (CLI_EXPR_IS_KEYWORD(*it)) {
-            int index = CLI_EXPR_KEYWORD_TO_KEYWORD_INDEX(*it);
-            printf("%s", language->keywords[index]);
-        } else if (CLI_EXPR_IS_NUMBER(*it)) {
-            int value = CLI_EXPR_NUMBER_TO_INT(*it);
-            printf("%d", value);
+            token = CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(*it);
+        } else if (CLI_EXPR_IS_ANY_NUMBER(*it)) {
+            token = CLI_SPEC_NUMBER;
         } else {
-            printf("<error:0x%04hx>", (expression_token) *it);
+            return;
+        }
+        node = command_tree_child(nodes, node, token);
+        if (!node) {
+            return;
         }
     }
-    printf("\" (");
-    for (const expression_token *it = begin; it != end && !CLI_EXPR_IS_TERMINAL(*it); ++it) {
-        if (it != *bytecode) {
-            printf(" ");
+    if (nodes[node].command) {
+        next->types |= cli_next_terminal;
+    }
+    for (unsigned short child = nodes[node].child; child; child = nodes[child].sibling) {
+        next_tokens_add(next, nodes[child].token);
+    }
+}
+#endif
+
+/*
+ * Next-token set by scanning all command specifications
+ */
+static void next_tokens_linear(const struct cli_language_definition *language, const cli_expression *prefix, int length, struct cli_next_tokens *next)
+{
+    for (const struct cli_command_definition *command_it = &language->commands[0]; command_it->handler; ++command_it) {
+        const syntax_token *syntax_it = &command_it->syntax[0];
+        const expression_token *prefix_it = *prefix;
+        const expression_token *prefix_end = prefix_it + length;
+        for (; prefix_it != prefix_end; ++syntax_it, ++prefix_it) {
+            if (CLI_SPEC_IS_KEYWORD(*syntax_it) && *syntax_it == CLI_EXPR_KEYWORD_TO_SPEC_KEYWORD(*prefix_it)) {
+                continue;
+            } else if (CLI_SPEC_IS_NUMBER(*syntax_it) && CLI_EXPR_IS_ANY_NUMBER(*prefix_it)) {
+                continue;
+            }
+            break;
+        }
+        if (prefix_it != prefix_end) {
+            continue;
+        }
+        if (length == CLI_MAX_TOKENS || CLI_SPEC_IS_TERMINAL(*syntax_it)) {
+            next->types |= cli_next_terminal;
+        } else {
+            next_tokens_add(next, *syntax_it);
         }
-        printf("%04hx", (expression_token) *it);
     }
-    printf(")\n");
 }
 
-void list_all_commands(const struct cli_language_definition *language)
+/*
+ * Return set of valid token types that can follow the current prefix
+ */
+enum cli_next_token next_tokens(const struct cli_language_definition *language, const cli_expression *prefix, int length, struct cli_next_tokens *next)
+{
+    *next = (struct cli_next_tokens) { 0 };
+    if (length < 0 || length > CLI_MAX_TOKENS) {
+        return cli_next_invalid;
+    }
+#ifndef CLI_NO_COMMAND_TREE
+    if (language->command_tree) {
+        next_tokens_tree(language, prefix, length, next);
+        return next->types;
+    }
+#endif
+    next_tokens_linear(language, prefix, length, next);
+    return next->types;
+}
+
+/*
+ * Complete a partial keyword from those permitted by a next-token set
+ */
+int complete_keyword(const struct cli_language_definition *language, const struct cli_next_tokens *next, const char *begin, const char *end, int *completion, int *common)
 {
-	printf(PRINTF_LINEBREAK "Commands:" PRINTF_LINEBREAK);
-	for (const struct cli_command_definition *cmd = language->commands; cmd->handler; ++cmd) {
-		printf(">>>");
-		for (
-			const syntax_token *token = &cmd->syntax[0], *end = token + CLI_MAX_TOKENS;
-			token != end && !CLI_SPEC_IS_TERMINAL(*token);
-			++token
-		) {
-			if (CLI_SPEC_IS_KEYWORD(*token)) {
-				printf(" %s", language->keywords[CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(*token)]);
-			} else if (CLI_SPEC_IS_NUMBER(*token)) {
-				printf(" #");
-			} else {
-				printf(" !");
-			}
-		}
-		printf(PRINTF_LINEBREAK);
-	}
-	printf(PRINTF_LINEBREAK);
+    int count = 0;
+    const char *first = NULL;
+    *common = 0;
+    for (int index = 0; index < CLI_RANGE_KEYWORD; ++index) {
+        if (!(next->keywords[index / 8] & (1 << (index % 8)))) {
+            continue;
+        }
+        unsigned char length;
+        const char *keyword = keyword_text(language, index, &length);
+        if (!keyword || length < end - begin) {
+            continue;
+        }
+        const char *it = begin;
+        for (const char *text = keyword; it != end && *text == *it; ++it, ++text) {
+        }
+        if (it != end) {
+            continue;
+        }
+        if (!count++) {
+            first = keyword;
+            *completion = index;
+            *common = length;
+        } else {
+            int shared = 0;
+            for (; shared < *common && shared < length && keyword[shared] == first[shared]; ++shared) {
+            }
+            *common = shared;
+        }
+    }
+    return count;
 }
+#endif
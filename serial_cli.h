@@ -3,6 +3,24 @@
 /* Enable a load of annoying noisy debug messages */
 // #define CLI_DEBUG_PARSER
 
+/*
+ * Feature switches, define to leave a subsystem out of small builds (see make
+ * footprint).  Unused functions are already dropped by --gc-sections, these
+ * also remove the paths reached via the language definition.
+ */
+/* Numbers in the text parsers (number tokens from bytecode still match) */
+// #define CLI_NO_NUMBERS
+/* Keyword prefix trees: no build_keyword_index, keyword_index is ignored */
+// #define CLI_NO_KEYWORD_INDEX
+/* Command prefix trees: no build_command_tree, command_tree is ignored */
+// #define CLI_NO_COMMAND_TREE
+/* Dispatch cache: match_cache is ignored */
+// #define CLI_NO_MATCH_CACHE
+/* Next-token prediction and keyword completion */
+// #define CLI_NO_COMPLETION
+/* Command listing: no list_all_commands */
+// #define CLI_NO_LIST
+
 /* A specification for a token */
 typedef unsigned char syntax_token;
 
@@ -42,10 +60,20 @@ typedef unsigned short expression_token;
 #define CLI_EXPR_NUMBER_BEGIN ((expression_token) (0xe000))
 #define CLI_EXPR_NUMBER_END ((expression_token) ((CLI_EXPR_NUMBER_BEGIN) + (CLI_RANGE_NUMBER)))
 
+/* Bytecode values referring to the wide number side array (see cli_wide_expression) */
+#define CLI_EXPR_SLOT_BEGIN ((expression_token) 0xd000)
+#define CLI_EXPR_SLOT_END ((expression_token) ((CLI_EXPR_SLOT_BEGIN) + (CLI_MAX_TOKENS)))
+
+/* Permitted range of wide numbers (32-bit) */
+#define CLI_WIDE_NUMBER_MIN (-2147483647L - 1)
+#define CLI_WIDE_NUMBER_MAX (2147483647L)
+
 /* Predicates for parsing bytecode */
 #define CLI_EXPR_IS_TERMINAL(token) ((token) == (CLI_EXPR_TERMINAL))
 #define CLI_EXPR_IS_KEYWORD(token) ((token) >= (CLI_EXPR_KEYWORD_BEGIN) && (token) < (CLI_EXPR_KEYWORD_END))
 #define CLI_EXPR_IS_NUMBER(token) ((token) >= (CLI_EXPR_NUMBER_BEGIN) && (token) < (CLI_EXPR_NUMBER_END))
+#define CLI_EXPR_IS_SLOT(token) ((token) >= (CLI_EXPR_SLOT_BEGIN) && (token) < (CLI_EXPR_SLOT_END))
+#define CLI_EXPR_IS_ANY_NUMBER(token) (CLI_EXPR_IS_NUMBER(token) || CLI_EXPR_IS_SLOT(token))
 
 /* Convert keyword bytecode value to index in keywords list / or back */
 #define CLI_EXPR_KEYWORD_TO_KEYWORD_INDEX(token) ((token) - (CLI_EXPR_KEYWORD_BEGIN))
@@ -62,41 +90,180 @@ typedef unsigned short expression_token;
 #define CLI_EXPR_NUMBER_TO_INT(token) ((int) ((expression_token) (token) - (CLI_EXPR_NUMBER_BEGIN)) + (CLI_NUMBER_MIN))
 #define CLI_INT_TO_EXPR_NUMBER(value) ((expression_token) ((int) (value) - (CLI_NUMBER_MIN)) + (CLI_EXPR_NUMBER_BEGIN))
 
+/* Convert slot bytecode value to index in the wide number side array, or back */
+#define CLI_EXPR_SLOT_TO_INDEX(token) ((token) - (CLI_EXPR_SLOT_BEGIN))
+#define CLI_INDEX_TO_EXPR_SLOT(index) ((expression_token) ((index) + (CLI_EXPR_SLOT_BEGIN)))
+
 /* Keyword is defined by reference to a null-terminated string */
 typedef const char *cli_keyword;
 
+/*
+ * Alternative keyword storage: one contiguous pool of length-prefixed strings,
+ * saving a pointer and a terminator per keyword:
+ *
+ *   [flags] [length] [chars...] [length] [chars...] ... [0]
+ *
+ * With CLI_KEYWORD_POOL_GROUPED, keywords are in order of length, and lookups
+ * stop at the first longer keyword.  Keyword indices are in pool order.
+ *
+ * Declare a pool from an X-macro list of keywords (which must be valid
+ * identifiers, as they also name the enum constants):
+ *
+ *   #define MY_KEYWORDS(X) X(to) X(get) X(set) X(potato)
+ *   CLI_KEYWORD_POOL(my_pool, MY_KEYWORDS, CLI_KEYWORD_POOL_GROUPED);
+ *   enum { MY_KEYWORDS(CLI_KEYWORD_POOL_ENUM) };  (kw_to, kw_get, ...)
+ *
+ * and point the language at CLI_KEYWORD_POOL_DATA(my_pool).
+ */
+#define CLI_KEYWORD_POOL_GROUPED (0x01)
+
+/* Character arrays in the pool are not terminated */
+#if defined(__GNUC__) && __GNUC__ >= 8
+#define CLI_NONSTRING __attribute__((__nonstring__))
+#else
+#define CLI_NONSTRING
+#endif
+
+#define CLI_KEYWORD_POOL_MEMBER(word) struct { unsigned char length; char text[sizeof(#word) - 1] CLI_NONSTRING; } kw_##word;
+#define CLI_KEYWORD_POOL_ENTRY(word) { sizeof(#word) - 1, #word },
+#define CLI_KEYWORD_POOL_ENUM(word) kw_##word,
+
+#define CLI_KEYWORD_POOL(name, list, flags) \
+    const struct { unsigned char pool_flags; list(CLI_KEYWORD_POOL_MEMBER) unsigned char end; } name = { (flags), list(CLI_KEYWORD_POOL_ENTRY) 0 }
+#define CLI_KEYWORD_POOL_DATA(name) ((const unsigned char *) &(name))
+
 /* Command specification is defined by array of tokens (trailing slots should be TERMINAL) */
 typedef const syntax_token cli_command_syntax[CLI_MAX_TOKENS];
 
 /* Bytecode is an array of bytecode values (trailing slots should be TERMINAL) */
 typedef expression_token cli_expression[CLI_MAX_TOKENS];
 
+/* Full-width values of numbers which do not fit in a bytecode token */
+struct cli_number_slots
+{
+    long value[CLI_MAX_TOKENS];
+    unsigned char count;
+};
+
+/* Bytecode with side array for wide numbers, slot tokens refer into the side array */
+struct cli_wide_expression
+{
+    /* Must be first: handlers receive a pointer to this member */
+    cli_expression bytecode;
+    struct cli_number_slots numbers;
+};
+
 /* Result of executing a command */
 enum cli_command_result
 {
     cli_command_success,
     cli_command_fail,
     cli_command_invalid_argument,
+    /* Not finished, call again later (only for handlers run by a cli_scheduler) */
+    cli_command_pending,
 };
 
 struct cli_command_definition;
+struct cli_arguments;
 
-/* Signature of command handler, called to execute command */
-#define CLI_COMMAND_HANDLER(handler_name, arg_bytecode, arg_definition) \
+/* Signature of command handler, called to execute command with its argument view */
+#define CLI_COMMAND_HANDLER(handler_name, arg_bytecode, arg_arguments, arg_definition) \
 	enum cli_command_result \
 	handler_name( \
 		const cli_expression *arg_bytecode, \
+		const struct cli_arguments *arg_arguments, \
 		const struct cli_command_definition *arg_definition \
 	)
-typedef CLI_COMMAND_HANDLER(cli_command_handler, bytecode, def);
+typedef CLI_COMMAND_HANDLER(cli_command_handler, bytecode, arguments, def);
+
+/* Command flags */
+#define CLI_COMMAND_READ_ONLY (0x01)
 
 /* Definition of a command: Specification of syntax, and handler callback */
 struct cli_command_definition
 {
     cli_command_syntax syntax;
     cli_command_handler *handler;
+    /* CLI_COMMAND_* flags, READ_ONLY commands may be run periodically by telemetry */
+    unsigned char flags;
+};
+
+/* Node of a keyword prefix tree, node zero is the root (empty string) */
+struct cli_keyword_index_node
+{
+    /* Character which leads from the parent to this node */
+    char ch;
+    /* Index of keyword which ends at this node plus one, or zero if none */
+    unsigned char keyword;
+    /* Index of the only keyword with this prefix plus one, or zero if there are several */
+    unsigned char unique;
+    /* Children are consecutive nodes sorted by character: count, and index of the first */
+    unsigned char children;
+    unsigned short child;
+};
+
+/* Precompiled keyword lookup: cost depends on token length (and the log of each node's fan-out), not keyword count */
+struct cli_keyword_index
+{
+    const struct cli_keyword_index_node *nodes;
+    unsigned short count;
+};
+
+/* Upper bound on nodes required to index keywords with given total length (with room to spare, the root's children are indexed directly, taking at most twice as many nodes) */
+#define CLI_KEYWORD_INDEX_NODES(total_chars) ((total_chars) + 1)
+
+/* Node of a command syntax prefix tree, node zero is the root (empty command) */
+struct cli_command_tree_node
+{
+    /* Syntax token which leads from the parent to this node */
+    syntax_token token;
+    /* Index of command which ends at this node plus one, or zero if none */
+    unsigned char command;
+    /* Index of first child and of next sibling, or zero if none */
+    unsigned short child;
+    unsigned short sibling;
+};
+
+/* Precompiled command matcher: one step per token, regardless of command count */
+struct cli_command_tree
+{
+    const struct cli_command_tree_node *nodes;
+    unsigned short count;
+};
+
+/* Upper bound on nodes required to index given number of commands */
+#define CLI_COMMAND_TREE_NODES(commands) ((commands) * (CLI_MAX_TOKENS) + 1)
+
+/* Specialised keyword lookup (e.g. generated by tools/cli_gen), returns non-zero on match */
+typedef int cli_keyword_lookup(expression_token *token, const char *begin, const char *end);
+
+/* Specialised command lookup (e.g. generated by tools/cli_gen), returns NULL if no match */
+typedef const struct cli_command_definition *cli_command_lookup(const cli_expression *value);
+
+/* Entries in the dispatch cache */
+#ifndef CLI_MATCH_CACHE_SIZE
+#define CLI_MATCH_CACHE_SIZE (8)
+#endif
+
+struct cli_match_cache_entry
+{
+    /* Hash of the command shape (keywords and number positions) */
+    unsigned short hash;
+    /* Index of command plus one, or zero if empty */
+    unsigned char command;
 };
 
+/* Direct-mapped cache of recently matched commands, checked before the full match */
+struct cli_match_cache
+{
+    struct cli_match_cache_entry entries[CLI_MATCH_CACHE_SIZE];
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/* Statistics, see serial_cli_instrument.h */
+struct cli_instrument;
+
 /* Language specification: Keyword LUT and command syntax definitions */
 struct cli_language_definition
 {
@@ -104,8 +271,58 @@ struct cli_language_definition
     const cli_keyword *keywords;
     /* Terminated by entry with NULL members */
     const struct cli_command_definition *commands;
+    /* Optional, built from keywords via build_keyword_index (or stored in ROM) */
+    const struct cli_keyword_index *keyword_index;
+    /* Optional, built from commands via build_command_tree (or stored in ROM) */
+    const struct cli_command_tree *command_tree;
+    /* Optional, take precedence over the tables and indices above */
+    cli_keyword_lookup *keyword_lookup;
+    cli_command_lookup *command_lookup;
+    /* Optional, zero-initialised, updated by match_command (not thread-safe) */
+    struct cli_match_cache *match_cache;
+    /* Alternative to keywords (which must then be NULL), see CLI_KEYWORD_POOL */
+    const unsigned char *keyword_pool;
+#ifdef CLI_INSTRUMENT
+    /* Optional, zero-initialised, updated by parse, match and execute */
+    struct cli_instrument *instrument;
+#endif
+};
+
+/*
+ * Text of the keyword with given index, from the keywords list or pool (not
+ * terminated for a pool).  Returns NULL if there is no such keyword.
+ */
+const char *keyword_text(const struct cli_language_definition *language, int index, unsigned char *length);
+
+/*
+ * Build a keyword index for a keywords list, into caller-provided nodes
+ */
+enum build_keyword_index_result
+{
+    build_keyword_index_success,
+    build_keyword_index_too_many_keywords,
+    build_keyword_index_too_many_nodes,
 };
 
+#ifndef CLI_NO_KEYWORD_INDEX
+enum build_keyword_index_result build_keyword_index(const cli_keyword *keywords, struct cli_keyword_index_node *nodes, unsigned short capacity, struct cli_keyword_index *index);
+#endif
+
+/*
+ * Build a command tree for a commands list, into caller-provided nodes
+ */
+enum build_command_tree_result
+{
+    build_command_tree_success,
+    build_command_tree_too_many_commands,
+    build_command_tree_too_many_nodes,
+    build_command_tree_invalid_token,
+};
+
+#ifndef CLI_NO_COMMAND_TREE
+enum build_command_tree_result build_command_tree(const struct cli_command_definition *commands, struct cli_command_tree_node *nodes, unsigned short capacity, struct cli_command_tree *tree);
+#endif
+
 /*
  * Parse a text command to bytecode
  */
@@ -118,6 +335,24 @@ enum parse_long_command_result
 
 enum parse_long_command_result parse_long_command(const struct cli_language_definition *spec, const char *command, const char *command_end, cli_expression *parsed);
 
+/*
+ * Parse a text command to bytecode, numbers (decimal or 0x-prefixed
+ * hexadecimal, 32-bit) outside the bytecode range go to the side array
+ */
+enum parse_long_command_result parse_long_command_wide(const struct cli_language_definition *spec, const char *command, const char *command_end, struct cli_wide_expression *parsed);
+
+/*
+ * Value of the number token at position, for use by handlers: decodes both
+ * bytecode numbers and slot tokens (which only occur in a cli_wide_expression)
+ */
+long expression_number(const cli_expression *bytecode, int position);
+
+/*
+ * Copy tokens [begin, end) of bytecode (stopping at the terminal) to the start
+ * of another expression, along with any wide numbers they refer to
+ */
+void copy_expression(const cli_expression *value, int begin, int end, struct cli_wide_expression *copy);
+
 /*
  * Match a bytecode command to the respective handler callback
  */
@@ -130,10 +365,78 @@ enum match_command_result
 
 enum match_command_result match_command(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result);
 
+/* Decoded values of the number slots of a matched command, in order */
+struct cli_arguments
+{
+    unsigned char count;
+    long value[CLI_MAX_TOKENS];
+};
+
+/*
+ * Match a bytecode command, and fill in its argument view (if not NULL)
+ */
+enum match_command_result match_command_arguments(const struct cli_language_definition *language, const cli_expression *value, const struct cli_command_definition **result, struct cli_arguments *arguments);
+
+/* A command with storage for its argument view, for runners which keep both */
+struct cli_call
+{
+    struct cli_wide_expression expression;
+    struct cli_arguments arguments;
+};
+
+/*
+ * Match the command of a call, fill in its arguments and run its handler,
+ * result is only written on success
+ */
+enum match_command_result execute_call(const struct cli_language_definition *language, struct cli_call *call, enum cli_command_result *result);
+
+/*
+ * Match a bytecode command and run its handler (with the argument view on the
+ * stack), result is only written on success
+ */
+enum match_command_result execute_command(const struct cli_language_definition *language, const cli_expression *value, enum cli_command_result *result);
+
+/*
+ * Next-token prediction, for hints and tab completion
+ */
+enum cli_next_token
+{
+    cli_next_invalid = 0x00,
+    cli_next_terminal = 0x01,
+    cli_next_keyword = 0x02,
+    cli_next_number = 0x04,
+};
+
+/* Set of tokens which may follow a command prefix */
+struct cli_next_tokens
+{
+    /* Bitmask of enum cli_next_token */
+    unsigned char types;
+    /* Bit n set if keyword with index n may follow */
+    unsigned char keywords[CLI_RANGE_KEYWORD / 8];
+};
+
 /*
- * List all commands (ASCII-format)
+ * Return set of valid token types that can follow the first length tokens of
+ * prefix.  With a command tree, cost is bounded by the prefix length.
  */
+#ifndef CLI_NO_COMPLETION
+enum cli_next_token next_tokens(const struct cli_language_definition *language, const cli_expression *prefix, int length, struct cli_next_tokens *next);
+
+/*
+ * Complete a partial keyword from those permitted by a next-token set.
+ * Returns number of candidates, completion receives the index of the first
+ * candidate and common receives the length of the prefix shared by all.
+ */
+int complete_keyword(const struct cli_language_definition *language, const struct cli_next_tokens *next, const char *begin, const char *end, int *completion, int *common);
+#endif
+
+/*
+ * List all commands (ASCII-format) to stdout, see serial_cli_output.h for other sinks
+ */
+#ifndef CLI_NO_LIST
 void list_all_commands(const struct cli_language_definition *language);
+#endif
 
 /*
  * Debug print bytecode command
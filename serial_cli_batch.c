@@ -0,0 +1,42 @@
+#include <string.h>
+
+#include "serial_cli_internal.h"
+#include "serial_cli_batch.h"
+#include "serial_cli_stream.h"
+
+size_t parse_batch(const struct cli_language_definition *language, const char *text, const char *end, struct cli_batch_line *lines, size_t capacity, const char **next)
+{
+    size_t count = 0;
+    while (text != end && count != capacity) {
+        const char *line_end = memchr(text, CLI_STREAM_LINE_BREAK, end - text);
+        const char *line_next = line_end ? line_end + 1 : end;
+        if (!line_end) {
+            line_end = end;
+        }
+        if (line_end != text && line_end[-1] == '\r') {
+            --line_end;
+        }
+        struct cli_batch_line *line = &lines[count++];
+        line->parse = parse_long_command(language, text, line_end, &line->bytecode);
+        line->match = match_command_fail;
+        if (line->parse == parse_long_command_success) {
+            const struct cli_command_definition *def;
+            line->match = match_command(language, &line->bytecode, &def);
+            if (line->match == match_command_success) {
+                line->command = def - language->commands;
+            }
+        }
+        text = line_next;
+    }
+    *next = text;
+    return count;
+}
+
+size_t batch_errors(const struct cli_batch_line *lines, size_t count)
+{
+    size_t errors = 0;
+    for (size_t i = 0; i < count; ++i) {
+        errors += lines[i].match != match_command_success && (lines[i].parse != parse_long_command_success || !CLI_EXPR_IS_TERMINAL(lines[i].bytecode[0]));
+    }
+    return errors;
+}
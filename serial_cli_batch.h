@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "serial_cli.h"
+
+/*
+ * Batch parsing: a buffer of commands separated by CLI_STREAM_LINE_BREAK is
+ * parsed and matched line by line into an array, for host tools checking
+ * scripts against a language.  Every line gets an entry, blank ones too, so
+ * entry i is line i of the buffer.
+ *
+ * parse_batch only reads the language, so threads may share one, provided it
+ * has no match cache (see host/cli_check.c).
+ */
+
+struct cli_batch_line
+{
+    cli_expression bytecode;
+    /* enum parse_long_command_result */
+    unsigned char parse;
+    /* enum match_command_result, match_command_fail unless parsed */
+    unsigned char match;
+    /* Index of the matched command */
+    unsigned char command;
+};
+
+/*
+ * Parse and match lines from text until end or until capacity lines are
+ * filled.  Returns the number of lines, next receives the start of the first
+ * line not parsed (end once all are).  A trailing '\r' is ignored, as by the
+ * stream parser.
+ */
+size_t parse_batch(const struct cli_language_definition *language, const char *text, const char *end, struct cli_batch_line *lines, size_t capacity, const char **next);
+
+/*
+ * Lines of a batch which did not parse, or parsed but did not match (blank
+ * lines are not counted)
+ */
+size_t batch_errors(const struct cli_batch_line *lines, size_t count);
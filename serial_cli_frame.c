@@ -0,0 +1,236 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_frame.h"
+
+enum frame_receiver_state
+{
+    frame_receiver_length,
+    /* First payload byte, which may be the request header */
+    frame_receiver_header,
+    frame_receiver_sequence,
+    frame_receiver_payload,
+    frame_receiver_number_low,
+    frame_receiver_crc,
+};
+
+unsigned char cli_crc8(unsigned char crc, unsigned char byte)
+{
+    crc ^= byte;
+    for (int bit = 0; bit < 8; ++bit) {
+        crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+    return crc;
+}
+
+/*
+ * Encode a bytecode command as a frame, after header bytes
+ */
+static enum encode_frame_result encode_frame_with_header(const cli_expression *bytecode, const unsigned char *header, unsigned char header_size, unsigned char *frame, unsigned char capacity, unsigned char *size)
+{
+    unsigned char *out_it = frame + 1;
+    unsigned char *out_end = frame + capacity;
+    if (capacity < CLI_FRAME_SIZE(header_size)) {
+        return encode_frame_overflow;
+    }
+    for (unsigned char i = 0; i < header_size; ++i) {
+        *out_it++ = header[i];
+    }
+    for (
+        const expression_token *it = *bytecode, *end = it + CLI_MAX_TOKENS;
+        it != end && !CLI_EXPR_IS_TERMINAL(*it);
+        ++it
+    ) {
+        if (CLI_EXPR_IS_KEYWORD(*it)) {
+            if (out_end - out_it < 2) {
+                return encode_frame_overflow;
+            }
+            *out_it++ = CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(CLI_EXPR_KEYWORD_TO_KEYWORD_INDEX(*it));
+        } else if (CLI_EXPR_IS_NUMBER(*it)) {
+            if (out_end - out_it < 3) {
+                return encode_frame_overflow;
+            }
+            unsigned short value = *it - CLI_EXPR_NUMBER_BEGIN;
+            *out_it++ = value >> 8;
+            *out_it++ = value & 0xff;
+        } else {
+            parse_error_printf_token("Cannot encode token", *it);
+            return encode_frame_invalid_token;
+        }
+    }
+    frame[0] = out_it - frame - 1;
+    unsigned char crc = 0;
+    for (const unsigned char *it = frame; it != out_it; ++it) {
+        crc = cli_crc8(crc, *it);
+    }
+    *out_it++ = crc;
+    *size = out_it - frame;
+    return encode_frame_success;
+}
+
+/*
+ * Encode a bytecode command as a frame
+ */
+enum encode_frame_result encode_frame(const cli_expression *bytecode, unsigned char *frame, unsigned char capacity, unsigned char *size)
+{
+    return encode_frame_with_header(bytecode, NULL, 0, frame, capacity, size);
+}
+
+/*
+ * Encode a bytecode command as a request frame
+ */
+enum encode_frame_result encode_request_frame(const cli_expression *bytecode, unsigned char sequence, unsigned char *frame, unsigned char capacity, unsigned char *size)
+{
+    const unsigned char header[CLI_FRAME_REQUEST_HEADER_SIZE] = { CLI_FRAME_REQUEST, sequence };
+    return encode_frame_with_header(bytecode, header, sizeof(header), frame, capacity, size);
+}
+
+/*
+ * Encode a reply frame
+ */
+void encode_reply_frame(const struct cli_reply *reply, unsigned char *frame)
+{
+    frame[0] = CLI_FRAME_REPLY_SIZE - 2;
+    frame[1] = CLI_FRAME_REPLY;
+    frame[2] = reply->sequence;
+    frame[3] = reply->status;
+    frame[4] = reply->code;
+    unsigned char crc = 0;
+    for (int i = 0; i < CLI_FRAME_REPLY_SIZE - 1; ++i) {
+        crc = cli_crc8(crc, frame[i]);
+    }
+    frame[CLI_FRAME_REPLY_SIZE - 1] = crc;
+}
+
+/*
+ * Append a token to the received command
+ */
+static void frame_receiver_emit(struct cli_frame_receiver *receiver, expression_token token)
+{
+    if (receiver->length == CLI_MAX_TOKENS) {
+        receiver->error = receive_frame_invalid_token;
+        return;
+    }
+    (*receiver->output)[receiver->length++] = token;
+}
+
+void frame_receiver_init(struct cli_frame_receiver *receiver, cli_expression *output)
+{
+    receiver->output = output;
+    receiver->state = frame_receiver_length;
+}
+
+enum receive_frame_result receive_frame(struct cli_frame_receiver *receiver, unsigned char byte)
+{
+    switch (receiver->state) {
+    case frame_receiver_length:
+        if (byte > CLI_FRAME_MAX_PAYLOAD + CLI_FRAME_REQUEST_HEADER_SIZE) {
+            return receive_frame_bad_length;
+        }
+        receiver->crc = cli_crc8(0, byte);
+        receiver->remaining = byte;
+        receiver->length = 0;
+        receiver->error = receive_frame_success;
+        receiver->request = FALSE;
+        receiver->state = byte ? frame_receiver_header : frame_receiver_crc;
+        return receive_frame_pending;
+    case frame_receiver_header:
+        if (byte == CLI_FRAME_REQUEST) {
+            receiver->crc = cli_crc8(receiver->crc, byte);
+            --receiver->remaining;
+            receiver->request = TRUE;
+            receiver->state = frame_receiver_sequence;
+            break;
+        }
+        receiver->state = frame_receiver_payload;
+        /* fall through */
+    case frame_receiver_payload:
+        receiver->crc = cli_crc8(receiver->crc, byte);
+        --receiver->remaining;
+        if (receiver->error != receive_frame_success) {
+            /* Consume rest of the frame */
+        } else if (byte >= CLI_FRAME_RESERVED_BEGIN) {
+            receiver->error = receive_frame_invalid_token;
+        } else if (byte & CLI_FRAME_KEYWORD_FLAG) {
+            frame_receiver_emit(receiver, CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(byte)));
+        } else {
+            receiver->high = byte;
+            receiver->state = frame_receiver_number_low;
+        }
+        break;
+    case frame_receiver_number_low:
+        receiver->crc = cli_crc8(receiver->crc, byte);
+        --receiver->remaining;
+        unsigned short value = (receiver->high << 8) | byte;
+        if (value >= CLI_RANGE_NUMBER) {
+            receiver->error = receive_frame_invalid_token;
+        } else {
+            frame_receiver_emit(receiver, CLI_EXPR_NUMBER_BEGIN + value);
+        }
+        receiver->state = frame_receiver_payload;
+        break;
+    case frame_receiver_sequence:
+        receiver->crc = cli_crc8(receiver->crc, byte);
+        --receiver->remaining;
+        receiver->sequence = byte;
+        receiver->state = frame_receiver_payload;
+        break;
+    case frame_receiver_crc:
+        receiver->state = frame_receiver_length;
+        if (byte != receiver->crc) {
+            parse_error_printf("Frame CRC mismatch");
+            return receive_frame_bad_crc;
+        }
+        if (receiver->error != receive_frame_success) {
+            parse_error_printf("Invalid token in frame");
+            return receiver->error;
+        }
+        if (receiver->length != CLI_MAX_TOKENS) {
+            (*receiver->output)[receiver->length] = CLI_EXPR_TERMINAL;
+        }
+        return receive_frame_success;
+    }
+    if (!receiver->remaining) {
+        if (receiver->state == frame_receiver_number_low) {
+            /* Payload ends part-way through a number */
+            receiver->error = receive_frame_invalid_token;
+        } else if (receiver->state == frame_receiver_sequence) {
+            /* Payload ends in the request header, so there is no sequence number to reply to */
+            receiver->error = receive_frame_bad_length;
+        }
+        receiver->state = frame_receiver_crc;
+    }
+    return receive_frame_pending;
+}
+
+enum receive_frame_result decode_frame(const unsigned char *frame, unsigned char size, cli_expression *output)
+{
+    struct cli_frame_receiver receiver;
+    frame_receiver_init(&receiver, output);
+    for (const unsigned char *it = frame, *end = frame + size; it != end; ++it) {
+        enum receive_frame_result result = receive_frame(&receiver, *it);
+        if (result != receive_frame_pending) {
+            return it + 1 == end || result != receive_frame_success ? result : receive_frame_bad_length;
+        }
+    }
+    return receive_frame_pending;
+}
+
+enum receive_frame_result decode_reply_frame(const unsigned char *frame, unsigned char size, struct cli_reply *reply)
+{
+    if (size != CLI_FRAME_REPLY_SIZE || frame[0] != CLI_FRAME_REPLY_SIZE - 2) {
+        return receive_frame_bad_length;
+    }
+    unsigned char crc = 0;
+    for (int i = 0; i < CLI_FRAME_REPLY_SIZE - 1; ++i) {
+        crc = cli_crc8(crc, frame[i]);
+    }
+    if (crc != frame[CLI_FRAME_REPLY_SIZE - 1]) {
+        return receive_frame_bad_crc;
+    }
+    if (frame[1] != CLI_FRAME_REPLY) {
+        return receive_frame_invalid_token;
+    }
+    reply->sequence = frame[2];
+    reply->status = frame[3];
+    reply->code = frame[4];
+    return receive_frame_success;
+}
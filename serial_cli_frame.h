@@ -0,0 +1,155 @@
+#pragma once
+
+#include "serial_cli.h"
+
+/*
+ * Binary bytecode frames, which bypass text parsing entirely:
+ *
+ *   [length] [payload: length bytes] [crc]
+ *
+ * The payload is a packed cli_expression (trailing terminal is implicit):
+ *
+ *   1kkkkkkk           keyword with index k (same value as the syntax token)
+ *   0nnnnnnn nnnnnnnn  number, bytecode value minus CLI_EXPR_NUMBER_BEGIN
+ *
+ * The CRC is CRC-8 (polynomial 0x07, initial value 0) over length and payload.
+ *
+ * Payloads starting with a byte from CLI_FRAME_RESERVED_BEGIN are not
+ * commands.  For pipelining, a request frame carries a command with a
+ * sequence number, and the device answers each with a reply frame:
+ *
+ *   [length] [CLI_FRAME_REQUEST] [sequence] [packed command] [crc]
+ *   [4] [CLI_FRAME_REPLY] [sequence] [status] [code] [crc]
+ *
+ * so the host may keep several requests in flight and match the replies up.
+ */
+
+/* Largest payload (all tokens numbers) */
+#define CLI_FRAME_MAX_PAYLOAD ((CLI_MAX_TOKENS) * 2)
+
+/* Size of frame, given the value of its first (length) byte */
+#define CLI_FRAME_SIZE(length) ((length) + 2)
+
+/* Largest frame */
+#define CLI_FRAME_MAX_SIZE CLI_FRAME_SIZE(CLI_FRAME_MAX_PAYLOAD)
+
+/* Packed encoding of tokens */
+#define CLI_FRAME_KEYWORD_FLAG ((unsigned char) 0x80)
+#define CLI_FRAME_RESERVED_BEGIN ((unsigned char) 0xc0)
+
+/* Frame types in the reserved range (0xc0 is CLI_FRAME_TELEMETRY) */
+#define CLI_FRAME_REQUEST ((unsigned char) 0xc1)
+#define CLI_FRAME_REPLY ((unsigned char) 0xc2)
+
+/* Bytes before the command in a request payload */
+#define CLI_FRAME_REQUEST_HEADER_SIZE (2)
+
+/* Largest request frame */
+#define CLI_FRAME_REQUEST_MAX_SIZE ((CLI_FRAME_MAX_SIZE) + (CLI_FRAME_REQUEST_HEADER_SIZE))
+
+/* Size of a reply frame */
+#define CLI_FRAME_REPLY_SIZE CLI_FRAME_SIZE(4)
+
+/* What the code of a reply refers to */
+enum cli_reply_status
+{
+    /* Command ran, code is its enum cli_command_result */
+    cli_reply_executed,
+    /* Command did not match, code is the enum match_command_result */
+    cli_reply_no_match,
+    /* Request payload was invalid, code is the enum receive_frame_result */
+    cli_reply_bad_request,
+};
+
+/* Content of a reply frame */
+struct cli_reply
+{
+    unsigned char sequence;
+    /* enum cli_reply_status */
+    unsigned char status;
+    unsigned char code;
+};
+
+/* Update frame CRC with one byte */
+unsigned char cli_crc8(unsigned char crc, unsigned char byte);
+
+/*
+ * Encode a bytecode command as a frame
+ */
+enum encode_frame_result
+{
+    encode_frame_success,
+    encode_frame_overflow,
+    encode_frame_invalid_token,
+};
+
+enum encode_frame_result encode_frame(const cli_expression *bytecode, unsigned char *frame, unsigned char capacity, unsigned char *size);
+
+/*
+ * Encode a bytecode command as a request frame
+ */
+enum encode_frame_result encode_request_frame(const cli_expression *bytecode, unsigned char sequence, unsigned char *frame, unsigned char capacity, unsigned char *size);
+
+/*
+ * Encode a reply frame (CLI_FRAME_REPLY_SIZE bytes)
+ */
+void encode_reply_frame(const struct cli_reply *reply, unsigned char *frame);
+
+/*
+ * Incremental frame decoder, writes tokens straight into the output as bytes
+ * arrive so no frame buffer is needed
+ */
+struct cli_frame_receiver
+{
+    cli_expression *output;
+    /* enum frame_receiver_state */
+    unsigned char state;
+    /* Payload bytes remaining */
+    unsigned char remaining;
+    /* Tokens written */
+    unsigned char length;
+    /* Running CRC */
+    unsigned char crc;
+    /* High byte of a number token */
+    unsigned char high;
+    /* Payload error to report once the frame is complete */
+    unsigned char error;
+    /* Whether the frame is a request, and its sequence number */
+    unsigned char request;
+    unsigned char sequence;
+};
+
+enum receive_frame_result
+{
+    /* More bytes are needed to complete the frame */
+    receive_frame_pending,
+    /* Frame complete, output holds the command */
+    receive_frame_success,
+    /* Length byte out of range, it was dropped */
+    receive_frame_bad_length,
+    /* Frame was dropped */
+    receive_frame_bad_crc,
+    receive_frame_invalid_token,
+};
+
+/*
+ * Initialise a frame receiver, which will write received commands to output.
+ * Both plain and request frames are accepted, see request and sequence.
+ */
+void frame_receiver_init(struct cli_frame_receiver *receiver, cli_expression *output);
+
+/*
+ * Feed one byte.  On a result other than pending, the output must be consumed
+ * before the next byte is fed.
+ */
+enum receive_frame_result receive_frame(struct cli_frame_receiver *receiver, unsigned char byte);
+
+/*
+ * Decode one complete frame from a buffer
+ */
+enum receive_frame_result decode_frame(const unsigned char *frame, unsigned char size, cli_expression *output);
+
+/*
+ * Decode a complete reply frame, invalid_token if it is another kind of frame
+ */
+enum receive_frame_result decode_reply_frame(const unsigned char *frame, unsigned char size, struct cli_reply *reply);
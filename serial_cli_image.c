@@ -0,0 +1,329 @@
+#include <string.h>
+
+#include "serial_cli_internal.h"
+#include "serial_cli_image.h"
+
+static const unsigned char image_magic[4] = { 'C', 'L', 'I', 'L' };
+
+/* Index nodes are stored as: byte, byte, 16-bit child, 16-bit sibling */
+#define IMAGE_NODE_SIZE (6)
+
+static unsigned short image_read16(const unsigned char *data)
+{
+    return data[0] | (unsigned short) data[1] << 8;
+}
+
+static unsigned long image_read32(const unsigned char *data)
+{
+    return image_read16(data) | (unsigned long) image_read16(data + 2) << 16;
+}
+
+static void image_write16(unsigned char *data, unsigned short value)
+{
+    data[0] = value & 0xff;
+    data[1] = value >> 8;
+}
+
+static void image_write32(unsigned char *data, unsigned long value)
+{
+    image_write16(data, value & 0xffff);
+    image_write16(data + 2, value >> 16);
+}
+
+/*
+ * Whether index nodes in an image have the layout of the node structs here
+ */
+static bool image_nodes_native(const unsigned char *nodes)
+{
+    const unsigned short probe = 1;
+    return sizeof(struct cli_keyword_index_node) == IMAGE_NODE_SIZE
+        && sizeof(struct cli_command_tree_node) == IMAGE_NODE_SIZE
+        && *(const unsigned char *) &probe == 1
+        && ((unsigned long) nodes & 1) == 0;
+}
+
+/*
+ * Validate keyword index nodes of an image: values, and the breadth-first
+ * order in which build_keyword_index creates nodes (children are consecutive,
+ * after their parent), so that walks over an image in place always terminate
+ */
+static bool image_keyword_nodes_valid(const unsigned char *nodes, unsigned short count, unsigned char max_value)
+{
+    for (unsigned short i = 0; i < count; ++i) {
+        const unsigned char *node = nodes + i * IMAGE_NODE_SIZE;
+        unsigned char children = node[3];
+        unsigned short child = image_read16(node + 4);
+        if (node[1] > max_value || node[2] > max_value || (children && (child <= i || child > count || children > count - child))) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Validate command tree nodes of an image: values, and the ordering in which
+ * build_command_tree creates nodes (a child is created after its parent, and
+ * links to the previously created first child as its sibling), so that walks
+ * over an image in place always terminate
+ */
+static bool image_tree_nodes_valid(const unsigned char *nodes, unsigned short count, unsigned char max_value)
+{
+    for (unsigned short i = 0; i < count; ++i) {
+        const unsigned char *node = nodes + i * IMAGE_NODE_SIZE;
+        unsigned short child = image_read16(node + 2);
+        unsigned short sibling = image_read16(node + 4);
+        if (node[1] > max_value || child >= count || (child && child <= i) || (sibling && sibling >= i)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Validate a section of count items of size at offset, returns NULL if it is not in the image
+ */
+static const unsigned char *image_section(const unsigned char *data, unsigned long size, unsigned long offset, unsigned long count, unsigned long item_size)
+{
+    if (offset < CLI_IMAGE_HEADER_SIZE || offset > size || count > (size - offset) / item_size) {
+        return NULL;
+    }
+    return data + offset;
+}
+
+enum language_image_load_result language_image_load(struct cli_language_image *image, const unsigned char *data, unsigned long size, cli_command_handler *const *handlers, unsigned char handler_count, struct cli_command_definition *commands, unsigned short capacity)
+{
+    if (size < CLI_IMAGE_HEADER_SIZE || memcmp(data, image_magic, sizeof(image_magic)) != 0 || data[4] != CLI_IMAGE_VERSION) {
+        return language_image_load_bad_header;
+    }
+    if (data[5] != CLI_MAX_TOKENS) {
+        return language_image_load_incompatible;
+    }
+    unsigned short command_count = image_read16(data + 6);
+    if (image_read32(data + 8) != size) {
+        return language_image_load_bad_size;
+    }
+
+    /* Keyword pool: flags, entries, terminator */
+    const unsigned char *pool = image_section(data, size, image_read32(data + 12), 2, 1);
+    if (!pool) {
+        return language_image_load_bad_size;
+    }
+    int keyword_count = 0;
+    const unsigned char *entry = pool + 1;
+    for (; entry < data + size && *entry; entry += *entry + 1, ++keyword_count) {
+    }
+    if (entry >= data + size || keyword_count > CLI_RANGE_KEYWORD) {
+        return language_image_load_bad_size;
+    }
+
+    /* Commands, bound to handlers */
+    const unsigned char *command = image_section(data, size, image_read32(data + 16), command_count, CLI_IMAGE_COMMAND_SIZE);
+    if (!command) {
+        return language_image_load_bad_size;
+    }
+    if (command_count >= capacity || command_count > CLI_MAX_COMMANDS) {
+        return language_image_load_too_many_commands;
+    }
+    for (unsigned short i = 0; i < command_count; ++i, command += CLI_IMAGE_COMMAND_SIZE) {
+        for (int j = 0; j < CLI_MAX_TOKENS; ++j) {
+            syntax_token token = command[j];
+            if (!CLI_SPEC_IS_TERMINAL(token) && !CLI_SPEC_IS_NUMBER(token) && !(CLI_SPEC_IS_KEYWORD(token) && CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(token) < keyword_count)) {
+                return language_image_load_invalid_syntax;
+            }
+        }
+        unsigned char handler = command[CLI_MAX_TOKENS];
+        if (handler >= handler_count || !handlers[handler]) {
+            return language_image_load_invalid_handler;
+        }
+        /* Syntax is const in the definition, which is being filled in here */
+        memcpy((syntax_token *) commands[i].syntax, command, CLI_MAX_TOKENS);
+        commands[i].handler = handlers[handler];
+        commands[i].flags = command[CLI_MAX_TOKENS + 1];
+    }
+    memset((syntax_token *) commands[command_count].syntax, CLI_SPEC_TERMINAL, CLI_MAX_TOKENS);
+    commands[command_count].handler = NULL;
+    commands[command_count].flags = 0;
+
+    memset(&image->language, 0, sizeof(image->language));
+    image->language.keyword_pool = pool;
+    image->language.commands = commands;
+
+    /* Indices, used in place where the layout allows */
+    unsigned long keyword_nodes = image_read32(data + 20);
+    unsigned short keyword_node_count = image_read16(data + 24);
+    if (keyword_node_count) {
+        const unsigned char *nodes = image_section(data, size, keyword_nodes, keyword_node_count, IMAGE_NODE_SIZE);
+        if (!nodes) {
+            return language_image_load_bad_size;
+        }
+        if (!image_keyword_nodes_valid(nodes, keyword_node_count, keyword_count)) {
+            return language_image_load_invalid_syntax;
+        }
+        if (image_nodes_native(nodes)) {
+            image->keyword_index.nodes = (const struct cli_keyword_index_node *) nodes;
+            image->keyword_index.count = keyword_node_count;
+            image->language.keyword_index = &image->keyword_index;
+        }
+    }
+    unsigned long tree_nodes = image_read32(data + 28);
+    unsigned short tree_node_count = image_read16(data + 32);
+    if (tree_node_count) {
+        const unsigned char *nodes = image_section(data, size, tree_nodes, tree_node_count, IMAGE_NODE_SIZE);
+        if (!nodes) {
+            return language_image_load_bad_size;
+        }
+        if (!image_tree_nodes_valid(nodes, tree_node_count, command_count)) {
+            return language_image_load_invalid_syntax;
+        }
+        if (image_nodes_native(nodes)) {
+            image->command_tree.nodes = (const struct cli_command_tree_node *) nodes;
+            image->command_tree.count = tree_node_count;
+            image->language.command_tree = &image->command_tree;
+        }
+    }
+    return language_image_load_success;
+}
+
+/*
+ * Append bytes to an image being written, returns false on overflow
+ */
+static bool image_append(unsigned char *data, unsigned long capacity, unsigned long *size, const void *bytes, unsigned long length)
+{
+    if (length > capacity - *size) {
+        return FALSE;
+    }
+    memcpy(data + *size, bytes, length);
+    *size += length;
+    return TRUE;
+}
+
+/*
+ * Append a keyword index node, returns false on overflow
+ */
+static bool image_append_keyword_node(unsigned char *data, unsigned long capacity, unsigned long *size, const struct cli_keyword_index_node *node)
+{
+    unsigned char bytes[IMAGE_NODE_SIZE] = { node->ch, node->keyword, node->unique, node->children };
+    image_write16(bytes + 4, node->child);
+    return image_append(data, capacity, size, bytes, sizeof(bytes));
+}
+
+/*
+ * Append a command tree node, returns false on overflow
+ */
+static bool image_append_tree_node(unsigned char *data, unsigned long capacity, unsigned long *size, unsigned char first, unsigned char second, unsigned short child, unsigned short sibling)
+{
+    unsigned char bytes[IMAGE_NODE_SIZE] = { first, second };
+    image_write16(bytes + 2, child);
+    image_write16(bytes + 4, sibling);
+    return image_append(data, capacity, size, bytes, sizeof(bytes));
+}
+
+/*
+ * Nodes are 16-bit aligned, returns false on overflow
+ */
+static bool image_align_nodes(unsigned char *data, unsigned long capacity, unsigned long *size)
+{
+    static const unsigned char padding = 0;
+    return !(*size & 1) || image_append(data, capacity, size, &padding, 1);
+}
+
+enum language_image_write_result language_image_write(const struct cli_language_definition *language, const unsigned char *handler_ids, unsigned char *data, unsigned long capacity, unsigned long *size)
+{
+    if (!language->commands || (!language->keywords && !language->keyword_pool)) {
+        return language_image_write_invalid_language;
+    }
+    if (capacity < CLI_IMAGE_HEADER_SIZE) {
+        return language_image_write_overflow;
+    }
+    memset(data, 0, CLI_IMAGE_HEADER_SIZE);
+    memcpy(data, image_magic, sizeof(image_magic));
+    data[4] = CLI_IMAGE_VERSION;
+    data[5] = CLI_MAX_TOKENS;
+    *size = CLI_IMAGE_HEADER_SIZE;
+
+    /* Keyword pool, copied or built from the list (grouped if it is sorted by length) */
+    image_write32(data + 12, *size);
+    if (language->keyword_pool) {
+        const unsigned char *end = language->keyword_pool + 1;
+        for (; *end; end += *end + 1) {
+        }
+        if (!image_append(data, capacity, size, language->keyword_pool, end + 1 - language->keyword_pool)) {
+            return language_image_write_overflow;
+        }
+    } else {
+        unsigned long flags = *size;
+        unsigned char grouped = CLI_KEYWORD_POOL_GROUPED;
+        if (!image_append(data, capacity, size, &grouped, 1)) {
+            return language_image_write_overflow;
+        }
+        unsigned char previous = 0;
+        for (const cli_keyword *keyword = language->keywords; *keyword; ++keyword) {
+            unsigned long length = strlen(*keyword);
+            unsigned char byte = length;
+            if (length == 0 || length > 0xff) {
+                return language_image_write_invalid_language;
+            }
+            if (byte < previous) {
+                data[flags] = 0;
+            }
+            previous = byte;
+            if (!image_append(data, capacity, size, &byte, 1) || !image_append(data, capacity, size, *keyword, length)) {
+                return language_image_write_overflow;
+            }
+        }
+        static const unsigned char terminator = 0;
+        if (!image_append(data, capacity, size, &terminator, 1)) {
+            return language_image_write_overflow;
+        }
+    }
+
+    /* Commands */
+    image_write32(data + 16, *size);
+    unsigned short command_count = 0;
+    for (const struct cli_command_definition *def = language->commands; def->handler; ++def, ++command_count) {
+        unsigned char flags[2] = { handler_ids[command_count], def->flags };
+        if (!image_append(data, capacity, size, def->syntax, CLI_MAX_TOKENS) || !image_append(data, capacity, size, flags, sizeof(flags))) {
+            return language_image_write_overflow;
+        }
+    }
+    image_write16(data + 6, command_count);
+
+    /* Indices */
+    const struct cli_keyword_index *index = language->keyword_index;
+    if (index) {
+        if (!image_align_nodes(data, capacity, size)) {
+            return language_image_write_overflow;
+        }
+        image_write32(data + 20, *size);
+        image_write16(data + 24, index->count);
+        for (unsigned short i = 0; i < index->count; ++i) {
+            const struct cli_keyword_index_node *node = &index->nodes[i];
+            if (!image_append_keyword_node(data, capacity, size, node)) {
+                return language_image_write_overflow;
+            }
+        }
+    }
+    const struct cli_command_tree *tree = language->command_tree;
+    if (tree) {
+        if (!image_align_nodes(data, capacity, size)) {
+            return language_image_write_overflow;
+        }
+        image_write32(data + 28, *size);
+        image_write16(data + 32, tree->count);
+        for (unsigned short i = 0; i < tree->count; ++i) {
+            const struct cli_command_tree_node *node = &tree->nodes[i];
+            if (!image_append_tree_node(data, capacity, size, node->token, node->command, node->child, node->sibling)) {
+                return language_image_write_overflow;
+            }
+        }
+    }
+    image_write32(data + 8, *size);
+    return language_image_write_success;
+}
+
+void language_publish(const struct cli_language_definition *volatile *active, const struct cli_language_definition *language)
+{
+    /* Everything the language points to is written before it becomes visible */
+    CLI_BARRIER();
+    *active = language;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "serial_cli.h"
+
+/*
+ * Language images: a language definition serialised to one relocatable
+ * block, which can be memory-mapped on the host or read in place from flash,
+ * so that the language can change without rebuilding the program.
+ *
+ * All fields are little-endian, offsets are from the start of the image:
+ *
+ *   0   magic "CLIL", version, CLI_MAX_TOKENS
+ *   6   command count (16 bits), image size (32 bits)
+ *   12  offset of the keyword pool (see CLI_KEYWORD_POOL)
+ *   16  offset of the commands: syntax (CLI_MAX_TOKENS bytes), handler ID, flags
+ *   20  offset (32 bits) and node count (16 bits) of the keyword index, zero if none
+ *   28  offset and node count of the command tree, likewise
+ *
+ * Index nodes are laid out as struct cli_keyword_index_node and struct
+ * cli_command_tree_node on little-endian targets with 16-bit alignment, and
+ * are then used in place; elsewhere they are ignored, and parsing falls back
+ * to the keyword pool and command list.  The keyword pool is always used in
+ * place.  Commands are bound to handlers (by ID, in a table supplied by the
+ * program) into caller-provided storage, which is the only copy made.
+ */
+
+#define CLI_IMAGE_VERSION (2)
+
+/* Size of the image header */
+#define CLI_IMAGE_HEADER_SIZE (36)
+
+/* Size of a command in an image */
+#define CLI_IMAGE_COMMAND_SIZE ((CLI_MAX_TOKENS) + 2)
+
+/* A loaded image, language is valid as long as the image data is */
+struct cli_language_image
+{
+    struct cli_language_definition language;
+    struct cli_keyword_index keyword_index;
+    struct cli_command_tree command_tree;
+};
+
+enum language_image_load_result
+{
+    language_image_load_success,
+    /* Not an image, or another version */
+    language_image_load_bad_header,
+    /* Built for another CLI_MAX_TOKENS */
+    language_image_load_incompatible,
+    /* Image is truncated, or sections lie outside it */
+    language_image_load_bad_size,
+    /* Command storage is too small */
+    language_image_load_too_many_commands,
+    /* Handler ID not in the handler table */
+    language_image_load_invalid_handler,
+    /* Syntax refers to a missing keyword, or an index is corrupt */
+    language_image_load_invalid_syntax,
+};
+
+/*
+ * Load an image: validate it, bind its commands to handlers[ID] into
+ * commands (command count plus one entries), and set up image->language to
+ * point into the data.
+ */
+enum language_image_load_result language_image_load(struct cli_language_image *image, const unsigned char *data, unsigned long size, cli_command_handler *const *handlers, unsigned char handler_count, struct cli_command_definition *commands, unsigned short capacity);
+
+enum language_image_write_result
+{
+    language_image_write_success,
+    language_image_write_overflow,
+    /* Keyword too long for a pool, or language has lookups only */
+    language_image_write_invalid_language,
+};
+
+/*
+ * Serialise a language, with handler_ids giving the handler ID of each
+ * command.  Indices are included if the language has them.
+ */
+enum language_image_write_result language_image_write(const struct cli_language_definition *language, const unsigned char *handler_ids, unsigned char *data, unsigned long capacity, unsigned long *size);
+
+/*
+ * Switch the language used by readers of active (e.g. the main loop), which
+ * must load the pointer once per command.  The previous language remains in
+ * use until those readers are done with it.
+ */
+void language_publish(const struct cli_language_definition *volatile *active, const struct cli_language_definition *language);
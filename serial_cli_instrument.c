@@ -0,0 +1,167 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_instrument.h"
+
+#ifdef CLI_INSTRUMENT
+
+static const struct cli_language_definition *stats_language;
+static struct cli_output *stats_output;
+
+static const char *parse_result_names[CLI_PARSE_RESULTS] = {
+    [parse_long_command_success] = "ok",
+    [parse_long_command_too_many_tokens] = "tokens",
+    [parse_long_command_invalid_token] = "invalid",
+};
+
+static const char *match_result_names[CLI_MATCH_RESULTS] = {
+    [match_command_success] = "ok",
+    [match_command_fail] = "fail",
+    [match_command_invalid_token] = "invalid",
+};
+
+void timing_record(struct cli_timing *timing, unsigned long duration)
+{
+    if (!timing->count || duration < timing->min) {
+        timing->min = duration;
+    }
+    if (duration > timing->max) {
+        timing->max = duration;
+    }
+    timing->total += duration;
+    ++timing->count;
+}
+
+enum parse_long_command_result instrument_parse(const struct cli_language_definition *language, unsigned long start, enum parse_long_command_result result)
+{
+    struct cli_instrument *instrument = language->instrument;
+    if (instrument) {
+        timing_record(&instrument->parse, CLI_INSTRUMENT_CLOCK() - start);
+        ++instrument->parse_results[result];
+    }
+    return result;
+}
+
+enum match_command_result instrument_match(const struct cli_language_definition *language, unsigned long start, enum match_command_result result)
+{
+    struct cli_instrument *instrument = language->instrument;
+    if (instrument) {
+        timing_record(&instrument->match, CLI_INSTRUMENT_CLOCK() - start);
+        ++instrument->match_results[result];
+    }
+    return result;
+}
+
+enum cli_command_result instrument_handler(const struct cli_language_definition *language, const struct cli_command_definition *command, unsigned long start, enum cli_command_result result)
+{
+    struct cli_instrument *instrument = language->instrument;
+    if (instrument && instrument->commands) {
+        struct cli_command_stats *stats = &instrument->commands[command - language->commands];
+        timing_record(&stats->handler, CLI_INSTRUMENT_CLOCK() - start);
+        if (result != cli_command_success && result != cli_command_pending) {
+            ++stats->failures;
+        }
+    }
+    return result;
+}
+
+static void timing_clear(struct cli_timing *timing)
+{
+    timing->count = 0;
+    timing->min = 0;
+    timing->max = 0;
+    timing->total = 0;
+}
+
+void instrument_reset(const struct cli_language_definition *language)
+{
+    struct cli_instrument *instrument = language->instrument;
+    if (!instrument) {
+        return;
+    }
+    timing_clear(&instrument->parse);
+    timing_clear(&instrument->match);
+    for (int i = 0; i < CLI_PARSE_RESULTS; ++i) {
+        instrument->parse_results[i] = 0;
+    }
+    for (int i = 0; i < CLI_MATCH_RESULTS; ++i) {
+        instrument->match_results[i] = 0;
+    }
+    if (instrument->commands) {
+        for (const struct cli_command_definition *command = language->commands; command->handler; ++command) {
+            struct cli_command_stats *stats = &instrument->commands[command - language->commands];
+            timing_clear(&stats->handler);
+            stats->failures = 0;
+        }
+    }
+}
+
+static void output_field(struct cli_output *output, const char *name, unsigned long value)
+{
+    output_char(output, ' ');
+    output_string(output, name);
+    output_char(output, '=');
+    output_int(output, value);
+}
+
+static void output_timing(struct cli_output *output, const struct cli_timing *timing)
+{
+    output_field(output, "n", timing->count);
+    output_field(output, "min", timing->min);
+    output_field(output, "max", timing->max);
+    output_field(output, "mean", timing->count ? timing->total / timing->count : 0);
+}
+
+void instrument_dump(const struct cli_language_definition *language, struct cli_output *output)
+{
+    const struct cli_instrument *instrument = language->instrument;
+    if (!instrument) {
+        return;
+    }
+    output_string(output, "parse");
+    output_timing(output, &instrument->parse);
+    for (int i = 0; i < CLI_PARSE_RESULTS; ++i) {
+        output_field(output, parse_result_names[i], instrument->parse_results[i]);
+    }
+    output_string(output, PRINTF_LINEBREAK "match");
+    output_timing(output, &instrument->match);
+    for (int i = 0; i < CLI_MATCH_RESULTS; ++i) {
+        output_field(output, match_result_names[i], instrument->match_results[i]);
+    }
+    output_string(output, PRINTF_LINEBREAK);
+    if (!instrument->commands) {
+        return;
+    }
+    for (const struct cli_command_definition *command = language->commands; command->handler; ++command) {
+        const struct cli_command_stats *stats = &instrument->commands[command - language->commands];
+        if (!stats->handler.count) {
+            continue;
+        }
+        print_syntax_to(language, command, output);
+        output_char(output, ':');
+        output_timing(output, &stats->handler);
+        output_field(output, "fail", stats->failures);
+        output_string(output, PRINTF_LINEBREAK);
+    }
+}
+
+void instrument_attach(const struct cli_language_definition *language, struct cli_output *output)
+{
+    stats_language = language;
+    stats_output = output;
+}
+
+CLI_COMMAND_HANDLER(cli_stats_handler, bytecode, arguments, def)
+{
+    (void) arguments;
+    (void) def;
+    if (!stats_language) {
+        return cli_command_fail;
+    }
+    if (CLI_EXPR_IS_TERMINAL((*bytecode)[1])) {
+        instrument_dump(stats_language, stats_output);
+    } else {
+        instrument_reset(stats_language);
+    }
+    return cli_command_success;
+}
+
+#endif
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "serial_cli.h"
+#include "serial_cli_output.h"
+
+/*
+ * Optional instrumentation, enabled by defining CLI_INSTRUMENT for all
+ * translation units.  Otherwise the hooks below expand to nothing and the
+ * language definition has no instrument member, so there is no cost at all.
+ *
+ * Durations are in ticks of a user-supplied clock (e.g. a cycle counter), by
+ * default a function the application defines:
+ *
+ *   unsigned long cli_instrument_clock(void);
+ *
+ * Counters are plain (not atomic), update them from one context only.
+ */
+
+#ifdef CLI_INSTRUMENT
+
+#ifndef CLI_INSTRUMENT_CLOCK
+#define CLI_INSTRUMENT_CLOCK() cli_instrument_clock()
+unsigned long cli_instrument_clock(void);
+#endif
+
+#define CLI_PARSE_RESULTS ((parse_long_command_invalid_token) + 1)
+#define CLI_MATCH_RESULTS ((match_command_invalid_token) + 1)
+
+/* Call count and duration statistics */
+struct cli_timing
+{
+    unsigned long count;
+    unsigned long min;
+    unsigned long max;
+    unsigned long total;
+};
+
+/* Per-command slot */
+struct cli_command_stats
+{
+    struct cli_timing handler;
+    /* Handler calls which did not return success (or pending) */
+    unsigned long failures;
+};
+
+/* Statistics for a language, referenced by its instrument member */
+struct cli_instrument
+{
+    struct cli_timing parse;
+    struct cli_timing match;
+    /* Indexed by enum parse_long_command_result and match_command_result */
+    unsigned long parse_results[CLI_PARSE_RESULTS];
+    unsigned long match_results[CLI_MATCH_RESULTS];
+    /* Caller-provided, one slot per command (same order as commands) */
+    struct cli_command_stats *commands;
+};
+
+#define CLI_INSTRUMENT_START(start) unsigned long start = CLI_INSTRUMENT_CLOCK()
+#define CLI_INSTRUMENT_PARSE(language, start, result) instrument_parse((language), (start), (result))
+#define CLI_INSTRUMENT_MATCH(language, start, result) instrument_match((language), (start), (result))
+#define CLI_INSTRUMENT_HANDLER(language, command, start, result) instrument_handler((language), (command), (start), (result))
+
+/*
+ * Record a duration
+ */
+void timing_record(struct cli_timing *timing, unsigned long duration);
+
+/*
+ * Hooks, each passes its result through
+ */
+enum parse_long_command_result instrument_parse(const struct cli_language_definition *language, unsigned long start, enum parse_long_command_result result);
+enum match_command_result instrument_match(const struct cli_language_definition *language, unsigned long start, enum match_command_result result);
+enum cli_command_result instrument_handler(const struct cli_language_definition *language, const struct cli_command_definition *command, unsigned long start, enum cli_command_result result);
+
+/*
+ * Clear all statistics of a language
+ */
+void instrument_reset(const struct cli_language_definition *language);
+
+/*
+ * Dump statistics, one line each for parse, match and every command called:
+ *
+ *   parse n=12 min=3 max=40 mean=10 ok=10 tokens=1 invalid=1
+ *   match n=10 min=2 max=9 mean=4 ok=9 fail=1 invalid=0
+ *   get potato count: n=9 min=5 max=7 mean=6 fail=0
+ */
+void instrument_dump(const struct cli_language_definition *language, struct cli_output *output);
+
+/*
+ * Language and sink used by the stats commands
+ */
+void instrument_attach(const struct cli_language_definition *language, struct cli_output *output);
+
+/* Handler for "<stats>" (dump) and "<stats> <reset>" (clear) */
+CLI_COMMAND_HANDLER(cli_stats_handler, bytecode, arguments, def);
+
+/*
+ * Entries for the commands table, given the keyword indices for the two words
+ * (the macro supplies its own trailing comma, as it is empty when compiled out)
+ */
+#define CLI_STATS_COMMANDS(stats_keyword, reset_keyword) \
+    { \
+        .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(stats_keyword) }, \
+        .handler = cli_stats_handler, \
+    }, \
+    { \
+        .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(stats_keyword), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(reset_keyword) }, \
+        .handler = cli_stats_handler, \
+    },
+
+#else
+
+#define CLI_INSTRUMENT_START(start)
+#define CLI_INSTRUMENT_PARSE(language, start, result) (result)
+#define CLI_INSTRUMENT_MATCH(language, start, result) (result)
+#define CLI_INSTRUMENT_HANDLER(language, command, start, result) (result)
+#define CLI_STATS_COMMANDS(stats_keyword, reset_keyword)
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+/* Definitions shared between the serial_cli translation units */
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "serial_cli.h"
+
+#ifndef NULL
+#define NULL ((void *) 0)
+#endif
+
+/* Define bools if not done already in headers */
+#ifndef FALSE
+#define FALSE (0)
+#define TRUE (!(FALSE))
+#endif
+
+/*
+ * Barrier between writing shared data and publishing it to another context
+ * (and between reading it and releasing it).  A compiler barrier is enough
+ * when both share one core (interrupt and main loop), override for SMP.
+ */
+#ifndef CLI_BARRIER
+#if defined(__GNUC__)
+#define CLI_BARRIER() __sync_synchronize()
+#else
+#define CLI_BARRIER()
+#endif
+#endif
+
+/* Delimiter in long-format commands */
+#define CLI_LONG_SPACE ' '
+
+/* Log CLI parse errors */
+#ifdef CLI_DEBUG_PARSER
+#define parse_error_printf(format, ...) printf(format "\n", ##__VA_ARGS__)
+#define parse_error_printf_str(format, begin, end, ...) parse_error_printf(format " (token: %*.*s)", ##__VA_ARGS__, (int) (end - begin), (int) (end - begin), begin)
+#define parse_error_printf_token(format, token, ...) parse_error_printf(format " (opcode: 0x%04x)", ##__VA_ARGS__, token)
+#else
+#define parse_error_printf(...) do { } while (0)
+#define parse_error_printf_str(...) do { } while (0)
+#define parse_error_printf_token(...) do { } while (0)
+#endif
+
+/* Bytecode of a single keyword, terminal if the language does not have it */
+expression_token keyword_token(const struct cli_language_definition *language, const char *word);
+
+#ifndef CLI_NO_KEYWORD_INDEX
+/* Find child of keyword index node by character, returns zero if not found */
+unsigned short keyword_index_child(const struct cli_keyword_index_node *nodes, unsigned short node, char ch);
+#endif
@@ -0,0 +1,199 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_macro.h"
+#include "serial_cli_short.h"
+
+/* Bytes before the commands of a macro */
+#define MACRO_HEADER_SIZE (2)
+
+/* Longest macro body */
+#define MACRO_MAX_LENGTH (0xff)
+
+void macro_init(struct cli_macro_arena *arena, const struct cli_language_definition *language, unsigned char *data, unsigned short size)
+{
+    arena->language = language;
+    arena->data = data;
+    arena->size = size;
+    arena->used = 0;
+    arena->recording = FALSE;
+    arena->macro_keyword = keyword_token(language, "macro");
+    arena->record_keyword = keyword_token(language, "record");
+    arena->end_keyword = keyword_token(language, "end");
+    arena->run_keyword = keyword_token(language, "run");
+    arena->delete_keyword = keyword_token(language, "delete");
+}
+
+/*
+ * Find a saved macro, returns its offset or used if not found
+ */
+static unsigned short macro_find(const unsigned char *data, unsigned short used, unsigned char id)
+{
+    unsigned short offset = 0;
+    while (offset + MACRO_HEADER_SIZE <= used && data[offset] != id) {
+        offset += MACRO_HEADER_SIZE + data[offset + 1];
+    }
+    return offset + MACRO_HEADER_SIZE <= used ? offset : used;
+}
+
+enum macro_result macro_record(struct cli_macro_arena *arena, unsigned char id)
+{
+    macro_cancel(arena);
+    if (arena->size - arena->used < MACRO_HEADER_SIZE) {
+        return macro_full;
+    }
+    arena->record = arena->used;
+    arena->data[arena->used++] = id;
+    arena->data[arena->used++] = 0;
+    arena->recording = TRUE;
+    return macro_success;
+}
+
+enum macro_result macro_append(struct cli_macro_arena *arena, const cli_expression *command)
+{
+    if (!arena->recording) {
+        return macro_bad_state;
+    }
+    unsigned char *length = &arena->data[arena->record + 1];
+    unsigned short capacity = arena->size - arena->used;
+    if (capacity > MACRO_MAX_LENGTH - *length) {
+        capacity = MACRO_MAX_LENGTH - *length;
+    }
+    unsigned char size;
+    switch (encode_short_command(arena->language, command, arena->data + arena->used, capacity > CLI_SHORT_MAX_SIZE ? CLI_SHORT_MAX_SIZE : capacity, &size)) {
+    case encode_short_command_success:
+        break;
+    case encode_short_command_overflow:
+        return macro_full;
+    default:
+        return macro_invalid_command;
+    }
+    arena->used += size;
+    *length += size;
+    return macro_success;
+}
+
+enum macro_result macro_save(struct cli_macro_arena *arena)
+{
+    if (!arena->recording) {
+        return macro_bad_state;
+    }
+    arena->recording = FALSE;
+    unsigned short old = macro_find(arena->data, arena->record, arena->data[arena->record]);
+    if (old != arena->record) {
+        macro_delete(arena, arena->data[old]);
+    }
+    return macro_success;
+}
+
+void macro_cancel(struct cli_macro_arena *arena)
+{
+    if (arena->recording) {
+        arena->used = arena->record;
+        arena->recording = FALSE;
+    }
+}
+
+enum macro_result macro_delete(struct cli_macro_arena *arena, unsigned char id)
+{
+    unsigned short end = arena->recording ? arena->record : arena->used;
+    unsigned short offset = macro_find(arena->data, end, id);
+    if (offset == end) {
+        return macro_not_found;
+    }
+    unsigned short size = MACRO_HEADER_SIZE + arena->data[offset + 1];
+    for (unsigned short i = offset; i + size < arena->used; ++i) {
+        arena->data[i] = arena->data[i + size];
+    }
+    arena->used -= size;
+    if (arena->recording) {
+        arena->record -= size;
+    }
+    return macro_success;
+}
+
+enum macro_result macro_run_stored(const struct cli_language_definition *language, const unsigned char *data, unsigned short used, unsigned char id, struct cli_macro_report *report)
+{
+    report->executed = 0;
+    unsigned short offset = macro_find(data, used, id);
+    if (offset == used) {
+        return macro_not_found;
+    }
+    const unsigned char *it = data + offset + MACRO_HEADER_SIZE;
+    const unsigned char *end = it + data[offset + 1];
+    if (end > data + used) {
+        return macro_corrupt;
+    }
+    /* Handlers get the argument view, as from the stream parser */
+    struct cli_short_receiver receiver;
+    struct cli_call call;
+    short_receiver_init(&receiver, language, &call.expression.bytecode);
+    for (; it != end; ++it) {
+        enum receive_short_result received = receive_short(&receiver, *it);
+        if (received == receive_short_pending) {
+            continue;
+        } else if (received != receive_short_success) {
+            return macro_corrupt;
+        }
+        ++report->executed;
+        report->match = execute_call(language, &call, &report->result);
+        if (report->match != match_command_success || report->result != cli_command_success) {
+            return macro_stopped;
+        }
+    }
+    /* A command cut short */
+    return receiver.state ? macro_corrupt : macro_success;
+}
+
+enum macro_result macro_run(const struct cli_macro_arena *arena, unsigned char id, struct cli_macro_report *report)
+{
+    return macro_run_stored(arena->language, arena->data, arena->recording ? arena->record : arena->used, id, report);
+}
+
+/*
+ * Macro ID argument, returns false if out of range
+ */
+static bool macro_id(const cli_expression *value, int position, unsigned char *id)
+{
+    if (!CLI_EXPR_IS_ANY_NUMBER((*value)[position])) {
+        return FALSE;
+    }
+    long number = expression_number(value, position);
+    if (number < 0 || number > 0xff) {
+        return FALSE;
+    }
+    *id = number;
+    return TRUE;
+}
+
+enum macro_command_result macro_command(struct cli_macro_arena *arena, const cli_expression *value, enum macro_result *result, struct cli_macro_report *report)
+{
+    int length = 0;
+    while (length < CLI_MAX_TOKENS && !CLI_EXPR_IS_TERMINAL((*value)[length])) {
+        ++length;
+    }
+    if (length == 0) {
+        return macro_command_none;
+    }
+    if ((*value)[0] != arena->macro_keyword || !CLI_EXPR_IS_KEYWORD((*value)[0])) {
+        if (!arena->recording) {
+            return macro_command_none;
+        }
+        *result = macro_append(arena, value);
+    } else {
+        expression_token operation = length > 1 ? (*value)[1] : CLI_EXPR_TERMINAL;
+        unsigned char id;
+        if (length == 2 && operation == arena->end_keyword) {
+            *result = macro_save(arena);
+        } else if (length != 3 || !macro_id(value, 2, &id)) {
+            *result = macro_invalid_command;
+        } else if (operation == arena->record_keyword) {
+            *result = macro_record(arena, id);
+        } else if (operation == arena->run_keyword && !arena->recording) {
+            *result = macro_run(arena, id, report);
+        } else if (operation == arena->delete_keyword && !arena->recording) {
+            *result = macro_delete(arena, id);
+        } else {
+            *result = arena->recording ? macro_bad_state : macro_invalid_command;
+        }
+    }
+    return *result == macro_success ? macro_command_success : macro_command_fail;
+}
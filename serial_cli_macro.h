@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+
+/*
+ * Macros: sequences of parsed commands stored on the device under a numeric
+ * ID, and replayed through match_command and the handlers by one request.
+ *
+ * Commands are validated when recorded and stored in short format (see
+ * serial_cli_short.h), so "set potato count to 42" takes three bytes.  The
+ * arena is a caller-provided byte array:
+ *
+ *   [id] [length] [short commands: length bytes] ...
+ *
+ * which may be copied to flash as is, and replayed from there with
+ * macro_run_stored.
+ *
+ * If the language has the keywords "macro", "record", "end", "run" and
+ * "delete", macro_command also accepts:
+ *
+ *   macro record <id>     following commands are stored instead of run
+ *   macro end             save the recording (replacing any macro <id>)
+ *   macro run <id>
+ *   macro delete <id>
+ */
+
+struct cli_macro_arena
+{
+    const struct cli_language_definition *language;
+    /* Caller-provided storage */
+    unsigned char *data;
+    unsigned short size;
+    unsigned short used;
+    /* Offset of the macro being recorded */
+    unsigned short record;
+    bool recording;
+    /* Bytecode of the macro keywords, terminal if absent */
+    expression_token macro_keyword;
+    expression_token record_keyword;
+    expression_token end_keyword;
+    expression_token run_keyword;
+    expression_token delete_keyword;
+};
+
+/* Where and why a replay stopped */
+struct cli_macro_report
+{
+    /* Commands run, including one which failed */
+    unsigned char executed;
+    /* Of the last command run */
+    enum match_command_result match;
+    /* Valid if match succeeded */
+    enum cli_command_result result;
+};
+
+enum macro_result
+{
+    macro_success,
+    macro_not_found,
+    /* Command does not match, or has wide numbers */
+    macro_invalid_command,
+    /* Arena (or the 255-byte macro limit) is full */
+    macro_full,
+    /* Not recording, or already recording */
+    macro_bad_state,
+    /* Replay stopped at a command which did not succeed, see the report */
+    macro_stopped,
+    /* Stored data is corrupt */
+    macro_corrupt,
+};
+
+/*
+ * Initialise an arena on caller-provided storage
+ */
+void macro_init(struct cli_macro_arena *arena, const struct cli_language_definition *language, unsigned char *data, unsigned short size);
+
+/*
+ * Start recording a macro (discarding any unfinished recording)
+ */
+enum macro_result macro_record(struct cli_macro_arena *arena, unsigned char id);
+
+/*
+ * Append a command to the recording
+ */
+enum macro_result macro_append(struct cli_macro_arena *arena, const cli_expression *command);
+
+/*
+ * Save the recording, replacing an older macro with the same ID
+ */
+enum macro_result macro_save(struct cli_macro_arena *arena);
+
+/*
+ * Drop the recording
+ */
+void macro_cancel(struct cli_macro_arena *arena);
+
+/*
+ * Remove a macro
+ */
+enum macro_result macro_delete(struct cli_macro_arena *arena, unsigned char id);
+
+/*
+ * Replay a macro, stopping at the first command which does not succeed
+ */
+enum macro_result macro_run(const struct cli_macro_arena *arena, unsigned char id, struct cli_macro_report *report);
+
+/*
+ * Replay a macro from a copy of arena data (e.g. in flash)
+ */
+enum macro_result macro_run_stored(const struct cli_language_definition *language, const unsigned char *data, unsigned short used, unsigned char id, struct cli_macro_report *report);
+
+enum macro_command_result
+{
+    /* Not a macro command, and not recording: execute it normally */
+    macro_command_none,
+    /* Command was recorded, or the macro command succeeded */
+    macro_command_success,
+    /* Macro command failed, or a command could not be recorded */
+    macro_command_fail,
+};
+
+/*
+ * Handle macro commands, and record other commands while recording.  result
+ * receives the outcome of the operation (and report that of a replay).
+ */
+enum macro_command_result macro_command(struct cli_macro_arena *arena, const cli_expression *value, enum macro_result *result, struct cli_macro_report *report);
@@ -0,0 +1,212 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_output.h"
+
+/* Buffer size for the stdio wrappers */
+#ifndef CLI_STDIO_BUFFER_SIZE
+#define CLI_STDIO_BUFFER_SIZE (64)
+#endif
+
+void output_init(struct cli_output *output, cli_output_write *write, void *context, char *buffer, unsigned short size)
+{
+    output->write = write;
+    output->context = context;
+    output->buffer = buffer;
+    output->size = size;
+    output->used = 0;
+    output->started = 0;
+    output->completed = FALSE;
+    output->dropped = 0;
+}
+
+/*
+ * Drop sent bytes from the start of the buffer
+ */
+static void output_consume(struct cli_output *output, unsigned short sent)
+{
+    output->used -= sent;
+    for (unsigned short i = 0; i < output->used; ++i) {
+        output->buffer[i] = output->buffer[sent + i];
+    }
+}
+
+unsigned short output_flush(struct cli_output *output)
+{
+    if (output->started) {
+        /* Only the thread context moves data, the interrupt merely flags completion */
+        if (!output->completed) {
+            return output->used;
+        }
+        output_consume(output, output->started);
+        output->started = 0;
+    }
+    if (!output->used) {
+        return 0;
+    }
+    output->completed = FALSE;
+    unsigned short sent = output->write(output->context, output->buffer, output->used);
+    if (sent == CLI_OUTPUT_STARTED) {
+        output->started = output->used;
+        return output->used;
+    }
+    if (sent > output->used) {
+        sent = output->used;
+    }
+    output_consume(output, sent);
+    return output->used;
+}
+
+void output_complete(struct cli_output *output)
+{
+    output->completed = TRUE;
+}
+
+void output_char(struct cli_output *output, char ch)
+{
+    if (output->used == output->size && output_flush(output) == output->size) {
+        ++output->dropped;
+        return;
+    }
+    output->buffer[output->used++] = ch;
+}
+
+void output_string(struct cli_output *output, const char *str)
+{
+    for (; *str; ++str) {
+        output_char(output, *str);
+    }
+}
+
+void output_chars(struct cli_output *output, const char *data, unsigned short length)
+{
+    for (; length; --length, ++data) {
+        output_char(output, *data);
+    }
+}
+
+/*
+ * Keyword by index, from either keyword storage
+ */
+static void output_keyword(struct cli_output *output, const struct cli_language_definition *language, int index)
+{
+    unsigned char length;
+    const char *text = keyword_text(language, index, &length);
+    if (text) {
+        output_chars(output, text, length);
+    }
+}
+
+void output_int(struct cli_output *output, long value)
+{
+    char digits[3 * sizeof(long)];
+    int count = 0;
+    unsigned long magnitude = value < 0 ? -(unsigned long) value : (unsigned long) value;
+    if (value < 0) {
+        output_char(output, '-');
+    }
+    do {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude && count < (int) sizeof(digits));
+    while (count) {
+        output_char(output, digits[--count]);
+    }
+}
+
+void output_hex(struct cli_output *output, unsigned long value, int digits)
+{
+    while (digits--) {
+        output_char(output, "0123456789abcdef"[(value >> (digits * 4)) & 0xf]);
+    }
+}
+
+void print_syntax_to(const struct cli_language_definition *language, const struct cli_command_definition *command, struct cli_output *output)
+{
+    for (
+        const syntax_token *token = &command->syntax[0], *end = token + CLI_MAX_TOKENS;
+        token != end && !CLI_SPEC_IS_TERMINAL(*token);
+        ++token
+    ) {
+        if (token != &command->syntax[0]) {
+            output_char(output, ' ');
+        }
+        if (CLI_SPEC_IS_KEYWORD(*token)) {
+            output_keyword(output, language, CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(*token));
+        } else if (CLI_SPEC_IS_NUMBER(*token)) {
+            output_char(output, '#');
+        } else {
+            output_char(output, '!');
+        }
+    }
+}
+
+#ifndef CLI_NO_LIST
+void list_all_commands_to(const struct cli_language_definition *language, struct cli_output *output)
+{
+    output_string(output, PRINTF_LINEBREAK "Commands:" PRINTF_LINEBREAK);
+    for (const struct cli_command_definition *cmd = language->commands; cmd->handler; ++cmd) {
+        output_string(output, ">>> ");
+        print_syntax_to(language, cmd, output);
+        output_string(output, PRINTF_LINEBREAK);
+    }
+    output_string(output, PRINTF_LINEBREAK);
+}
+#endif
+
+void print_bytecode_to(const struct cli_language_definition *language, const cli_expression *bytecode, struct cli_output *output)
+{
+    const expression_token * const begin = *bytecode;
+    const expression_token * const end = begin + CLI_MAX_TOKENS;
+    output_string(output, "Bytecode dump: \"");
+    for (const expression_token *it = begin; it != end && !CLI_EXPR_IS_TERMINAL(*it); ++it) {
+        if (it != begin) {
+            output_char(output, CLI_LONG_SPACE);
+        }
+        if (CLI_EXPR_IS_KEYWORD(*it)) {
+            output_keyword(output, language, CLI_EXPR_KEYWORD_TO_KEYWORD_INDEX(*it));
+        } else if (CLI_EXPR_IS_ANY_NUMBER(*it)) {
+            output_int(output, expression_number(bytecode, it - begin));
+        } else {
+            output_string(output, "<error:0x");
+            output_hex(output, *it, 4);
+            output_char(output, '>');
+        }
+    }
+    output_string(output, "\" (");
+    for (const expression_token *it = begin; it != end && !CLI_EXPR_IS_TERMINAL(*it); ++it) {
+        if (it != begin) {
+            output_char(output, ' ');
+        }
+        output_hex(output, *it, 4);
+    }
+    output_string(output, ")" PRINTF_LINEBREAK);
+}
+
+#ifndef CLI_NO_STDIO
+/*
+ * Sink which writes to a stdio stream
+ */
+static unsigned short stdio_write(void *context, const char *data, unsigned short size)
+{
+    return fwrite(data, 1, size, (FILE *) context);
+}
+
+#ifndef CLI_NO_LIST
+void list_all_commands(const struct cli_language_definition *language)
+{
+    char buffer[CLI_STDIO_BUFFER_SIZE];
+    struct cli_output output;
+    output_init(&output, stdio_write, stdout, buffer, sizeof(buffer));
+    list_all_commands_to(language, &output);
+    output_flush(&output);
+}
+#endif
+
+void _print_bytecode(const struct cli_language_definition *language, const cli_expression *bytecode)
+{
+    char buffer[CLI_STDIO_BUFFER_SIZE];
+    struct cli_output output;
+    output_init(&output, stdio_write, stdout, buffer, sizeof(buffer));
+    print_bytecode_to(language, bytecode, &output);
+    output_flush(&output);
+}
+#endif
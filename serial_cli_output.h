@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+
+/* Write callback result: the transfer of all size bytes was started and owns them */
+#define CLI_OUTPUT_STARTED (0xffff)
+
+/*
+ * Transmit callback.  Returns the number of bytes consumed, which may be fewer
+ * than size (e.g. zero while the UART is busy), the remainder stays buffered
+ * until the next flush; consumed data must have been copied or sent, as the
+ * buffer is reused.  Alternatively returns CLI_OUTPUT_STARTED after starting
+ * a transfer (e.g. DMA) straight from the buffer: the data then stays untouched
+ * until output_complete, while further output is appended behind it.
+ */
+typedef unsigned short cli_output_write(void *context, const char *data, unsigned short size);
+
+/*
+ * Buffered output sink, formatted into by the library and flushed in chunks
+ */
+struct cli_output
+{
+    cli_output_write *write;
+    void *context;
+    /* Caller-provided buffer, smaller than CLI_OUTPUT_STARTED */
+    char *buffer;
+    unsigned short size;
+    unsigned short used;
+    /* Bytes at the start of the buffer owned by a started transfer */
+    unsigned short started;
+    /* Set by output_complete once that transfer has finished */
+    volatile bool completed;
+    /* Characters lost because the buffer was full and the sink was busy */
+    unsigned short dropped;
+};
+
+/*
+ * Initialise an output sink
+ */
+void output_init(struct cli_output *output, cli_output_write *write, void *context, char *buffer, unsigned short size);
+
+/*
+ * Pass buffered data to the write callback, returns number of bytes still buffered
+ */
+unsigned short output_flush(struct cli_output *output);
+
+/*
+ * Release the data of a started transfer, safe to call from its interrupt
+ */
+void output_complete(struct cli_output *output);
+
+/*
+ * Formatters
+ */
+void output_char(struct cli_output *output, char ch);
+void output_string(struct cli_output *output, const char *str);
+void output_chars(struct cli_output *output, const char *data, unsigned short length);
+void output_int(struct cli_output *output, long value);
+void output_hex(struct cli_output *output, unsigned long value, int digits);
+
+/*
+ * Print command syntax, with '#' for numbers
+ */
+void print_syntax_to(const struct cli_language_definition *language, const struct cli_command_definition *command, struct cli_output *output);
+
+#ifndef CLI_NO_LIST
+/*
+ * List all commands (ASCII-format)
+ */
+void list_all_commands_to(const struct cli_language_definition *language, struct cli_output *output);
+#endif
+
+/*
+ * Print bytecode command with its hexadecimal encoding
+ */
+void print_bytecode_to(const struct cli_language_definition *language, const cli_expression *bytecode, struct cli_output *output);
@@ -0,0 +1,83 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_queue.h"
+
+static unsigned char queue_next(const struct cli_command_queue *queue, unsigned char index)
+{
+    return index + 1 == queue->depth ? 0 : index + 1;
+}
+
+void command_queue_init(struct cli_command_queue *queue, const struct cli_language_definition *language, struct cli_queue_entry *entries, unsigned char depth)
+{
+    queue->entries = entries;
+    queue->depth = depth;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->overflows = 0;
+    queue->high_water = 0;
+    stream_parser_init(&queue->parser, language, &entries[0].bytecode);
+}
+
+enum command_queue_feed_result command_queue_feed(struct cli_command_queue *queue, char ch)
+{
+    enum stream_parser_result result = stream_parser_feed(&queue->parser, ch);
+    if (result == stream_parser_pending) {
+        return command_queue_feed_pending;
+    }
+    unsigned char head = queue->head;
+    if (result == stream_parser_success && CLI_EXPR_IS_TERMINAL(queue->entries[head].bytecode[0])) {
+        /* Blank line */
+        return command_queue_feed_pending;
+    }
+    unsigned char next = queue_next(queue, head);
+    if (next == queue->tail) {
+        /* Head entry is not visible to the consumer, so it is simply reused */
+        ++queue->overflows;
+        return command_queue_feed_overflow;
+    }
+    queue->entries[head].result = result;
+    CLI_BARRIER();
+    queue->head = next;
+    stream_parser_reset(&queue->parser, &queue->entries[next].bytecode);
+    unsigned char count = command_queue_count(queue);
+    if (count > queue->high_water) {
+        queue->high_water = count;
+    }
+    return command_queue_feed_queued;
+}
+
+unsigned char command_queue_count(const struct cli_command_queue *queue)
+{
+    unsigned char head = queue->head;
+    unsigned char tail = queue->tail;
+    return head >= tail ? head - tail : queue->depth - tail + head;
+}
+
+const struct cli_queue_entry *command_queue_peek(const struct cli_command_queue *queue)
+{
+    unsigned char tail = queue->tail;
+    if (tail == queue->head) {
+        return NULL;
+    }
+    CLI_BARRIER();
+    return &queue->entries[tail];
+}
+
+void command_queue_pop(struct cli_command_queue *queue)
+{
+    CLI_BARRIER();
+    queue->tail = queue_next(queue, queue->tail);
+}
+
+bool command_queue_execute(struct cli_command_queue *queue, struct cli_queue_result *result)
+{
+    const struct cli_queue_entry *entry = command_queue_peek(queue);
+    if (!entry) {
+        return FALSE;
+    }
+    result->parse = entry->result;
+    if (result->parse == stream_parser_success) {
+        result->match = execute_command(queue->parser.language, &entry->bytecode, &result->command);
+    }
+    command_queue_pop(queue);
+    return TRUE;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+#include "serial_cli_stream.h"
+
+/* A parsed line waiting to be executed */
+struct cli_queue_entry
+{
+    cli_expression bytecode;
+    /* enum stream_parser_result, only success lines need to be matched */
+    unsigned char result;
+};
+
+/*
+ * Single-producer/single-consumer queue of parsed commands.  The producer
+ * (typically the RX interrupt) feeds characters, which are parsed straight
+ * into the free entry at the head; completed lines are published to the
+ * consumer (main loop), which matches and runs them in place.  Handlers may
+ * therefore take as long as depth-1 lines take to arrive.
+ *
+ * Of depth entries, one is always being parsed into, so depth-1 lines can be
+ * waiting.  A line which completes while the queue is full is dropped and
+ * counted.  Blank lines are not queued.
+ *
+ * Entries are published with CLI_BARRIER (see serial_cli_internal.h), which
+ * must be overridden if producer and consumer run on different cores.
+ */
+struct cli_command_queue
+{
+    struct cli_stream_parser parser;
+    struct cli_queue_entry *entries;
+    unsigned char depth;
+    /* Entry being parsed into, written by producer only */
+    volatile unsigned char head;
+    /* Oldest waiting entry, written by consumer only */
+    volatile unsigned char tail;
+    /* Lines dropped because the queue was full, written by producer only */
+    volatile unsigned short overflows;
+    /* Most lines ever waiting at once, written by producer only */
+    volatile unsigned char high_water;
+};
+
+enum command_queue_feed_result
+{
+    command_queue_feed_pending,
+    /* A line was completed and queued */
+    command_queue_feed_queued,
+    /* A line was completed but dropped, the queue was full */
+    command_queue_feed_overflow,
+};
+
+/*
+ * Initialise a queue on caller-provided storage of depth entries (2..255)
+ */
+void command_queue_init(struct cli_command_queue *queue, const struct cli_language_definition *language, struct cli_queue_entry *entries, unsigned char depth);
+
+/*
+ * Producer: feed one received character
+ */
+enum command_queue_feed_result command_queue_feed(struct cli_command_queue *queue, char ch);
+
+/*
+ * Consumer: number of lines waiting
+ */
+unsigned char command_queue_count(const struct cli_command_queue *queue);
+
+/*
+ * Consumer: oldest waiting line, or NULL if the queue is empty.  The entry
+ * stays valid until command_queue_pop.
+ */
+const struct cli_queue_entry *command_queue_peek(const struct cli_command_queue *queue);
+
+/*
+ * Consumer: release the oldest waiting line
+ */
+void command_queue_pop(struct cli_command_queue *queue);
+
+/* Outcome of executing a queued line */
+struct cli_queue_result
+{
+    enum stream_parser_result parse;
+    /* Valid if parse succeeded */
+    enum match_command_result match;
+    /* Valid if match succeeded */
+    enum cli_command_result command;
+};
+
+/*
+ * Consumer: dequeue the oldest line, match it and run its handler.  Returns
+ * false if the queue was empty.
+ */
+bool command_queue_execute(struct cli_command_queue *queue, struct cli_queue_result *result);
@@ -0,0 +1,44 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_request.h"
+
+void request_server_init(struct cli_request_server *server, const struct cli_language_definition *language)
+{
+    server->language = language;
+    frame_receiver_init(&server->receiver, &server->call.expression.bytecode);
+    server->requests = 0;
+    server->dropped = 0;
+}
+
+unsigned char serve_request(struct cli_request_server *server, unsigned char byte, unsigned char *reply)
+{
+    enum receive_frame_result received = receive_frame(&server->receiver, byte);
+    struct cli_reply content = {
+        .sequence = server->receiver.sequence,
+    };
+    switch (received) {
+    case receive_frame_pending:
+        return 0;
+    case receive_frame_success: {
+        enum cli_command_result result = cli_command_fail;
+        enum match_command_result match = execute_call(server->language, &server->call, &result);
+        content.status = match == match_command_success ? cli_reply_executed : cli_reply_no_match;
+        content.code = match == match_command_success ? (unsigned char) result : (unsigned char) match;
+        break;
+    }
+    case receive_frame_invalid_token:
+        /* The frame arrived intact, so its sequence number can be trusted */
+        content.status = cli_reply_bad_request;
+        content.code = received;
+        break;
+    default:
+        /* The host times out on the sequence number */
+        ++server->dropped;
+        return 0;
+    }
+    if (!server->receiver.request) {
+        return 0;
+    }
+    ++server->requests;
+    encode_reply_frame(&content, reply);
+    return CLI_FRAME_REPLY_SIZE;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "serial_cli.h"
+#include "serial_cli_frame.h"
+
+/*
+ * Device side of pipelined requests: request frames (see serial_cli_frame.h)
+ * are decoded as bytes arrive, run as soon as they complete, and answered
+ * with a reply frame carrying the request's sequence number.  Requests are
+ * therefore answered in order, and the host can keep as many in flight as
+ * the receive buffering of the link allows.
+ *
+ * Plain frames are run too, but not answered, as there is nothing to
+ * correlate the reply with.
+ */
+struct cli_request_server
+{
+    const struct cli_language_definition *language;
+    struct cli_frame_receiver receiver;
+    /* Request being received, handlers get its argument view */
+    struct cli_call call;
+    /* Requests answered, and frames dropped for a bad length or CRC */
+    unsigned long requests;
+    unsigned long dropped;
+};
+
+/*
+ * Initialise a request server
+ */
+void request_server_init(struct cli_request_server *server, const struct cli_language_definition *language);
+
+/*
+ * Feed one received byte.  Returns the size of the reply written to reply
+ * (CLI_FRAME_REPLY_SIZE bytes of storage), zero if there is none yet.
+ */
+unsigned char serve_request(struct cli_request_server *server, unsigned char byte, unsigned char *reply);
@@ -0,0 +1,89 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_scheduler.h"
+#include "serial_cli_instrument.h"
+
+void scheduler_init(struct cli_scheduler *scheduler, const struct cli_language_definition *language, struct cli_task *tasks, unsigned char size, cli_completion_callback *complete, void *context)
+{
+    scheduler->language = language;
+    scheduler->tasks = tasks;
+    scheduler->size = size;
+    scheduler->next_id = 0;
+    scheduler->complete = complete;
+    scheduler->context = context;
+    for (unsigned char i = 0; i < size; ++i) {
+        tasks[i].active = FALSE;
+    }
+}
+
+/*
+ * Call a task's handler, and free the task unless it is still pending
+ */
+static enum cli_command_result task_step(const struct cli_scheduler *scheduler, struct cli_task *task)
+{
+    /* Only needed for instrumentation */
+    (void) scheduler;
+    CLI_INSTRUMENT_START(start);
+    enum cli_command_result result = CLI_INSTRUMENT_HANDLER(scheduler->language, task->command, start, task->command->handler(&task->call.expression.bytecode, &task->call.arguments, task->command));
+    if (result != cli_command_pending) {
+        task->active = FALSE;
+    }
+    return result;
+}
+
+enum scheduler_submit_result scheduler_submit(struct cli_scheduler *scheduler, const cli_expression *value, unsigned char *id, enum cli_command_result *result)
+{
+    struct cli_task *task = NULL;
+    for (unsigned char i = 0; i < scheduler->size; ++i) {
+        if (!scheduler->tasks[i].active) {
+            task = &scheduler->tasks[i];
+            break;
+        }
+    }
+    if (!task) {
+        return scheduler_submit_busy;
+    }
+    if (match_command_arguments(scheduler->language, value, &task->command, &task->call.arguments) != match_command_success) {
+        return scheduler_submit_no_match;
+    }
+    copy_expression(value, 0, CLI_MAX_TOKENS, &task->call.expression);
+    task->resume = 0;
+    task->id = scheduler->next_id++;
+    task->active = TRUE;
+    enum cli_command_result first = task_step(scheduler, task);
+    if (first != cli_command_pending) {
+        *result = first;
+        return scheduler_submit_done;
+    }
+    *id = task->id;
+    return scheduler_submit_pending;
+}
+
+unsigned char scheduler_run(struct cli_scheduler *scheduler)
+{
+    unsigned char pending = 0;
+    for (unsigned char i = 0; i < scheduler->size; ++i) {
+        struct cli_task *task = &scheduler->tasks[i];
+        if (!task->active) {
+            continue;
+        }
+        enum cli_command_result result = task_step(scheduler, task);
+        if (result == cli_command_pending) {
+            ++pending;
+        } else if (scheduler->complete) {
+            scheduler->complete(scheduler->context, task->id, result);
+        }
+    }
+    return pending;
+}
+
+bool scheduler_cancel(struct cli_scheduler *scheduler, unsigned char id)
+{
+    for (unsigned char i = 0; i < scheduler->size; ++i) {
+        struct cli_task *task = &scheduler->tasks[i];
+        if (task->active && task->id == id) {
+            task->active = FALSE;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+
+/*
+ * Cooperative scheduler for long-running command handlers.
+ *
+ * A handler run by the scheduler may return cli_command_pending, and is then
+ * called again on every scheduler_run until it returns another result, which
+ * is reported to the completion callback together with the request ID handed
+ * out when the command was submitted.  Meanwhile further commands can be
+ * submitted, up to the number of tasks.
+ *
+ * Handlers keep their place between calls protothread-style, with the
+ * CLI_TASK_* macros on the task which owns the bytecode:
+ *
+ *   CLI_COMMAND_HANDLER(bake_potato, bytecode, arguments, def)
+ *   {
+ *       struct cli_task *task = CLI_TASK(bytecode);
+ *       CLI_TASK_BEGIN(task);
+ *       oven_start();
+ *       CLI_TASK_WAIT_UNTIL(task, oven_done());
+ *       CLI_TASK_END(task);
+ *       return cli_command_success;
+ *   }
+ *
+ * Locals do not survive a yield, keep state in task->context instead.  Such
+ * handlers must only be run through the scheduler.
+ */
+
+/* Per-task words of handler state */
+#ifndef CLI_TASK_CONTEXT_SIZE
+#define CLI_TASK_CONTEXT_SIZE (2)
+#endif
+
+struct cli_task
+{
+    /* Copy of the command and its arguments, first member so handlers can
+     * find their task */
+    struct cli_call call;
+    const struct cli_command_definition *command;
+    /* Resume point, zero before the first call */
+    unsigned short resume;
+    /* Request ID, valid while active */
+    unsigned char id;
+    bool active;
+    long context[CLI_TASK_CONTEXT_SIZE];
+};
+
+/* Task running a handler, given the bytecode the handler was passed */
+#define CLI_TASK(bytecode) ((struct cli_task *) (bytecode))
+
+#define CLI_TASK_BEGIN(task) switch ((task)->resume) { case 0:
+#define CLI_TASK_END(task) } (task)->resume = 0
+
+/* Return pending, and continue after this point on the next call */
+#define CLI_TASK_YIELD(task) \
+    do { \
+        (task)->resume = __LINE__; \
+        return cli_command_pending; \
+        case __LINE__:; \
+    } while (0)
+
+/* Return pending until the condition holds */
+#define CLI_TASK_WAIT_UNTIL(task, condition) \
+    do { \
+        (task)->resume = __LINE__; \
+        case __LINE__: \
+        if (!(condition)) { \
+            return cli_command_pending; \
+        } \
+    } while (0)
+
+/* Called when a pending command completes */
+typedef void cli_completion_callback(void *context, unsigned char id, enum cli_command_result result);
+
+struct cli_scheduler
+{
+    const struct cli_language_definition *language;
+    struct cli_task *tasks;
+    unsigned char size;
+    unsigned char next_id;
+    cli_completion_callback *complete;
+    void *context;
+};
+
+enum scheduler_submit_result
+{
+    /* Handler finished on the first call, result is written */
+    scheduler_submit_done,
+    /* Handler is pending, id is written and completion will be reported */
+    scheduler_submit_pending,
+    /* No command matches */
+    scheduler_submit_no_match,
+    /* All tasks are busy, command was not run */
+    scheduler_submit_busy,
+};
+
+/*
+ * Initialise a scheduler on caller-provided task storage
+ */
+void scheduler_init(struct cli_scheduler *scheduler, const struct cli_language_definition *language, struct cli_task *tasks, unsigned char size, cli_completion_callback *complete, void *context);
+
+/*
+ * Match a command and call its handler once.  The command is copied, so value
+ * may be reused immediately.
+ */
+enum scheduler_submit_result scheduler_submit(struct cli_scheduler *scheduler, const cli_expression *value, unsigned char *id, enum cli_command_result *result);
+
+/*
+ * Resume each pending handler once, reporting those which complete.  Returns
+ * the number of commands still pending.
+ */
+unsigned char scheduler_run(struct cli_scheduler *scheduler);
+
+/*
+ * Drop a pending command without reporting it, returns false if not found
+ */
+bool scheduler_cancel(struct cli_scheduler *scheduler, unsigned char id);
@@ -0,0 +1,128 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_short.h"
+
+enum short_receiver_state
+{
+    short_receiver_opcode,
+    short_receiver_number_high,
+    short_receiver_number_low,
+};
+
+/*
+ * Encode a bytecode command as a short command
+ */
+enum encode_short_command_result encode_short_command(const struct cli_language_definition *language, const cli_expression *bytecode, unsigned char *data, unsigned char capacity, unsigned char *size)
+{
+    const struct cli_command_definition *command;
+    unsigned char *out_it = data;
+    unsigned char *out_end = data + capacity;
+    if (match_command(language, bytecode, &command) != match_command_success) {
+        return encode_short_command_no_match;
+    }
+    if (out_it == out_end) {
+        return encode_short_command_overflow;
+    }
+    *out_it++ = CLI_SHORT_OPCODE(command - language->commands);
+    for (
+        const expression_token *it = *bytecode, *end = it + CLI_MAX_TOKENS;
+        it != end && !CLI_EXPR_IS_TERMINAL(*it);
+        ++it
+    ) {
+        if (CLI_EXPR_IS_KEYWORD(*it)) {
+            /* Implied by the opcode */
+        } else if (CLI_EXPR_IS_NUMBER(*it)) {
+            if (out_end - out_it < 2) {
+                return encode_short_command_overflow;
+            }
+            unsigned short value = *it - CLI_EXPR_NUMBER_BEGIN;
+            *out_it++ = value >> 8;
+            *out_it++ = value & 0xff;
+        } else {
+            parse_error_printf_token("Cannot encode token", *it);
+            return encode_short_command_invalid_token;
+        }
+    }
+    *size = out_it - data;
+    return encode_short_command_success;
+}
+
+void short_receiver_init(struct cli_short_receiver *receiver, const struct cli_language_definition *language, cli_expression *output)
+{
+    receiver->language = language;
+    receiver->output = output;
+    receiver->state = short_receiver_opcode;
+}
+
+/*
+ * Copy keywords up to the next number in the syntax, returns true if the
+ * command is complete
+ */
+static bool short_receiver_advance(struct cli_short_receiver *receiver)
+{
+    const syntax_token *syntax = receiver->command->syntax;
+    for (; receiver->position < CLI_MAX_TOKENS; ++receiver->position) {
+        syntax_token token = syntax[receiver->position];
+        if (CLI_SPEC_IS_TERMINAL(token)) {
+            break;
+        } else if (CLI_SPEC_IS_NUMBER(token)) {
+            return FALSE;
+        }
+        (*receiver->output)[receiver->position] = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(token));
+    }
+    if (receiver->position != CLI_MAX_TOKENS) {
+        (*receiver->output)[receiver->position] = CLI_EXPR_TERMINAL;
+    }
+    return TRUE;
+}
+
+enum receive_short_result receive_short(struct cli_short_receiver *receiver, unsigned char byte)
+{
+    switch (receiver->state) {
+    case short_receiver_opcode:
+        if (!(byte & CLI_SHORT_OPCODE_FLAG)) {
+            return receive_short_not_short;
+        }
+        receiver->command = receiver->language->commands;
+        for (unsigned char index = byte & ~CLI_SHORT_OPCODE_FLAG; index && receiver->command->handler; --index) {
+            ++receiver->command;
+        }
+        if (!receiver->command->handler) {
+            parse_error_printf("Invalid opcode");
+            return receive_short_invalid_opcode;
+        }
+        receiver->position = 0;
+        break;
+    case short_receiver_number_high:
+        receiver->high = byte;
+        receiver->state = short_receiver_number_low;
+        return receive_short_pending;
+    case short_receiver_number_low:
+        receiver->state = short_receiver_opcode;
+        unsigned short value = (receiver->high << 8) | byte;
+        if (value >= CLI_RANGE_NUMBER) {
+            parse_error_printf("Invalid number");
+            return receive_short_invalid_number;
+        }
+        (*receiver->output)[receiver->position++] = CLI_EXPR_NUMBER_BEGIN + value;
+        break;
+    }
+    if (short_receiver_advance(receiver)) {
+        receiver->state = short_receiver_opcode;
+        return receive_short_success;
+    }
+    receiver->state = short_receiver_number_high;
+    return receive_short_pending;
+}
+
+enum receive_short_result decode_short_command(const struct cli_language_definition *language, const unsigned char *data, unsigned char size, cli_expression *output)
+{
+    struct cli_short_receiver receiver;
+    short_receiver_init(&receiver, language, output);
+    for (const unsigned char *it = data, *end = data + size; it != end; ++it) {
+        enum receive_short_result result = receive_short(&receiver, *it);
+        if (result != receive_short_pending) {
+            return it + 1 == end || result != receive_short_success ? result : receive_short_bad_length;
+        }
+    }
+    return receive_short_pending;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "serial_cli.h"
+
+/*
+ * Short-format commands, derived from the language definition:
+ *
+ *   [opcode] [number]...
+ *
+ *   1ccccccc           opcode: index c of the command in the commands list
+ *   0nnnnnnn nnnnnnnn  number, bytecode value minus CLI_EXPR_NUMBER_BEGIN (as
+ *                      in frames), one per number in the command's syntax
+ *
+ * Keywords are implied by the opcode, so "set potato count to 42" is three
+ * bytes instead of 22.  The receiver expands a short command back into the
+ * same bytecode the long format parses to, to be matched and run as usual.
+ *
+ * Opcodes have the top bit set, so they cannot be confused with text: bytes
+ * which do not belong to a short command are handed back for the stream
+ * parser, and both formats can share one link.
+ */
+
+/* Opcode of the command with given index */
+#define CLI_SHORT_OPCODE_FLAG ((unsigned char) 0x80)
+#define CLI_SHORT_OPCODE(index) ((unsigned char) ((index) | (CLI_SHORT_OPCODE_FLAG)))
+
+/* Largest short command (all tokens but the first numbers) */
+#define CLI_SHORT_MAX_SIZE (1 + ((CLI_MAX_TOKENS) - 1) * 2)
+
+/*
+ * Encode a bytecode command in short format (numbers must be in bytecode
+ * range, wide numbers cannot be encoded)
+ */
+enum encode_short_command_result
+{
+    encode_short_command_success,
+    encode_short_command_overflow,
+    encode_short_command_no_match,
+    encode_short_command_invalid_token,
+};
+
+enum encode_short_command_result encode_short_command(const struct cli_language_definition *language, const cli_expression *bytecode, unsigned char *data, unsigned char capacity, unsigned char *size);
+
+/*
+ * Incremental short-format decoder, writes tokens straight into the output
+ */
+struct cli_short_receiver
+{
+    const struct cli_language_definition *language;
+    cli_expression *output;
+    /* Command being received */
+    const struct cli_command_definition *command;
+    /* Syntax position of the next number */
+    unsigned char position;
+    /* enum short_receiver_state */
+    unsigned char state;
+    /* High byte of a number */
+    unsigned char high;
+};
+
+enum receive_short_result
+{
+    /* More bytes are needed to complete the command */
+    receive_short_pending,
+    /* Command complete, output holds its bytecode */
+    receive_short_success,
+    /* Byte is not part of a short command (e.g. text for the stream parser) */
+    receive_short_not_short,
+    /* Command was dropped */
+    receive_short_invalid_opcode,
+    receive_short_invalid_number,
+    /* Buffer does not hold exactly one command (decode_short_command only) */
+    receive_short_bad_length,
+};
+
+/*
+ * Initialise a short-format receiver, which will write received commands to output
+ */
+void short_receiver_init(struct cli_short_receiver *receiver, const struct cli_language_definition *language, cli_expression *output);
+
+/*
+ * Feed one byte.  On success, the output must be consumed before the next
+ * byte is fed.
+ */
+enum receive_short_result receive_short(struct cli_short_receiver *receiver, unsigned char byte);
+
+/*
+ * Decode one complete short command from a buffer
+ */
+enum receive_short_result decode_short_command(const struct cli_language_definition *language, const unsigned char *data, unsigned char size, cli_expression *output);
@@ -0,0 +1,284 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_stream.h"
+
+/* Keyword candidate when no keyword matches the word so far */
+#define STREAM_NO_KEYWORD ((unsigned short) 0xffff)
+
+/* Longest word which is tracked character-by-character */
+#define STREAM_MAX_WORD_LENGTH (0xff)
+
+enum stream_parser_state
+{
+    stream_parser_space,
+    stream_parser_word,
+    stream_parser_discard,
+};
+
+/*
+ * Test whether a keyword shares the first length characters of the candidate
+ * keyword (which is known to have at least that many characters)
+ */
+static bool keyword_prefix_equal(const char *candidate, const char *keyword, unsigned char length)
+{
+    for (; length; --length, ++candidate, ++keyword) {
+        if (*candidate != *keyword) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Find first keyword (from the candidate onwards) which continues the current
+ * prefix with the given character.  The candidate is always the first keyword
+ * in the list matching the prefix, so the final result is identical to the
+ * linear search in parse_keyword.
+ */
+static unsigned short keyword_list_advance(const cli_keyword *keywords, unsigned short candidate, unsigned char length, char ch)
+{
+    const char *prefix = keywords[candidate];
+    for (const cli_keyword *keyword = &keywords[candidate]; *keyword; ++keyword) {
+        if (keyword_prefix_equal(prefix, *keyword, length) && (*keyword)[length] == ch) {
+            return keyword - keywords;
+        }
+    }
+    return STREAM_NO_KEYWORD;
+}
+
+/*
+ * Same as keyword_list_advance, for a keyword pool
+ */
+static unsigned short keyword_pool_advance(const unsigned char *pool, unsigned short candidate, unsigned char length, char ch)
+{
+    const unsigned char *entry = pool + 1;
+    unsigned short index = 0;
+    for (; index != candidate; ++index) {
+        entry += *entry + 1;
+    }
+    const char *prefix = (const char *) entry + 1;
+    for (; *entry; entry += *entry + 1, ++index) {
+        const char *text = (const char *) entry + 1;
+        if (*entry < length || !keyword_prefix_equal(prefix, text, length)) {
+            continue;
+        }
+        if (ch ? *entry > length && text[length] == ch : *entry == length) {
+            return index;
+        }
+    }
+    return STREAM_NO_KEYWORD;
+}
+
+/*
+ * Start a new word
+ */
+static void stream_word_begin(struct cli_stream_parser *parser)
+{
+    const struct cli_language_definition *language = parser->language;
+    parser->state = stream_parser_word;
+    parser->word_length = 0;
+    parser->number = 0;
+    parser->negative = FALSE;
+#ifdef CLI_NO_NUMBERS
+    parser->is_number = FALSE;
+#else
+    parser->is_number = TRUE;
+#endif
+    parser->base = 10;
+    parser->digits = 0;
+#ifndef CLI_NO_KEYWORD_INDEX
+    if (language->keyword_index) {
+        parser->keyword = 0;
+        return;
+    }
+#endif
+    if (language->keyword_pool) {
+        parser->keyword = language->keyword_pool[1] ? 0 : STREAM_NO_KEYWORD;
+    } else {
+        parser->keyword = language->keywords[0] ? 0 : STREAM_NO_KEYWORD;
+    }
+}
+
+/*
+ * Advance keyword candidate by one character ('\0' for end of word)
+ */
+static unsigned short stream_keyword_feed(const struct cli_stream_parser *parser, char ch)
+{
+    const struct cli_language_definition *language = parser->language;
+    if (parser->keyword == STREAM_NO_KEYWORD) {
+        return STREAM_NO_KEYWORD;
+    }
+#ifndef CLI_NO_KEYWORD_INDEX
+    if (language->keyword_index) {
+        const struct cli_keyword_index_node *nodes = language->keyword_index->nodes;
+        if (!ch) {
+            return nodes[parser->keyword].keyword ? nodes[parser->keyword].keyword - 1 : STREAM_NO_KEYWORD;
+        }
+        unsigned short child = keyword_index_child(nodes, parser->keyword, ch);
+        return child ? child : STREAM_NO_KEYWORD;
+    }
+#endif
+    if (language->keyword_pool) {
+        return keyword_pool_advance(language->keyword_pool, parser->keyword, parser->word_length, ch);
+    }
+    return keyword_list_advance(language->keywords, parser->keyword, parser->word_length, ch);
+}
+
+#ifndef CLI_NO_NUMBERS
+/*
+ * Advance number candidate by one character, same rules as parse_long_command
+ */
+static void stream_number_feed(struct cli_stream_parser *parser, char ch)
+{
+    if (!parser->is_number) {
+        return;
+    }
+    unsigned char digit = parser->base;
+    if (ch >= '0' && ch <= '9') {
+        digit = ch - '0';
+    } else if (ch >= 'a' && ch <= 'f') {
+        digit = ch - 'a' + 10;
+    } else if (ch >= 'A' && ch <= 'F') {
+        digit = ch - 'A' + 10;
+    }
+    if (parser->word_length == 0 && ch == '-') {
+        parser->negative = TRUE;
+    } else if ((ch == 'x' || ch == 'X') && parser->base == 10 && parser->digits == 1 && parser->number == 0) {
+        /* Hexadecimal prefix */
+        parser->base = 16;
+        parser->digits = 0;
+    } else if (digit >= parser->base) {
+        parser->is_number = FALSE;
+    } else {
+        parser->number = parser->number * parser->base + digit;
+        parser->digits = 1 + (parser->digits != 0);
+        if (parser->number > CLI_NUMBER_ABSMAX) {
+            parser->is_number = FALSE;
+        }
+    }
+}
+#endif
+
+/*
+ * Feed a character of the current word
+ */
+static void stream_word_feed(struct cli_stream_parser *parser, char ch)
+{
+#ifndef CLI_NO_NUMBERS
+    stream_number_feed(parser, ch);
+#endif
+    if (parser->word_length == STREAM_MAX_WORD_LENGTH) {
+        parser->keyword = STREAM_NO_KEYWORD;
+        return;
+    }
+    parser->keyword = stream_keyword_feed(parser, ch);
+    ++parser->word_length;
+}
+
+/*
+ * Complete the current word and append its bytecode to the output
+ */
+static bool stream_word_end(struct cli_stream_parser *parser)
+{
+    expression_token token;
+    unsigned short keyword = parser->word_length == STREAM_MAX_WORD_LENGTH ? STREAM_NO_KEYWORD : stream_keyword_feed(parser, '\0');
+    int value = parser->negative ? -parser->number : parser->number;
+    if (keyword != STREAM_NO_KEYWORD) {
+        /* Keyword matches have highest precedence */
+        token = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(keyword);
+    } else if (parser->is_number && (parser->base == 10 || parser->digits) && value >= CLI_NUMBER_MIN && value <= CLI_NUMBER_MAX) {
+        /* Integer value */
+        token = CLI_INT_TO_EXPR_NUMBER(value);
+    } else {
+        parse_error_printf("Unrecognised token at index %d", parser->length);
+        return FALSE;
+    }
+    (*parser->output)[parser->length++] = token;
+    parser->state = stream_parser_space;
+    return TRUE;
+}
+
+/*
+ * Drop the rest of the line, and report an error at the line break
+ */
+static void stream_discard(struct cli_stream_parser *parser, enum stream_parser_result error)
+{
+    parser->state = stream_parser_discard;
+    parser->error = error;
+}
+
+void stream_parser_init(struct cli_stream_parser *parser, const struct cli_language_definition *language, cli_expression *output)
+{
+    parser->language = language;
+    stream_parser_reset(parser, output);
+}
+
+void stream_parser_reset(struct cli_stream_parser *parser, cli_expression *output)
+{
+    parser->output = output;
+    parser->length = 0;
+    parser->state = stream_parser_space;
+}
+
+enum stream_parser_result stream_parser_feed(struct cli_stream_parser *parser, char ch)
+{
+    if (ch == '\r') {
+        return stream_parser_pending;
+    }
+    if (ch == CLI_STREAM_LINE_BREAK) {
+        enum stream_parser_result result = stream_parser_success;
+        if (parser->state == stream_parser_word && !stream_word_end(parser)) {
+            stream_discard(parser, stream_parser_invalid_token);
+        }
+        if (parser->state == stream_parser_discard) {
+            result = parser->error;
+        } else if (parser->length != CLI_MAX_TOKENS) {
+            (*parser->output)[parser->length] = CLI_EXPR_TERMINAL;
+        }
+        parser->length = 0;
+        parser->state = stream_parser_space;
+        return result;
+    }
+    if ((unsigned char) ch < CLI_LONG_SPACE || ch == 0x7f) {
+        /* Control characters (including NUL, the keyword trackers' end of word) never form a token */
+        if (parser->state != stream_parser_discard) {
+            parse_error_printf("Control character 0x%02x at index %d", (unsigned char) ch, parser->length);
+            stream_discard(parser, stream_parser_invalid_token);
+        }
+        return stream_parser_pending;
+    }
+    switch (parser->state) {
+    case stream_parser_space:
+        if (ch == CLI_LONG_SPACE) {
+            break;
+        }
+        if (parser->length == CLI_MAX_TOKENS) {
+            parse_error_printf("Too many tokens");
+            stream_discard(parser, stream_parser_too_many_tokens);
+            break;
+        }
+        stream_word_begin(parser);
+        stream_word_feed(parser, ch);
+        break;
+    case stream_parser_word:
+        if (ch != CLI_LONG_SPACE) {
+            stream_word_feed(parser, ch);
+        } else if (!stream_word_end(parser)) {
+            stream_discard(parser, stream_parser_invalid_token);
+        }
+        break;
+    default:
+        break;
+    }
+    return stream_parser_pending;
+}
+
+enum stream_parser_result stream_parser_feed_chunk(struct cli_stream_parser *parser, const char *begin, const char *end, const char **next)
+{
+    enum stream_parser_result result = stream_parser_pending;
+    const char *it;
+    for (it = begin; it != end && result == stream_parser_pending; ++it) {
+        result = stream_parser_feed(parser, *it);
+    }
+    *next = it;
+    return result;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+
+/* Line terminator for the stream parser ('\r' is ignored) */
+#define CLI_STREAM_LINE_BREAK '\n'
+
+/*
+ * Incremental long-format parser: characters are tokenized and resolved to
+ * keywords/numbers as they arrive, so no line buffer is needed.  Once a line
+ * break is received, only match_command remains to be run on the output.
+ *
+ * State is a few bytes, so a parser can be fed directly from an RX interrupt.
+ */
+struct cli_stream_parser
+{
+    const struct cli_language_definition *language;
+    cli_expression *output;
+    /* Tokens completed in the current line */
+    unsigned char length;
+    /* enum stream_parser_state */
+    unsigned char state;
+    /* Characters received of the current word */
+    unsigned char word_length;
+    /* Keyword index node (or keyword list index) matching the word so far */
+    unsigned short keyword;
+    /* Magnitude of the number matching the word so far */
+    int number;
+    bool negative;
+    bool is_number;
+    /* Base (10, or 16 after a 0x prefix) and digits received in that base */
+    unsigned char base;
+    unsigned char digits;
+    /* Error to report at the end of a discarded line */
+    unsigned char error;
+};
+
+enum stream_parser_result
+{
+    /* More characters are needed to complete the line */
+    stream_parser_pending,
+    /* Line complete, output holds the parsed command */
+    stream_parser_success,
+    /* Line was discarded */
+    stream_parser_too_many_tokens,
+    stream_parser_invalid_token,
+};
+
+/*
+ * Initialise a stream parser, which will write parsed commands to output
+ */
+void stream_parser_init(struct cli_stream_parser *parser, const struct cli_language_definition *language, cli_expression *output);
+
+/*
+ * Discard the current line, and write subsequent commands to output
+ */
+void stream_parser_reset(struct cli_stream_parser *parser, cli_expression *output);
+
+/*
+ * Feed one character.  On a result other than pending, the output must be
+ * consumed before the next character is fed.
+ */
+enum stream_parser_result stream_parser_feed(struct cli_stream_parser *parser, char ch);
+
+/*
+ * Feed characters until a line completes or the chunk is exhausted, returns
+ * pending if the chunk was exhausted.  next receives the position to resume.
+ */
+enum stream_parser_result stream_parser_feed_chunk(struct cli_stream_parser *parser, const char *begin, const char *end, const char **next);
@@ -0,0 +1,225 @@
+#include "serial_cli_internal.h"
+#include "serial_cli_telemetry.h"
+#include "serial_cli_instrument.h"
+
+/* Output of the handler being run by telemetry_tick */
+static struct cli_output *telemetry_current;
+
+/* Offset of handler data in the frame */
+#define TELEMETRY_DATA_OFFSET (1 + (CLI_TELEMETRY_HEADER_SIZE))
+
+/*
+ * Write callback of the frame output, which never drains: a handler writing
+ * more than fits shows up as dropped characters
+ */
+static unsigned short telemetry_frame_full(void *context, const char *data, unsigned short size)
+{
+    (void) context;
+    (void) data;
+    (void) size;
+    return 0;
+}
+
+void telemetry_init(struct cli_telemetry *telemetry, const struct cli_language_definition *language, struct cli_subscription *subscriptions, unsigned char count, unsigned char *ring, unsigned short ring_size)
+{
+    telemetry->language = language;
+    telemetry->subscriptions = subscriptions;
+    telemetry->count = count;
+    telemetry->ring = ring;
+    telemetry->ring_size = ring_size;
+    telemetry->head = 0;
+    telemetry->tail = 0;
+    telemetry->next = 0;
+    telemetry->frames = 0;
+    telemetry->coalesced = 0;
+    telemetry->errors = 0;
+    for (unsigned char i = 0; i < count; ++i) {
+        subscriptions[i].period = 0;
+    }
+    output_init(&telemetry->output, telemetry_frame_full, NULL, (char *) telemetry->frame + TELEMETRY_DATA_OFFSET, CLI_TELEMETRY_MAX_DATA);
+    telemetry->subscribe_keyword = keyword_token(language, "subscribe");
+    telemetry->every_keyword = keyword_token(language, "every");
+    telemetry->unsubscribe_keyword = keyword_token(language, "unsubscribe");
+}
+
+enum telemetry_command_result telemetry_subscribe(struct cli_telemetry *telemetry, const cli_expression *command, unsigned short period, unsigned char *id)
+{
+    struct cli_subscription *subscription = NULL;
+    const struct cli_command_definition *def;
+    struct cli_arguments arguments;
+    for (unsigned char i = 0; i < telemetry->count; ++i) {
+        if (!telemetry->subscriptions[i].period) {
+            subscription = &telemetry->subscriptions[i];
+            break;
+        }
+    }
+    if (!period) {
+        return telemetry_command_invalid_period;
+    }
+    if (match_command_arguments(telemetry->language, command, &def, &arguments) != match_command_success) {
+        return telemetry_command_no_match;
+    }
+    if (!(def->flags & CLI_COMMAND_READ_ONLY)) {
+        return telemetry_command_not_read_only;
+    }
+    if (!subscription) {
+        return telemetry_command_full;
+    }
+    copy_expression(command, 0, CLI_MAX_TOKENS, &subscription->call.expression);
+    subscription->call.arguments = arguments;
+    subscription->command = def;
+    subscription->countdown = period;
+    subscription->sequence = 0;
+    subscription->overdue = FALSE;
+    subscription->period = period;
+    *id = subscription - telemetry->subscriptions;
+    return telemetry_command_subscribed;
+}
+
+enum telemetry_command_result telemetry_unsubscribe(struct cli_telemetry *telemetry, unsigned char id)
+{
+    if (id >= telemetry->count || !telemetry->subscriptions[id].period) {
+        return telemetry_command_no_match;
+    }
+    telemetry->subscriptions[id].period = 0;
+    return telemetry_command_unsubscribed;
+}
+
+enum telemetry_command_result telemetry_command(struct cli_telemetry *telemetry, const cli_expression *value, unsigned char *id)
+{
+    int length = 0;
+    while (length < CLI_MAX_TOKENS && !CLI_EXPR_IS_TERMINAL((*value)[length])) {
+        ++length;
+    }
+    if (length == 0) {
+        return telemetry_command_none;
+    }
+    expression_token first = (*value)[0];
+    if (first == telemetry->subscribe_keyword && CLI_EXPR_IS_KEYWORD(first)) {
+        if (length < 4 || (*value)[length - 2] != telemetry->every_keyword || !CLI_EXPR_IS_ANY_NUMBER((*value)[length - 1])) {
+            return telemetry_command_no_match;
+        }
+        long period = expression_number(value, length - 1);
+        if (period < 1 || period > 0xffff) {
+            return telemetry_command_invalid_period;
+        }
+        struct cli_wide_expression command;
+        copy_expression(value, 1, length - 2, &command);
+        return telemetry_subscribe(telemetry, &command.bytecode, period, id);
+    }
+    if (first == telemetry->unsubscribe_keyword && CLI_EXPR_IS_KEYWORD(first)) {
+        if (length != 2 || !CLI_EXPR_IS_ANY_NUMBER((*value)[1])) {
+            return telemetry_command_no_match;
+        }
+        long subscription = expression_number(value, 1);
+        if (subscription < 0 || subscription >= telemetry->count) {
+            return telemetry_command_no_match;
+        }
+        return telemetry_unsubscribe(telemetry, subscription);
+    }
+    return telemetry_command_none;
+}
+
+static unsigned short ring_used(const struct cli_telemetry *telemetry)
+{
+    unsigned short head = telemetry->head;
+    unsigned short tail = telemetry->tail;
+    return head >= tail ? head - tail : telemetry->ring_size - tail + head;
+}
+
+/*
+ * Copy a frame into the ring and publish it, caller checked there is room
+ */
+static void ring_write(struct cli_telemetry *telemetry, const unsigned char *data, unsigned short size)
+{
+    unsigned short head = telemetry->head;
+    for (; size; --size) {
+        telemetry->ring[head] = *data++;
+        head = head + 1 == telemetry->ring_size ? 0 : head + 1;
+    }
+    CLI_BARRIER();
+    telemetry->head = head;
+}
+
+/*
+ * Run a subscription's handler and queue its output
+ */
+static void telemetry_sample(struct cli_telemetry *telemetry, struct cli_subscription *subscription)
+{
+    struct cli_output *output = &telemetry->output;
+    output->used = 0;
+    output->dropped = 0;
+    telemetry_current = output;
+    CLI_INSTRUMENT_START(start);
+    enum cli_command_result result = CLI_INSTRUMENT_HANDLER(telemetry->language, subscription->command, start, subscription->command->handler(&subscription->call.expression.bytecode, &subscription->call.arguments, subscription->command));
+    telemetry_current = NULL;
+    if (result != cli_command_success || output->dropped) {
+        ++telemetry->errors;
+        return;
+    }
+    unsigned char *frame = telemetry->frame;
+    unsigned char length = CLI_TELEMETRY_HEADER_SIZE + output->used;
+    frame[0] = length;
+    frame[1] = CLI_FRAME_TELEMETRY;
+    frame[2] = subscription - telemetry->subscriptions;
+    frame[3] = subscription->sequence;
+    unsigned char crc = 0;
+    for (unsigned char i = 0; i < length + 1; ++i) {
+        crc = cli_crc8(crc, frame[i]);
+    }
+    frame[length + 1] = crc;
+    ring_write(telemetry, frame, CLI_FRAME_SIZE(length));
+    ++telemetry->frames;
+}
+
+void telemetry_tick(struct cli_telemetry *telemetry)
+{
+    for (unsigned char i = 0; i < telemetry->count; ++i) {
+        struct cli_subscription *subscription = &telemetry->subscriptions[i];
+        if (!subscription->period || --subscription->countdown) {
+            continue;
+        }
+        subscription->countdown = subscription->period;
+        ++subscription->sequence;
+        if (subscription->overdue) {
+            ++telemetry->coalesced;
+        }
+        subscription->overdue = TRUE;
+    }
+    unsigned char start = telemetry->next;
+    for (unsigned char i = 0; i < telemetry->count; ++i) {
+        unsigned char index = (start + i) % telemetry->count;
+        struct cli_subscription *subscription = &telemetry->subscriptions[index];
+        if (!subscription->period || !subscription->overdue) {
+            continue;
+        }
+        if (telemetry->ring_size - 1 - ring_used(telemetry) < CLI_TELEMETRY_MAX_FRAME_SIZE) {
+            /* Saturated, start here next time */
+            telemetry->next = index;
+            return;
+        }
+        telemetry_sample(telemetry, subscription);
+        subscription->overdue = FALSE;
+        telemetry->next = (index + 1) % telemetry->count;
+    }
+}
+
+struct cli_output *telemetry_output(void)
+{
+    return telemetry_current;
+}
+
+unsigned short telemetry_read(struct cli_telemetry *telemetry, unsigned char *data, unsigned short size)
+{
+    unsigned short tail = telemetry->tail;
+    unsigned short head = telemetry->head;
+    unsigned short count = 0;
+    CLI_BARRIER();
+    for (; count < size && tail != head; ++count) {
+        data[count] = telemetry->ring[tail];
+        tail = tail + 1 == telemetry->ring_size ? 0 : tail + 1;
+    }
+    CLI_BARRIER();
+    telemetry->tail = tail;
+    return count;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "serial_cli.h"
+#include "serial_cli_frame.h"
+#include "serial_cli_output.h"
+
+/*
+ * Periodic telemetry: read-only commands are subscribed with a period in
+ * ticks, and telemetry_tick runs those which are due, packing what each
+ * handler writes to telemetry_output() into a frame in a TX ring:
+ *
+ *   [length] [CLI_FRAME_TELEMETRY] [id] [sequence] [data...] [crc]
+ *
+ * Framing and CRC are as for command frames (see serial_cli_frame.h).  The
+ * sequence counts periods elapsed, so gaps show where samples were merged.
+ *
+ * Frames are only queued whole.  While the ring lacks room for a frame, due
+ * subscriptions stay overdue and are sampled once there is room again, so a
+ * saturated link gets the latest values at a lower rate instead of a growing
+ * backlog.
+ *
+ * If the language has the keywords "subscribe", "every" and "unsubscribe",
+ * telemetry_command also accepts:
+ *
+ *   subscribe <command...> every <ticks>
+ *   unsubscribe <id>
+ */
+
+/* Largest handler output per frame */
+#ifndef CLI_TELEMETRY_MAX_DATA
+#define CLI_TELEMETRY_MAX_DATA (16)
+#endif
+
+/* Telemetry frame marker, first payload byte (in the range reserved by command frames) */
+#define CLI_FRAME_TELEMETRY ((unsigned char) 0xc0)
+
+/* Payload bytes before the handler output */
+#define CLI_TELEMETRY_HEADER_SIZE (3)
+
+/* Largest telemetry frame */
+#define CLI_TELEMETRY_MAX_FRAME_SIZE CLI_FRAME_SIZE((CLI_TELEMETRY_HEADER_SIZE) + (CLI_TELEMETRY_MAX_DATA))
+
+struct cli_subscription
+{
+    /* Copy of the command and its arguments, decoded once at subscription */
+    struct cli_call call;
+    const struct cli_command_definition *command;
+    /* Ticks between samples, zero if the slot is free */
+    unsigned short period;
+    /* Ticks until the next sample is due */
+    unsigned short countdown;
+    /* Periods elapsed (modulo 256) */
+    unsigned char sequence;
+    /* Due, but not sent yet */
+    bool overdue;
+};
+
+struct cli_telemetry
+{
+    const struct cli_language_definition *language;
+    /* Caller-provided subscription slots, the index is the subscription ID */
+    struct cli_subscription *subscriptions;
+    unsigned char count;
+    /* Caller-provided TX ring of complete frames */
+    unsigned char *ring;
+    unsigned short ring_size;
+    /* Written by telemetry_tick only */
+    volatile unsigned short head;
+    /* Written by telemetry_read only */
+    volatile unsigned short tail;
+    /* Subscription to try first on the next tick, for fairness when saturated */
+    unsigned char next;
+    /* Frame under construction, handlers write into its data */
+    unsigned char frame[CLI_TELEMETRY_MAX_FRAME_SIZE];
+    struct cli_output output;
+    /* Bytecode of the subscription keywords, terminal if absent */
+    expression_token subscribe_keyword;
+    expression_token every_keyword;
+    expression_token unsubscribe_keyword;
+    /* Frames queued */
+    unsigned long frames;
+    /* Samples merged into a later one because the link was saturated */
+    unsigned long coalesced;
+    /* Samples dropped because the handler failed or wrote too much */
+    unsigned long errors;
+};
+
+enum telemetry_command_result
+{
+    /* Not a subscription command, execute it normally */
+    telemetry_command_none,
+    telemetry_command_subscribed,
+    telemetry_command_unsubscribed,
+    /* No such command, or no such subscription */
+    telemetry_command_no_match,
+    telemetry_command_not_read_only,
+    telemetry_command_full,
+    telemetry_command_invalid_period,
+};
+
+/*
+ * Initialise telemetry on caller-provided subscription slots and TX ring (the
+ * ring must be larger than CLI_TELEMETRY_MAX_FRAME_SIZE)
+ */
+void telemetry_init(struct cli_telemetry *telemetry, const struct cli_language_definition *language, struct cli_subscription *subscriptions, unsigned char count, unsigned char *ring, unsigned short ring_size);
+
+/*
+ * Subscribe a read-only command, id receives the subscription ID
+ */
+enum telemetry_command_result telemetry_subscribe(struct cli_telemetry *telemetry, const cli_expression *command, unsigned short period, unsigned char *id);
+
+/*
+ * Cancel a subscription
+ */
+enum telemetry_command_result telemetry_unsubscribe(struct cli_telemetry *telemetry, unsigned char id);
+
+/*
+ * Handle "subscribe ... every N" and "unsubscribe N" commands, id receives
+ * the subscription ID on subscribe
+ */
+enum telemetry_command_result telemetry_command(struct cli_telemetry *telemetry, const cli_expression *value, unsigned char *id);
+
+/*
+ * Advance by one tick, running due subscriptions while the ring has room
+ */
+void telemetry_tick(struct cli_telemetry *telemetry);
+
+/*
+ * Output for handler data while run by telemetry_tick, NULL otherwise
+ */
+struct cli_output *telemetry_output(void);
+
+/*
+ * Take up to size bytes from the TX ring (e.g. from the UART TX interrupt),
+ * returns the number taken
+ */
+unsigned short telemetry_read(struct cli_telemetry *telemetry, unsigned char *data, unsigned short size);
@@ -1,15 +1,31 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "serial_cli.h"
+#include "serial_cli_stream.h"
+#include "serial_cli_frame.h"
+#include "serial_cli_output.h"
+#include "serial_cli_queue.h"
+#include "serial_cli_scheduler.h"
+#include "serial_cli_instrument.h"
+#include "serial_cli_telemetry.h"
+#include "serial_cli_short.h"
+#include "serial_cli_macro.h"
+#include "serial_cli_batch.h"
+#include "serial_cli_image.h"
+#include "serial_cli_request.h"
 
 #ifndef NULL
 #define NULL ((void *) 0)
 #endif
 
-static enum cli_command_result test_handler(const cli_expression *command, const struct cli_command_definition *def);
+enum cli_command_result test_handler(const cli_expression *command, const struct cli_arguments *arguments, const struct cli_command_definition *def);
 
 static const struct cli_language_definition lang1;
 
+/* Same language, compiled from test_language.cli by tools/cli_gen */
+extern const struct cli_language_definition test_language;
+
 #define KWIDX(name) CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(kw_##name)
 
 enum keywords
@@ -66,18 +82,22 @@ static const struct cli_language_definition lang1 =
         {
             .syntax = { KWIDX(get), KWIDX(potato), KWIDX(count) },
             .handler = test_handler,
+            .flags = CLI_COMMAND_READ_ONLY,
         },
         {
             .syntax = { KWIDX(get), KWIDX(potato), KWIDX(mass) },
             .handler = test_handler,
+            .flags = CLI_COMMAND_READ_ONLY,
         },
         {
             .syntax = { KWIDX(get), KWIDX(lemon), KWIDX(count) },
             .handler = test_handler,
+            .flags = CLI_COMMAND_READ_ONLY,
         },
         {
             .syntax = { KWIDX(get), KWIDX(lemon), KWIDX(mass) },
             .handler = test_handler,
+            .flags = CLI_COMMAND_READ_ONLY,
         },
         {
             .syntax = { KWIDX(set), KWIDX(potato), KWIDX(count), KWIDX(to), CLI_SPEC_NUMBER },
@@ -110,11 +130,1553 @@ static int test_case = 0;
         } \
     } while (0)
 
+/* Parse a command with two languages and check that the bytecode is identical */
+static int compare_parse(const struct cli_language_definition *expect, const struct cli_language_definition *actual, const char *command)
+{
+    cli_expression expect_bytecode;
+    cli_expression actual_bytecode;
+    enum parse_long_command_result expect_result = parse_long_command(expect, command, NULL, &expect_bytecode);
+    enum parse_long_command_result actual_result = parse_long_command(actual, command, NULL, &actual_bytecode);
+    if (expect_result != actual_result) {
+        return 0;
+    }
+    for (int i = 0; expect_result == parse_long_command_success && i < CLI_MAX_TOKENS; ++i) {
+        if (expect_bytecode[i] != actual_bytecode[i]) {
+            return 0;
+        }
+        if (CLI_EXPR_IS_TERMINAL(expect_bytecode[i])) {
+            break;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Whether the children of each index node are consecutive, after their
+ * parent, and sorted (fillers of a directly indexed root aside)
+ */
+static int keyword_index_ordered(const struct cli_keyword_index *index)
+{
+    const struct cli_keyword_index_node *nodes = index->nodes;
+    for (unsigned short i = 0; i < index->count; ++i) {
+        const struct cli_keyword_index_node *first = nodes + nodes[i].child;
+        if (nodes[i].children && (nodes[i].child <= i || nodes[i].child + nodes[i].children > index->count)) {
+            return 0;
+        }
+        for (unsigned short child = 1; child < nodes[i].children; ++child) {
+            if (first[child].ch && (unsigned char) first[child].ch <= (unsigned char) first[child - 1].ch) {
+                return 0;
+            }
+            if (first[child].ch && i && !first[child - 1].ch) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int test_keyword_index(void)
+{
+    struct cli_keyword_index_node nodes[CLI_KEYWORD_INDEX_NODES(64)];
+    struct cli_keyword_index index;
+    struct cli_language_definition lang = lang1;
+    lang.keyword_index = &index;
+
+    ASSERT(build_keyword_index_too_many_nodes, build_keyword_index(lang1.keywords, nodes, 8, &index));
+    ASSERT(build_keyword_index_success, build_keyword_index(lang1.keywords, nodes, sizeof(nodes) / sizeof(nodes[0]), &index));
+
+    ASSERT(1, keyword_index_ordered(&index));
+
+    for (const cli_keyword *keyword = lang1.keywords; *keyword; ++keyword) {
+        ASSERT(1, compare_parse(&lang1, &lang, *keyword));
+    }
+    ASSERT(1, compare_parse(&lang1, &lang, "ge"));
+    ASSERT(1, compare_parse(&lang1, &lang, "gets"));
+    ASSERT(1, compare_parse(&lang1, &lang, "potatoes"));
+    ASSERT(1, compare_parse(&lang1, &lang, "set lemon count to -42"));
+    ASSERT(1, compare_parse(&lang1, &lang, "42"));
+
+    const struct cli_command_definition *def;
+    cli_expression bytecode;
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get lemon mass", NULL, &bytecode));
+    ASSERT(match_command_success, match_command(&lang, &bytecode, &def));
+    ASSERT(cmd_get_lemon_mass, def - lang1.commands);
+
+    /* Prefixes of other keywords, duplicates (the first definition wins), and a directly indexed root */
+    static const char *words[] = { "t", "to", "top", "tops", "toe", "tox", "s", "u", "v", "vt", "w", "r", "" };
+    struct cli_language_definition prefixes = { .keywords = (const cli_keyword[]) { "top", "to", "toe", "top", "tops", "t", "toe", "s", "v", NULL } };
+    struct cli_language_definition indexed = prefixes;
+    indexed.keyword_index = &index;
+    ASSERT(build_keyword_index_success, build_keyword_index(prefixes.keywords, nodes, sizeof(nodes) / sizeof(nodes[0]), &index));
+    ASSERT(4, nodes[0].children);
+    ASSERT(1, keyword_index_ordered(&index));
+    for (unsigned long i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+        ASSERT(1, compare_parse(&prefixes, &indexed, words[i]));
+    }
+
+    /* Without room for the filler, the root is searched */
+    ASSERT(build_keyword_index_success, build_keyword_index(prefixes.keywords, nodes, index.count - 1, &index));
+    ASSERT(3, nodes[0].children);
+    ASSERT(1, keyword_index_ordered(&index));
+    for (unsigned long i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+        ASSERT(1, compare_parse(&prefixes, &indexed, words[i]));
+    }
+    return 0;
+}
+
+static int test_command_tree(void)
+{
+    static const char *commands[] = {
+        "",
+        "true",
+        "false",
+        "get potato count",
+        "get potato mass",
+        "get lemon mass",
+        "get lemon",
+        "set potato count to 42",
+        "set lemon count to -42",
+        "set lemon count to",
+        "set lemon count to 1 2",
+        "bake potato",
+        "bake lemon",
+        "potato",
+        "42",
+        NULL
+    };
+    struct cli_command_tree_node nodes[CLI_COMMAND_TREE_NODES(CLI_MAX_COMMANDS)];
+    struct cli_command_tree tree;
+    struct cli_language_definition lang = lang1;
+    lang.command_tree = &tree;
+
+    ASSERT(build_command_tree_too_many_nodes, build_command_tree(lang1.commands, nodes, 4, &tree));
+    ASSERT(build_command_tree_success, build_command_tree(lang1.commands, nodes, sizeof(nodes) / sizeof(nodes[0]), &tree));
+
+    for (const char **command = commands; *command; ++command) {
+        const struct cli_command_definition *expect_def;
+        const struct cli_command_definition *actual_def;
+        cli_expression bytecode;
+        ASSERT(parse_long_command_success, parse_long_command(&lang1, *command, NULL, &bytecode));
+        ASSERT(match_command(&lang1, &bytecode, &expect_def), match_command(&lang, &bytecode, &actual_def));
+        ASSERT(expect_def, actual_def);
+    }
+    return 0;
+}
+
+/* Feed a line through the stream parser and compare against parse_long_command */
+static int compare_stream(struct cli_stream_parser *parser, const cli_expression *output, const char *command)
+{
+    static const enum stream_parser_result expect_results[] = {
+        [parse_long_command_success] = stream_parser_success,
+        [parse_long_command_too_many_tokens] = stream_parser_too_many_tokens,
+        [parse_long_command_invalid_token] = stream_parser_invalid_token,
+    };
+    cli_expression bytecode;
+    enum parse_long_command_result expect = parse_long_command(parser->language, command, NULL, &bytecode);
+    const char *next;
+    const char *end = command;
+    while (*end) {
+        ++end;
+    }
+    if (stream_parser_feed_chunk(parser, command, end, &next) != stream_parser_pending || next != end) {
+        return 0;
+    }
+    if (stream_parser_feed(parser, CLI_STREAM_LINE_BREAK) != expect_results[expect]) {
+        return 0;
+    }
+    for (int i = 0; expect == parse_long_command_success && i < CLI_MAX_TOKENS; ++i) {
+        if (bytecode[i] != (*output)[i]) {
+            return 0;
+        }
+        if (CLI_EXPR_IS_TERMINAL(bytecode[i])) {
+            break;
+        }
+    }
+    return 1;
+}
+
+static int test_stream_parser(void)
+{
+    static const char *commands[] = {
+        "",
+        "   ",
+        "true",
+        "  get  potato   mass ",
+        "set potato count to 42",
+        "set lemon count to -42",
+        "set potato count to -1001",
+        "set potato count to 1001",
+        "set potato count to -",
+        "set potato count to 4-2",
+        "bake set true potato count to false lemon count",
+        "bake set true potato count to false lemon",
+        "invalid",
+        "ge",
+        "gets",
+        "truepotato",
+        "t",
+        "set potato count to 0x2a",
+        "set potato count to -0X3E7",
+        "set potato count to 0x",
+        "set potato count to 00x1",
+        "set potato count to 0xg",
+        "set potato count to 0x3e9",
+        "set potato count to 0x3e8",
+        "set potato count to -0x3e8",
+        "set potato count to 0xffffffff",
+        "set potato count to 0xfffffc18",
+        "set potato count to 0x100000000",
+        NULL
+    };
+    struct cli_keyword_index_node nodes[CLI_KEYWORD_INDEX_NODES(64)];
+    struct cli_keyword_index index;
+    struct cli_language_definition lang = lang1;
+    struct cli_stream_parser parser;
+    cli_expression output;
+
+    stream_parser_init(&parser, &lang1, &output);
+    for (const char **command = commands; *command; ++command) {
+        ASSERT(1, compare_stream(&parser, &output, *command));
+    }
+
+    ASSERT(build_keyword_index_success, build_keyword_index(lang1.keywords, nodes, sizeof(nodes) / sizeof(nodes[0]), &index));
+    lang.keyword_index = &index;
+    stream_parser_init(&parser, &lang, &output);
+    for (const char **command = commands; *command; ++command) {
+        ASSERT(1, compare_stream(&parser, &output, *command));
+    }
+
+    /* Control characters are rejected before they reach the keyword list or index */
+    static const char control[] = "to\0xy\ntr\0ue\nt\x01rue\ntrue\n";
+    const char *next;
+    const struct cli_command_definition *def;
+    for (int i = 0; i < 2; ++i) {
+        stream_parser_init(&parser, i ? &lang : &lang1, &output);
+        ASSERT(stream_parser_invalid_token, stream_parser_feed_chunk(&parser, control, control + sizeof(control) - 1, &next));
+        ASSERT(stream_parser_invalid_token, stream_parser_feed_chunk(&parser, next, control + sizeof(control) - 1, &next));
+        ASSERT(stream_parser_invalid_token, stream_parser_feed_chunk(&parser, next, control + sizeof(control) - 1, &next));
+        ASSERT(stream_parser_success, stream_parser_feed_chunk(&parser, next, control + sizeof(control) - 1, &next));
+        ASSERT(match_command_success, match_command(&lang1, &output, &def));
+        ASSERT(cmd_true, def - lang1.commands);
+    }
+
+    /* Malformed input is dropped up to the line break */
+    const char *input = "bake invalid potato\r\nbake potato\r\n";
+    ASSERT(stream_parser_invalid_token, stream_parser_feed_chunk(&parser, input, input + 21, &next));
+    ASSERT(stream_parser_success, stream_parser_feed_chunk(&parser, next, input + 34, &next));
+    ASSERT(input + 34, next);
+    ASSERT(match_command_success, match_command(&lang1, &output, &def));
+    ASSERT(cmd_bake_potato, def - lang1.commands);
+    return 0;
+}
+
+static int test_frame(void)
+{
+    cli_expression bytecode;
+    cli_expression decoded;
+    unsigned char frame[CLI_FRAME_MAX_SIZE * 2];
+    unsigned char size;
+    enum cli_command_result result;
+
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set potato count to 42", NULL, &bytecode));
+    ASSERT(encode_frame_overflow, encode_frame(&bytecode, frame, 6, &size));
+    ASSERT(encode_frame_success, encode_frame(&bytecode, frame, sizeof(frame), &size));
+    ASSERT(CLI_FRAME_SIZE(6), size);
+    ASSERT(CLI_FRAME_SIZE(frame[0]), size);
+    ASSERT(receive_frame_success, decode_frame(frame, size, &decoded));
+    ASSERT(1, memcmp(bytecode, decoded, 5 * sizeof(expression_token)) == 0 && CLI_EXPR_IS_TERMINAL(decoded[5]));
+    ASSERT(match_command_success, execute_command(&lang1, &decoded, &result));
+    ASSERT(cli_command_success, result);
+
+    ASSERT(receive_frame_pending, decode_frame(frame, size - 1, &decoded));
+    frame[size - 1] ^= 1;
+    ASSERT(receive_frame_bad_crc, decode_frame(frame, size, &decoded));
+    frame[size - 1] ^= 1;
+
+    /* Byte stream: bad length byte, then two frames back to back */
+    struct cli_frame_receiver receiver;
+    unsigned char second;
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "false", NULL, &bytecode));
+    ASSERT(encode_frame_success, encode_frame(&bytecode, frame + size, sizeof(frame) - size, &second));
+    frame_receiver_init(&receiver, &decoded);
+    ASSERT(receive_frame_bad_length, receive_frame(&receiver, 0xff));
+    for (unsigned char i = 0; i < size - 1; ++i) {
+        ASSERT(receive_frame_pending, receive_frame(&receiver, frame[i]));
+    }
+    ASSERT(receive_frame_success, receive_frame(&receiver, frame[size - 1]));
+    ASSERT(match_command_success, execute_command(&lang1, &decoded, &result));
+    ASSERT(cli_command_success, result);
+    ASSERT(receive_frame_success, decode_frame(frame + size, second, &decoded));
+    ASSERT(match_command_success, execute_command(&lang1, &decoded, &result));
+    ASSERT(cli_command_fail, result);
+
+    /* Reserved byte in payload */
+    frame[0] = 1;
+    frame[1] = 0xc0;
+    frame[2] = cli_crc8(cli_crc8(0, frame[0]), frame[1]);
+    ASSERT(receive_frame_invalid_token, decode_frame(frame, 3, &decoded));
+    return 0;
+}
+
+static int test_generated_language(void)
+{
+    static const char *commands[] = {
+        "",
+        "true",
+        "false",
+        "get potato count",
+        "get potato mass",
+        "get lemon count",
+        "get lemon mass",
+        "get lemon",
+        "set potato count to 42",
+        "set lemon count to -42",
+        "set lemon count to",
+        "set lemon count to 1 2",
+        "set lemon count to 1001",
+        "bake potato",
+        "bake lemon",
+        "bake set true potato count to false lemon count",
+        "potatoes",
+        "tru",
+        "42",
+        NULL
+    };
+    struct cli_stream_parser parser;
+    cli_expression output;
+    stream_parser_init(&parser, &test_language, &output);
+
+    for (const char **command = commands; *command; ++command) {
+        const struct cli_command_definition *expect_def;
+        const struct cli_command_definition *actual_def;
+        cli_expression bytecode;
+        ASSERT(1, compare_parse(&lang1, &test_language, *command));
+        ASSERT(1, compare_stream(&parser, &output, *command));
+        if (parse_long_command(&lang1, *command, NULL, &bytecode) == parse_long_command_success) {
+            ASSERT(match_command(&lang1, &bytecode, &expect_def), match_command(&test_language, &bytecode, &actual_def));
+            ASSERT(expect_def ? expect_def - lang1.commands : -1, actual_def ? actual_def - test_language.commands : -1);
+            ASSERT(expect_def ? expect_def->flags : 0, actual_def ? actual_def->flags : 0);
+        }
+    }
+    return 0;
+}
+
+static int test_next_tokens(void)
+{
+    static const char *prefixes[] = {
+        "",
+        "get",
+        "get potato",
+        "get potato count",
+        "set lemon count to",
+        "set lemon count to 5",
+        "bake",
+        "lemon",
+        "42",
+        NULL
+    };
+    struct cli_command_tree_node nodes[CLI_COMMAND_TREE_NODES(CLI_MAX_COMMANDS)];
+    struct cli_command_tree tree;
+    struct cli_language_definition lang = lang1;
+    struct cli_next_tokens expect;
+    struct cli_next_tokens actual;
+    cli_expression bytecode;
+    int length;
+    lang.command_tree = &tree;
+    ASSERT(build_command_tree_success, build_command_tree(lang1.commands, nodes, sizeof(nodes) / sizeof(nodes[0]), &tree));
+
+    for (const char **prefix = prefixes; *prefix; ++prefix) {
+        ASSERT(parse_long_command_success, parse_long_command(&lang1, *prefix, NULL, &bytecode));
+        for (length = 0; length < CLI_MAX_TOKENS && !CLI_EXPR_IS_TERMINAL(bytecode[length]); ++length) {
+        }
+        ASSERT(next_tokens(&lang1, &bytecode, length, &expect), next_tokens(&lang, &bytecode, length, &actual));
+        ASSERT(0, memcmp(&expect, &actual, sizeof(expect)));
+    }
+
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get", NULL, &bytecode));
+    ASSERT(cli_next_keyword, next_tokens(&lang, &bytecode, 1, &actual));
+    ASSERT(1 << (kw_potato % 8) | 1 << (kw_lemon % 8), actual.keywords[0]);
+    ASSERT(cli_next_invalid, next_tokens(&lang, &bytecode, 0, &actual) & cli_next_number);
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "set lemon count to 5", NULL, &bytecode));
+    ASSERT(cli_next_number, next_tokens(&lang, &bytecode, 4, &actual));
+    ASSERT(cli_next_terminal, next_tokens(&lang, &bytecode, 5, &actual));
+    ASSERT(cli_next_invalid, next_tokens(&lang, &bytecode, 2, &actual) & cli_next_terminal);
+
+    /* Tab completion of "get pot" */
+    const char *partial = "pot";
+    int completion;
+    int common;
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get", NULL, &bytecode));
+    next_tokens(&lang, &bytecode, 1, &actual);
+    ASSERT(1, complete_keyword(&lang, &actual, partial, partial + 3, &completion, &common));
+    ASSERT(kw_potato, completion);
+    ASSERT(6, common);
+    ASSERT(2, complete_keyword(&lang, &actual, partial, partial, &completion, &common));
+    ASSERT(0, common);
+    return 0;
+}
+
+/* Output sink which captures to a string, accepting at most limit bytes per call */
+struct capture
+{
+    char text[512];
+    unsigned short length;
+    unsigned short limit;
+    int calls;
+    /* Start of the last transfer, for sinks which take ownership of it */
+    const char *data;
+};
+
+static unsigned short capture_write(void *context, const char *data, unsigned short size)
+{
+    struct capture *capture = context;
+    ++capture->calls;
+    if (size > capture->limit) {
+        size = capture->limit;
+    }
+    memcpy(capture->text + capture->length, data, size);
+    capture->length += size;
+    capture->text[capture->length] = '\0';
+    return size;
+}
+
+/*
+ * Sink which starts a transfer from the buffer, as a DMA-driven UART would
+ */
+static unsigned short started_write(void *context, const char *data, unsigned short size)
+{
+    struct capture *capture = context;
+    ++capture->calls;
+    capture->data = data;
+    capture->limit = size;
+    return CLI_OUTPUT_STARTED;
+}
+
+static int test_output(void)
+{
+    static const char *expect =
+        PRINTF_LINEBREAK "Commands:" PRINTF_LINEBREAK
+        ">>> true" PRINTF_LINEBREAK
+        ">>> false" PRINTF_LINEBREAK
+        ">>> get potato count" PRINTF_LINEBREAK
+        ">>> get potato mass" PRINTF_LINEBREAK
+        ">>> get lemon count" PRINTF_LINEBREAK
+        ">>> get lemon mass" PRINTF_LINEBREAK
+        ">>> set potato count to #" PRINTF_LINEBREAK
+        ">>> set lemon count to #" PRINTF_LINEBREAK
+        ">>> bake potato" PRINTF_LINEBREAK
+        PRINTF_LINEBREAK;
+    struct capture capture = { .limit = 0xffff };
+    struct cli_output output;
+    char buffer[32];
+    cli_expression bytecode;
+
+    /* Flushed in buffer-sized chunks */
+    output_init(&output, capture_write, &capture, buffer, sizeof(buffer));
+    list_all_commands_to(&lang1, &output);
+    ASSERT(0, output_flush(&output));
+    ASSERT(0, strcmp(expect, capture.text));
+    ASSERT((int) (strlen(expect) + sizeof(buffer) - 1) / (int) sizeof(buffer), capture.calls);
+
+    /* Sink which accepts partial writes loses nothing */
+    capture = (struct capture) { .limit = 5 };
+    output_init(&output, capture_write, &capture, buffer, sizeof(buffer));
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set lemon count to -42", NULL, &bytecode));
+    print_bytecode_to(&lang1, &bytecode, &output);
+    while (output_flush(&output)) {
+    }
+    ASSERT(0, strcmp("Bytecode dump: \"set lemon count to -42\" (f003 f006 f007 f009 e3be)" PRINTF_LINEBREAK, capture.text));
+    ASSERT(0, output.dropped);
+
+    /* Busy sink drops characters once the buffer is full */
+    capture = (struct capture) { .limit = 0 };
+    output_init(&output, capture_write, &capture, buffer, sizeof(buffer));
+    output_int(&output, -2147483647L - 1);
+    output_string(&output, " and the rest of a long message");
+    ASSERT(sizeof(buffer), output.used);
+    ASSERT(11 + 31 - sizeof(buffer), output.dropped);
+    capture.limit = 0xffff;
+    ASSERT(0, output_flush(&output));
+    ASSERT(0, strcmp("-2147483648 and the rest of a lo", capture.text));
+
+    /* Started transfer keeps its data until completion, later output goes behind it */
+    capture = (struct capture) { .limit = 0 };
+    output_init(&output, started_write, &capture, buffer, sizeof(buffer));
+    output_string(&output, "first");
+    ASSERT(5, output_flush(&output));
+    ASSERT(buffer, capture.data);
+    ASSERT(5, capture.limit);
+    output_string(&output, " and the rest of a long message");
+    ASSERT(sizeof(buffer), output.used);
+    ASSERT(5 + 31 - sizeof(buffer), output.dropped);
+    ASSERT(sizeof(buffer), output_flush(&output));
+    ASSERT(1, capture.calls);
+    ASSERT(0, memcmp("first", buffer, 5));
+    output_complete(&output);
+    ASSERT(sizeof(buffer) - 5, output_flush(&output));
+    ASSERT(2, capture.calls);
+    ASSERT(sizeof(buffer) - 5, capture.limit);
+    ASSERT(0, memcmp(" and the rest of a long mes", buffer, sizeof(buffer) - 5));
+    output_complete(&output);
+    ASSERT(0, output_flush(&output));
+    ASSERT(2, capture.calls);
+    return 0;
+}
+
+static int test_wide_numbers(void)
+{
+    struct cli_wide_expression wide;
+    const struct cli_command_definition *def;
+
+    /* Narrow path accepts hexadecimal, but keeps the bytecode range */
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set potato count to 0x2A", NULL, &wide.bytecode));
+    ASSERT(42, CLI_EXPR_NUMBER_TO_INT(wide.bytecode[4]));
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, "set potato count to 0x12345678", NULL, &wide.bytecode));
+    /* Narrow hexadecimal values do not wrap */
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, "set potato count to 0xffffffff", NULL, &wide.bytecode));
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, "set potato count to 0xfffffc18", NULL, &wide.bytecode));
+
+    /* Wide path puts large values in the side array */
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to 0x12345678", NULL, &wide));
+    ASSERT(1, CLI_EXPR_IS_SLOT(wide.bytecode[4]));
+    ASSERT(1, wide.numbers.count);
+    ASSERT(match_command_success, match_command(&lang1, &wide.bytecode, &def));
+    ASSERT(cmd_set_potato_count, def - lang1.commands);
+    ASSERT(0x12345678L, expression_number(&wide.bytecode, 4));
+
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to -42", NULL, &wide));
+    ASSERT(1, CLI_EXPR_IS_NUMBER(wide.bytecode[4]));
+    ASSERT(0, wide.numbers.count);
+    ASSERT(-42, expression_number(&wide.bytecode, 4));
+
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to -2147483648", NULL, &wide));
+    ASSERT(CLI_WIDE_NUMBER_MIN, expression_number(&wide.bytecode, 4));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to 2147483647", NULL, &wide));
+    ASSERT(CLI_WIDE_NUMBER_MAX, expression_number(&wide.bytecode, 4));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to 0xffffffff", NULL, &wide));
+    ASSERT(-1, expression_number(&wide.bytecode, 4));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang1, "set potato count to 1000", NULL, &wide));
+    ASSERT(1000, expression_number(&wide.bytecode, 4));
+    ASSERT(match_command_success, match_command(&lang1, &wide.bytecode, &def));
+
+    ASSERT(parse_long_command_invalid_token, parse_long_command_wide(&lang1, "set potato count to 2147483648", NULL, &wide));
+    ASSERT(parse_long_command_invalid_token, parse_long_command_wide(&lang1, "set potato count to -2147483649", NULL, &wide));
+    ASSERT(parse_long_command_invalid_token, parse_long_command_wide(&lang1, "set potato count to 0x100000000", NULL, &wide));
+    ASSERT(parse_long_command_invalid_token, parse_long_command_wide(&lang1, "set potato count to 12a", NULL, &wide));
+    return 0;
+}
+
+/* Parse a command with explicit end, check the tokens */
+static int check_tokens(const char *command, const char *end, int length, const expression_token *expect)
+{
+    cli_expression bytecode;
+    if (parse_long_command(&lang1, command, end, &bytecode) != parse_long_command_success) {
+        return 0;
+    }
+    for (int i = 0; i < length; ++i) {
+        if (bytecode[i] != expect[i]) {
+            return 0;
+        }
+    }
+    return length == CLI_MAX_TOKENS || CLI_EXPR_IS_TERMINAL(bytecode[length]);
+}
+
+/* Long space runs and words, to cover whole blocks of the SWAR/SSE2 tokenizers */
+static int test_tokenizer(void)
+{
+    static const char spaced[] = "                     get                                 potato        count                         ";
+    static const char nul[] = "true     \0   false                                      ";
+    static const char long_word[] = "potatopotatopotatopotatopotato";
+    const expression_token get_potato_count[] = {
+        CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_get),
+        CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_potato),
+        CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_count),
+    };
+    const expression_token true_only[] = {
+        CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_true),
+    };
+    const expression_token potato[] = {
+        CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_potato),
+    };
+    cli_expression bytecode;
+
+    /* Every end position which does not split a word */
+    for (int end = 0; end <= (int) sizeof(spaced) - 1; ++end) {
+        int length = end <= 21 ? 0 : end >= 24 && end <= 57 ? 1 : end >= 63 && end <= 71 ? 2 : end >= 76 ? 3 : -1;
+        if (length >= 0) {
+            ASSERT(1, check_tokens(spaced, spaced + end, length, get_potato_count));
+        }
+    }
+    ASSERT(1, check_tokens(spaced, NULL, 3, get_potato_count));
+    ASSERT(1, check_tokens(nul, nul + sizeof(nul) - 1, 1, true_only));
+    ASSERT(1, check_tokens(nul, NULL, 1, true_only));
+    ASSERT(1, check_tokens(long_word + 24, long_word + 30, 1, potato));
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, long_word, long_word + 30, &bytecode));
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, long_word, long_word + 7, &bytecode));
+    ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, long_word, long_word + 5, &bytecode));
+    return 0;
+}
+
+static int test_match_cache(void)
+{
+    static const char *commands[] = {
+        "get potato count",
+        "get potato count",
+        "set potato count to 42",
+        "set potato count to -1",
+        "set lemon count to 7",
+        "get lemon",
+        "bake potato",
+        "get potato count",
+        NULL
+    };
+    struct cli_match_cache cache = { 0 };
+    struct cli_language_definition lang = lang1;
+    lang.match_cache = &cache;
+
+    for (const char **command = commands; *command; ++command) {
+        const struct cli_command_definition *expect_def;
+        const struct cli_command_definition *actual_def;
+        cli_expression bytecode;
+        ASSERT(parse_long_command_success, parse_long_command(&lang1, *command, NULL, &bytecode));
+        ASSERT(match_command(&lang1, &bytecode, &expect_def), match_command(&lang, &bytecode, &actual_def));
+        ASSERT(expect_def, actual_def);
+    }
+    /* Repeated shapes hit, whatever the number values (the last may be evicted) */
+    ASSERT(1, cache.hits >= 2 && cache.hits <= 3);
+    ASSERT(8, cache.hits + cache.misses);
+    return 0;
+}
+
+/* Feed a string to a command queue, returns the last non-pending result */
+static enum command_queue_feed_result feed_queue(struct cli_command_queue *queue, const char *input)
+{
+    enum command_queue_feed_result result = command_queue_feed_pending;
+    for (; *input; ++input) {
+        enum command_queue_feed_result feed = command_queue_feed(queue, *input);
+        if (feed != command_queue_feed_pending) {
+            result = feed;
+        }
+    }
+    return result;
+}
+
+static int test_command_queue(void)
+{
+    struct cli_queue_entry entries[3];
+    struct cli_command_queue queue;
+    struct cli_queue_result result;
+    command_queue_init(&queue, &lang1, entries, 3);
+
+    ASSERT(false, command_queue_execute(&queue, &result));
+    ASSERT(command_queue_feed_pending, feed_queue(&queue, "\r\n\n"));
+    ASSERT(command_queue_feed_pending, feed_queue(&queue, "tr"));
+    ASSERT(command_queue_feed_queued, feed_queue(&queue, "ue\r\n"));
+    ASSERT(command_queue_feed_queued, feed_queue(&queue, "potatoes\n"));
+    /* Full: parsing continues into the free entry, which is dropped at the end */
+    ASSERT(command_queue_feed_overflow, feed_queue(&queue, "false\n"));
+    ASSERT(2, command_queue_count(&queue));
+    ASSERT(1, queue.overflows);
+    ASSERT(2, queue.high_water);
+
+    ASSERT(true, command_queue_execute(&queue, &result));
+    ASSERT(stream_parser_success, result.parse);
+    ASSERT(match_command_success, result.match);
+    ASSERT(cli_command_success, result.command);
+    /* A line arriving while the consumer is busy */
+    ASSERT(command_queue_feed_queued, feed_queue(&queue, "false\n"));
+    ASSERT(true, command_queue_execute(&queue, &result));
+    ASSERT(stream_parser_invalid_token, result.parse);
+    ASSERT(true, command_queue_execute(&queue, &result));
+    ASSERT(match_command_success, result.match);
+    ASSERT(cli_command_fail, result.command);
+    ASSERT(false, command_queue_execute(&queue, &result));
+
+    /* Wrap around several times with the consumer keeping up */
+    for (int i = 0; i < 10; ++i) {
+        ASSERT(command_queue_feed_queued, feed_queue(&queue, i & 1 ? "get lemon\n" : "get lemon count\n"));
+        const struct cli_queue_entry *entry = command_queue_peek(&queue);
+        ASSERT(1, entry != NULL);
+        ASSERT(CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_lemon), entry->bytecode[1]);
+        ASSERT(true, command_queue_execute(&queue, &result));
+        ASSERT(i & 1 ? match_command_fail : match_command_success, result.match);
+    }
+    ASSERT(0, command_queue_count(&queue));
+    ASSERT(1, queue.overflows);
+    return 0;
+}
+
+/* Completes after the given number of resumes, failing if that was negative */
+static CLI_COMMAND_HANDLER(slow_handler, bytecode, arguments, def)
+{
+    (void) def;
+    struct cli_task *task = CLI_TASK(bytecode);
+    CLI_TASK_BEGIN(task);
+    task->context[0] = arguments->value[0];
+    task->context[1] = task->context[0] < 0 ? -task->context[0] : task->context[0];
+    while (task->context[1]) {
+        --task->context[1];
+        CLI_TASK_YIELD(task);
+    }
+    CLI_TASK_END(task);
+    return task->context[0] < 0 ? cli_command_fail : cli_command_success;
+}
+
+struct completion_log
+{
+    int count;
+    unsigned char id[4];
+    enum cli_command_result result[4];
+};
+
+static void log_completion(void *context, unsigned char id, enum cli_command_result result)
+{
+    struct completion_log *log = context;
+    log->id[log->count] = id;
+    log->result[log->count] = result;
+    ++log->count;
+}
+
+static int test_scheduler(void)
+{
+    const struct cli_language_definition lang = {
+        .keywords = lang1.keywords,
+        .commands = (const struct cli_command_definition[]) {
+            {
+                .syntax = { KWIDX(set), KWIDX(potato), KWIDX(count), KWIDX(to), CLI_SPEC_NUMBER },
+                .handler = slow_handler,
+            },
+            {
+                .handler = NULL,
+            },
+        },
+    };
+    struct cli_task tasks[2];
+    struct cli_scheduler scheduler;
+    struct completion_log log = { 0 };
+    struct cli_wide_expression bytecode;
+    enum cli_command_result result;
+    unsigned char first;
+    unsigned char second;
+    unsigned char third;
+    scheduler_init(&scheduler, &lang, tasks, 2, log_completion, &log);
+
+    /* Immediate completion */
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "set potato count to 0", NULL, &bytecode.bytecode));
+    ASSERT(scheduler_submit_done, scheduler_submit(&scheduler, &bytecode.bytecode, &first, &result));
+    ASSERT(cli_command_success, result);
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get potato count", NULL, &bytecode.bytecode));
+    ASSERT(scheduler_submit_no_match, scheduler_submit(&scheduler, &bytecode.bytecode, &first, &result));
+
+    /* Two overlapping commands, the second finishes first */
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "set potato count to -3", NULL, &bytecode.bytecode));
+    ASSERT(scheduler_submit_pending, scheduler_submit(&scheduler, &bytecode.bytecode, &first, &result));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "set potato count to 0x10001", NULL, &bytecode));
+    ASSERT(scheduler_submit_pending, scheduler_submit(&scheduler, &bytecode.bytecode, &second, &result));
+    ASSERT(1, first != second);
+    ASSERT(scheduler_submit_busy, scheduler_submit(&scheduler, &bytecode.bytecode, &third, &result));
+    /* Bytecode was copied */
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "set potato count to 0", NULL, &bytecode.bytecode));
+
+    ASSERT(2, scheduler_run(&scheduler));
+    ASSERT(2, scheduler_run(&scheduler));
+    ASSERT(1, scheduler_run(&scheduler));
+    ASSERT(1, log.count);
+    ASSERT(first, log.id[0]);
+    ASSERT(cli_command_fail, log.result[0]);
+
+    /* The freed task takes new commands while the wide one is still running */
+    ASSERT(scheduler_submit_done, scheduler_submit(&scheduler, &bytecode.bytecode, &third, &result));
+    ASSERT(cli_command_success, result);
+    ASSERT(true, scheduler_cancel(&scheduler, second));
+    ASSERT(false, scheduler_cancel(&scheduler, second));
+    ASSERT(0, scheduler_run(&scheduler));
+    ASSERT(1, log.count);
+    return 0;
+}
+
+#ifdef CLI_INSTRUMENT
+/* Advances by one on every reading, so each recorded duration is one tick */
+static unsigned long fake_clock;
+
+unsigned long cli_instrument_clock(void)
+{
+    return fake_clock++;
+}
+
+static int test_instrument(void)
+{
+    static const char *commands[] = {
+        "true",
+        "false",
+        "set potato count to 42",
+        "get lemon",
+        "potatoes",
+        "true",
+        NULL
+    };
+    static const char *expect =
+        "parse n=6 min=1 max=1 mean=1 ok=5 tokens=0 invalid=1" PRINTF_LINEBREAK
+        "match n=5 min=1 max=1 mean=1 ok=4 fail=1 invalid=0" PRINTF_LINEBREAK
+        "true: n=2 min=1 max=1 mean=1 fail=0" PRINTF_LINEBREAK
+        "false: n=1 min=1 max=1 mean=1 fail=1" PRINTF_LINEBREAK
+        "set potato count to #: n=1 min=1 max=1 mean=1 fail=0" PRINTF_LINEBREAK;
+    const struct cli_language_definition stats_lang = {
+        .keywords = (const cli_keyword[]) { "stats", "reset", NULL },
+        .commands = (const struct cli_command_definition[]) {
+            CLI_STATS_COMMANDS(0, 1)
+            {
+                .handler = NULL,
+            },
+        },
+    };
+    struct cli_command_stats slots[9] = { 0 };
+    struct cli_instrument instrument = { .commands = slots };
+    struct cli_language_definition lang = lang1;
+    struct capture capture = { .limit = 0xffff };
+    struct cli_output output;
+    char buffer[32];
+    cli_expression bytecode;
+    enum cli_command_result result;
+    lang.instrument = &instrument;
+
+    for (const char **command = commands; *command; ++command) {
+        if (parse_long_command(&lang, *command, NULL, &bytecode) == parse_long_command_success) {
+            execute_command(&lang, &bytecode, &result);
+        }
+    }
+    ASSERT(6, instrument.parse.count);
+    ASSERT(1, instrument.match_results[match_command_fail]);
+    ASSERT(2, slots[cmd_true].handler.count);
+    ASSERT(0, slots[cmd_bake_potato].handler.count);
+
+    /* Dump and reset via the stats commands */
+    output_init(&output, capture_write, &capture, buffer, sizeof(buffer));
+    instrument_attach(&lang, &output);
+    ASSERT(parse_long_command_success, parse_long_command(&stats_lang, "stats", NULL, &bytecode));
+    ASSERT(match_command_success, execute_command(&stats_lang, &bytecode, &result));
+    ASSERT(cli_command_success, result);
+    output_flush(&output);
+    ASSERT(0, strcmp(expect, capture.text));
+    ASSERT(parse_long_command_success, parse_long_command(&stats_lang, "stats reset", NULL, &bytecode));
+    ASSERT(match_command_success, execute_command(&stats_lang, &bytecode, &result));
+    ASSERT(0, instrument.parse.count);
+    ASSERT(0, instrument.match_results[match_command_fail]);
+    ASSERT(0, slots[cmd_true].handler.count);
+    ASSERT(0, slots[cmd_false].failures);
+
+    /* Handlers run by a scheduler or by telemetry are counted as well */
+    struct cli_task tasks[1];
+    struct cli_scheduler scheduler;
+    struct cli_subscription subscriptions[1];
+    struct cli_telemetry telemetry;
+    unsigned char ring[64];
+    unsigned char id;
+    scheduler_init(&scheduler, &lang, tasks, 1, NULL, NULL);
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "true", NULL, &bytecode));
+    ASSERT(scheduler_submit_done, scheduler_submit(&scheduler, &bytecode, &id, &result));
+    ASSERT(1, slots[cmd_true].handler.count);
+    telemetry_init(&telemetry, &lang, subscriptions, 1, ring, sizeof(ring));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get potato count", NULL, &bytecode));
+    ASSERT(telemetry_command_subscribed, telemetry_subscribe(&telemetry, &bytecode, 1, &id));
+    telemetry_tick(&telemetry);
+    ASSERT(1, slots[cmd_get_potato_count].handler.count);
+    /* Keyword lookups of telemetry_init are not parses */
+    ASSERT(2, instrument.parse.count);
+    ASSERT(0, instrument.parse_results[parse_long_command_invalid_token]);
+    instrument_attach(NULL, NULL);
+    return 0;
+}
+#endif
+
+static int potato_count = 0x1234;
+
+/* Writes the potato count, big-endian */
+static CLI_COMMAND_HANDLER(potato_count_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    struct cli_output *output = telemetry_output();
+    if (!output) {
+        return cli_command_fail;
+    }
+    output_char(output, potato_count >> 8);
+    output_char(output, potato_count & 0xff);
+    return cli_command_success;
+}
+
+/* Writes more than fits in a telemetry frame */
+static CLI_COMMAND_HANDLER(potato_dump_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) def;
+    for (long i = 0; i < arguments->value[0]; ++i) {
+        output_char(telemetry_output(), i);
+    }
+    return cli_command_success;
+}
+
+static int test_telemetry(void)
+{
+    enum {
+        tkw_get,
+        tkw_set,
+        tkw_potato,
+        tkw_count,
+        tkw_subscribe,
+        tkw_every,
+        tkw_unsubscribe,
+    };
+    const struct cli_language_definition lang = {
+        .keywords = (const cli_keyword[]) { "get", "set", "potato", "count", "subscribe", "every", "unsubscribe", NULL },
+        .commands = (const struct cli_command_definition[]) {
+            {
+                .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_get), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_potato), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_count) },
+                .handler = potato_count_handler,
+                .flags = CLI_COMMAND_READ_ONLY,
+            },
+            {
+                .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_get), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_potato), CLI_SPEC_NUMBER },
+                .handler = potato_dump_handler,
+                .flags = CLI_COMMAND_READ_ONLY,
+            },
+            {
+                .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_set), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_potato), CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(tkw_count), CLI_SPEC_NUMBER },
+                .handler = potato_count_handler,
+            },
+            {
+                .handler = NULL,
+            },
+        },
+    };
+    /* Room for a worst case frame only while no 7-byte frame is waiting */
+    unsigned char ring[CLI_TELEMETRY_MAX_FRAME_SIZE + 7];
+    struct cli_subscription subscriptions[2];
+    struct cli_telemetry telemetry;
+    cli_expression bytecode;
+    unsigned char id;
+    unsigned char id2;
+    unsigned char frame[CLI_TELEMETRY_MAX_FRAME_SIZE];
+    telemetry_init(&telemetry, &lang, subscriptions, 2, ring, sizeof(ring));
+
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "get potato count", NULL, &bytecode));
+    ASSERT(telemetry_command_none, telemetry_command(&telemetry, &bytecode, &id));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "subscribe set potato count 1 every 2", NULL, &bytecode));
+    ASSERT(telemetry_command_not_read_only, telemetry_command(&telemetry, &bytecode, &id));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "subscribe get potato every 2", NULL, &bytecode));
+    ASSERT(telemetry_command_no_match, telemetry_command(&telemetry, &bytecode, &id));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "subscribe get potato count every 0", NULL, &bytecode));
+    ASSERT(telemetry_command_invalid_period, telemetry_command(&telemetry, &bytecode, &id));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "subscribe get potato count every 2", NULL, &bytecode));
+    ASSERT(telemetry_command_subscribed, telemetry_command(&telemetry, &bytecode, &id));
+
+    /* One frame every two ticks */
+    telemetry_tick(&telemetry);
+    ASSERT(0, telemetry_read(&telemetry, frame, sizeof(frame)));
+    telemetry_tick(&telemetry);
+    ASSERT(7, telemetry_read(&telemetry, frame, sizeof(frame)));
+    ASSERT(5, frame[0]);
+    ASSERT(CLI_FRAME_TELEMETRY, frame[1]);
+    ASSERT(id, frame[2]);
+    ASSERT(1, frame[3]);
+    ASSERT(0x12, frame[4]);
+    ASSERT(0x34, frame[5]);
+    unsigned char crc = 0;
+    for (int i = 0; i < 6; ++i) {
+        crc = cli_crc8(crc, frame[i]);
+    }
+    ASSERT(crc, frame[6]);
+
+    /* Saturated link: samples are merged, and the latest value is sent once there is room */
+    telemetry_tick(&telemetry);
+    telemetry_tick(&telemetry);
+    ASSERT(1, telemetry.coalesced == 0 && telemetry.frames == 2);
+    for (int i = 0; i < 6; ++i) {
+        telemetry_tick(&telemetry);
+    }
+    ASSERT(2, telemetry.frames);
+    ASSERT(2, telemetry.coalesced);
+    potato_count = 0x0102;
+    ASSERT(7, telemetry_read(&telemetry, frame, 7));
+    ASSERT(2, frame[3]);
+    telemetry_tick(&telemetry);
+    ASSERT(3, telemetry.frames);
+    ASSERT(7, telemetry_read(&telemetry, frame, sizeof(frame)));
+    ASSERT(5, frame[3]);
+    ASSERT(0x01, frame[4]);
+    ASSERT(0x02, frame[5]);
+    ASSERT(0, telemetry_read(&telemetry, frame, sizeof(frame)));
+
+    /* Oversized output is dropped, the slot is released by unsubscribe */
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "subscribe get potato 100 every 1", NULL, &bytecode));
+    ASSERT(telemetry_command_subscribed, telemetry_command(&telemetry, &bytecode, &id2));
+    ASSERT(telemetry_command_full, telemetry_command(&telemetry, &bytecode, &id2));
+    telemetry_tick(&telemetry);
+    ASSERT(1, telemetry.errors);
+    ASSERT(7, telemetry_read(&telemetry, frame, sizeof(frame)));
+    ASSERT(id, frame[2]);
+    ASSERT(telemetry_command_unsubscribed, telemetry_unsubscribe(&telemetry, id2));
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "unsubscribe 0", NULL, &bytecode));
+    ASSERT(telemetry_command_unsubscribed, telemetry_command(&telemetry, &bytecode, &id));
+    ASSERT(telemetry_command_no_match, telemetry_command(&telemetry, &bytecode, &id));
+    telemetry_tick(&telemetry);
+    telemetry_tick(&telemetry);
+    ASSERT(0, telemetry_read(&telemetry, frame, sizeof(frame)));
+    ASSERT(NULL, telemetry_output());
+    return 0;
+}
+
+static int test_short_format(void)
+{
+    static const char *commands[] = {
+        "true",
+        "get lemon mass",
+        "set potato count to 42",
+        "set lemon count to -1000",
+        "set lemon count to 999",
+        "bake potato",
+        NULL
+    };
+    unsigned char data[CLI_SHORT_MAX_SIZE];
+    unsigned char size;
+    cli_expression bytecode;
+    cli_expression output;
+    struct cli_short_receiver receiver;
+    struct cli_stream_parser parser;
+    cli_expression text_output;
+
+    /* Round trip, through the same match and handlers */
+    for (const char **command = commands; *command; ++command) {
+        const struct cli_command_definition *def;
+        ASSERT(parse_long_command_success, parse_long_command(&lang1, *command, NULL, &bytecode));
+        ASSERT(encode_short_command_success, encode_short_command(&lang1, &bytecode, data, sizeof(data), &size));
+        ASSERT(receive_short_success, decode_short_command(&lang1, data, size, &output));
+        for (int i = 0; i < CLI_MAX_TOKENS; ++i) {
+            ASSERT(bytecode[i], output[i]);
+            if (CLI_EXPR_IS_TERMINAL(bytecode[i])) {
+                break;
+            }
+        }
+        ASSERT(match_command_success, match_command(&lang1, &output, &def));
+        ASSERT(CLI_SHORT_OPCODE(def - lang1.commands), data[0]);
+    }
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set potato count to 42", NULL, &bytecode));
+    ASSERT(encode_short_command_success, encode_short_command(&lang1, &bytecode, data, sizeof(data), &size));
+    ASSERT(3, size);
+    ASSERT(CLI_SHORT_OPCODE(cmd_set_potato_count), data[0]);
+    ASSERT(encode_short_command_overflow, encode_short_command(&lang1, &bytecode, data, 2, &size));
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "get lemon", NULL, &bytecode));
+    ASSERT(encode_short_command_no_match, encode_short_command(&lang1, &bytecode, data, sizeof(data), &size));
+
+    /* Invalid input */
+    data[0] = CLI_SHORT_OPCODE(cmd_bake_potato + 1);
+    ASSERT(receive_short_invalid_opcode, decode_short_command(&lang1, data, 1, &output));
+    data[0] = CLI_SHORT_OPCODE(cmd_set_lemon_count);
+    data[1] = CLI_RANGE_NUMBER >> 8;
+    data[2] = CLI_RANGE_NUMBER & 0xff;
+    ASSERT(receive_short_invalid_number, decode_short_command(&lang1, data, 3, &output));
+    ASSERT(receive_short_pending, decode_short_command(&lang1, data, 2, &output));
+    data[0] = CLI_SHORT_OPCODE(cmd_true);
+    ASSERT(receive_short_bad_length, decode_short_command(&lang1, data, 2, &output));
+
+    /* Mixed with text on one link */
+    static const unsigned char link[] = {
+        'b', 'a', 'k', 'e', CLI_SHORT_OPCODE(cmd_false), ' ', 'p', 'o', 't', 'a', 't', 'o', '\n',
+        CLI_SHORT_OPCODE(cmd_set_potato_count), 0x04, 0x12,
+    };
+    int text = 0;
+    int binary = 0;
+    short_receiver_init(&receiver, &lang1, &output);
+    stream_parser_init(&parser, &lang1, &text_output);
+    for (size_t i = 0; i < sizeof(link); ++i) {
+        enum receive_short_result result = receive_short(&receiver, link[i]);
+        if (result == receive_short_not_short) {
+            if (stream_parser_feed(&parser, link[i]) == stream_parser_success) {
+                ASSERT(CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_bake), text_output[0]);
+                ++text;
+            }
+        } else if (result == receive_short_success) {
+            ++binary;
+        }
+    }
+    ASSERT(1, text);
+    ASSERT(2, binary);
+    ASSERT(42, expression_number(&output, 4));
+    return 0;
+}
+
+/* lang1 keywords in the same order, and grouped by length */
+#define LANG1_KEYWORDS(X) X(true) X(false) X(get) X(set) X(bake) X(potato) X(lemon) X(count) X(mass) X(to)
+#define GROUPED_KEYWORDS(X) X(to) X(get) X(set) X(bake) X(mass) X(true) X(count) X(false) X(lemon) X(potato)
+
+static CLI_KEYWORD_POOL(lang1_pool, LANG1_KEYWORDS, 0);
+static CLI_KEYWORD_POOL(grouped_pool, GROUPED_KEYWORDS, CLI_KEYWORD_POOL_GROUPED);
+
+static int test_keyword_pool(void)
+{
+    static const char *commands[] = {
+        "true",
+        "get potato count",
+        "get lemon mass",
+        "set lemon count to -42",
+        "bake potato",
+        "tru",
+        "trues",
+        "t",
+        "to",
+        "potatoes",
+        "mass count to to",
+        NULL
+    };
+    struct cli_language_definition lang = lang1;
+    struct cli_language_definition grouped = { .keyword_pool = CLI_KEYWORD_POOL_DATA(grouped_pool), .commands = lang1.commands };
+    struct cli_stream_parser parser;
+    cli_expression output;
+    lang.keywords = NULL;
+    lang.keyword_pool = CLI_KEYWORD_POOL_DATA(lang1_pool);
+
+    /* One length byte per keyword, plus flags and end */
+    ASSERT(2 + 10 + 41, (int) sizeof(lang1_pool));
+    ASSERT(sizeof(lang1_pool), sizeof(grouped_pool));
+
+    stream_parser_init(&parser, &lang, &output);
+    for (const char **command = commands; *command; ++command) {
+        ASSERT(1, compare_parse(&lang1, &lang, *command));
+        ASSERT(1, compare_stream(&parser, &output, *command));
+    }
+
+    /* Indices follow pool order (the enum shadows lang1's in this block) */
+    {
+        enum { GROUPED_KEYWORDS(CLI_KEYWORD_POOL_ENUM) grouped_count };
+        ASSERT(parse_long_command_success, parse_long_command(&grouped, "potato to count", NULL, &output));
+        ASSERT(CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_potato), output[0]);
+        ASSERT(CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_to), output[1]);
+        ASSERT(CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_count), output[2]);
+        ASSERT(parse_long_command_invalid_token, parse_long_command(&grouped, "potatoes", NULL, &output));
+        ASSERT(parse_long_command_invalid_token, parse_long_command(&grouped, "t", NULL, &output));
+        ASSERT(10, grouped_count);
+    }
+
+    /* Keyword text */
+    unsigned char length;
+    ASSERT(0, strncmp("lemon", keyword_text(&lang, kw_lemon, &length), 5));
+    ASSERT(5, length);
+    ASSERT(NULL, keyword_text(&lang, 10, &length));
+    ASSERT(0, strncmp("lemon", keyword_text(&lang1, kw_lemon, &length), 5));
+    ASSERT(5, length);
+
+    /* Listing and completion are unchanged */
+    struct capture expect = { .limit = 0xffff };
+    struct capture actual = { .limit = 0xffff };
+    struct cli_output out;
+    char buffer[32];
+    output_init(&out, capture_write, &expect, buffer, sizeof(buffer));
+    list_all_commands_to(&lang1, &out);
+    output_flush(&out);
+    output_init(&out, capture_write, &actual, buffer, sizeof(buffer));
+    list_all_commands_to(&lang, &out);
+    output_flush(&out);
+    ASSERT(0, strcmp(expect.text, actual.text));
+
+    struct cli_next_tokens next;
+    int completion;
+    int common;
+    ASSERT(cli_next_keyword, next_tokens(&lang, &output, 0, &next));
+    static const char partial[] = "fa";
+    ASSERT(5, complete_keyword(&lang, &next, partial, partial, &completion, &common));
+    ASSERT(1, complete_keyword(&lang, &next, partial, partial + 2, &completion, &common));
+    ASSERT(kw_false, completion);
+    ASSERT(5, common);
+    return 0;
+}
+
+/* Sum of the arguments of the last call */
+static long argument_sum;
+
+static CLI_COMMAND_HANDLER(sum_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) def;
+    argument_sum = 0;
+    for (unsigned char i = 0; i < arguments->count; ++i) {
+        argument_sum += arguments->value[i];
+    }
+    return arguments->count ? cli_command_success : cli_command_invalid_argument;
+}
+
+static int test_arguments(void)
+{
+    const struct cli_language_definition lang = {
+        .keywords = lang1.keywords,
+        .commands = (const struct cli_command_definition[]) {
+            {
+                .syntax = { KWIDX(set), CLI_SPEC_NUMBER, KWIDX(to), CLI_SPEC_NUMBER, CLI_SPEC_NUMBER },
+                .handler = sum_handler,
+            },
+            {
+                .syntax = { KWIDX(bake), KWIDX(potato) },
+                .handler = sum_handler,
+            },
+            {
+                .handler = NULL,
+            },
+        },
+    };
+    const struct cli_command_definition *def;
+    struct cli_arguments arguments;
+    struct cli_call call;
+    enum cli_command_result result;
+
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set lemon count to -42", NULL, &call.expression.bytecode));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &call.expression.bytecode, &def, &arguments));
+    ASSERT(1, arguments.count);
+    ASSERT(-42, arguments.value[0]);
+    ASSERT(match_command_success, match_command_arguments(&lang1, &call.expression.bytecode, &def, NULL));
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "bake potato", NULL, &call.expression.bytecode));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &call.expression.bytecode, &def, &arguments));
+    ASSERT(0, arguments.count);
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "get lemon", NULL, &call.expression.bytecode));
+    ASSERT(match_command_fail, match_command_arguments(&lang1, &call.expression.bytecode, &def, &arguments));
+
+    /* Narrow and wide numbers alike, handlers read the view */
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "set 1 to -0x10000 100000", NULL, &call.expression));
+    ASSERT(match_command_success, execute_call(&lang, &call, &result));
+    ASSERT(cli_command_success, result);
+    ASSERT(3, call.arguments.count);
+    ASSERT(-0x10000, call.arguments.value[1]);
+    ASSERT(1 - 0x10000 + 100000, argument_sum);
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "bake potato", NULL, &call.expression));
+    ASSERT(match_command_success, execute_call(&lang, &call, &result));
+    ASSERT(cli_command_invalid_argument, result);
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "set 1 to 2", NULL, &call.expression));
+    ASSERT(match_command_fail, execute_call(&lang, &call, &result));
+
+    /* A bare expression run via execute_command gets the view as well */
+    cli_expression bytecode;
+    ASSERT(parse_long_command_success, parse_long_command(&lang, "set 1 to 2 -3", NULL, &bytecode));
+    ASSERT(match_command_success, execute_command(&lang, &bytecode, &result));
+    ASSERT(cli_command_success, result);
+    ASSERT(0, argument_sum);
+    return 0;
+}
+
+static long macro_total = 0;
+
+/* Adds its argument to the macro total */
+static CLI_COMMAND_HANDLER(macro_add_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) def;
+    macro_total += arguments->value[0];
+    return cli_command_success;
+}
+
+static CLI_COMMAND_HANDLER(macro_fail_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    return cli_command_fail;
+}
+
+/* Parse and pass a command to macro_command */
+static enum macro_command_result macro_text(struct cli_macro_arena *arena, const char *text, enum macro_result *result, struct cli_macro_report *report)
+{
+    struct cli_wide_expression expression;
+    ASSERT(parse_long_command_success, parse_long_command_wide(arena->language, text, NULL, &expression));
+    return macro_command(arena, &expression.bytecode, result, report);
+}
+
+static int test_macros(void)
+{
+    enum {
+        mkw_add,
+        mkw_fail,
+        mkw_macro,
+        mkw_record,
+        mkw_end,
+        mkw_run,
+        mkw_delete,
+    };
+    const struct cli_language_definition lang = {
+        .keywords = (const cli_keyword[]) { "add", "fail", "macro", "record", "end", "run", "delete", NULL },
+        .commands = (const struct cli_command_definition[]) {
+            {
+                .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(mkw_add), CLI_SPEC_NUMBER },
+                .handler = macro_add_handler,
+            },
+            {
+                .syntax = { CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(mkw_fail) },
+                .handler = macro_fail_handler,
+            },
+            {
+                .handler = NULL,
+            },
+        },
+    };
+    unsigned char data[16];
+    struct cli_macro_arena arena;
+    struct cli_macro_report report;
+    enum macro_result result;
+    struct cli_wide_expression expression;
+    macro_init(&arena, &lang, data, sizeof(data));
+
+#define MACRO_COMMAND(text) macro_text(&arena, text, &result, &report)
+
+    ASSERT(macro_command_none, MACRO_COMMAND("add 1"));
+    ASSERT(macro_command_success, MACRO_COMMAND("macro record 1"));
+    ASSERT(macro_command_success, MACRO_COMMAND("add 1"));
+    ASSERT(macro_command_success, MACRO_COMMAND("add -2"));
+    ASSERT(macro_command_fail, MACRO_COMMAND("add"));
+    ASSERT(macro_invalid_command, result);
+    ASSERT(macro_command_fail, MACRO_COMMAND("add 100000"));
+    ASSERT(macro_invalid_command, result);
+    ASSERT(macro_command_fail, MACRO_COMMAND("macro run 1"));
+    ASSERT(macro_bad_state, result);
+    ASSERT(macro_command_success, MACRO_COMMAND("macro end"));
+    ASSERT(8, arena.used);
+    ASSERT(0, macro_total);
+
+    /* Replay */
+    ASSERT(macro_command_success, MACRO_COMMAND("macro run 1"));
+    ASSERT(2, report.executed);
+    ASSERT(-1, macro_total);
+    ASSERT(macro_command_fail, MACRO_COMMAND("macro run 2"));
+    ASSERT(macro_not_found, result);
+    ASSERT(macro_command_fail, MACRO_COMMAND("macro run 256"));
+    ASSERT(macro_invalid_command, result);
+
+    /* Stops at the first failing command */
+    ASSERT(macro_success, macro_record(&arena, 2));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "add 10", NULL, &expression));
+    ASSERT(macro_success, macro_append(&arena, &expression.bytecode));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "fail", NULL, &expression));
+    ASSERT(macro_success, macro_append(&arena, &expression.bytecode));
+    ASSERT(macro_success, macro_save(&arena));
+    ASSERT(macro_stopped, macro_run(&arena, 2, &report));
+    ASSERT(2, report.executed);
+    ASSERT(match_command_success, report.match);
+    ASSERT(cli_command_fail, report.result);
+    ASSERT(9, macro_total);
+    ASSERT(macro_command_success, MACRO_COMMAND("macro delete 2"));
+    ASSERT(8, arena.used);
+    ASSERT(macro_command_fail, MACRO_COMMAND("macro delete 2"));
+    ASSERT(macro_not_found, result);
+
+    /* Re-recording replaces, an abandoned recording leaves the arena as it was */
+    ASSERT(macro_command_success, MACRO_COMMAND("macro record 1"));
+    ASSERT(macro_command_success, MACRO_COMMAND("add 5"));
+    ASSERT(macro_command_success, MACRO_COMMAND("macro end"));
+    ASSERT(5, arena.used);
+    ASSERT(macro_success, macro_record(&arena, 3));
+    macro_cancel(&arena);
+    ASSERT(5, arena.used);
+
+    /* Arena data runs from a copy */
+    unsigned char stored[sizeof(data)];
+    memcpy(stored, data, arena.used);
+    ASSERT(macro_success, macro_run_stored(&lang, stored, arena.used, 1, &report));
+    ASSERT(14, macro_total);
+    ASSERT(macro_corrupt, macro_run_stored(&lang, stored, arena.used - 1, 1, &report));
+
+    /* Full */
+    ASSERT(macro_success, macro_record(&arena, 4));
+    ASSERT(parse_long_command_success, parse_long_command_wide(&lang, "add 1", NULL, &expression));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT(macro_success, macro_append(&arena, &expression.bytecode));
+    }
+    ASSERT(macro_full, macro_append(&arena, &expression.bytecode));
+    ASSERT(macro_success, macro_save(&arena));
+    ASSERT(macro_success, macro_run(&arena, 4, &report));
+    ASSERT(17, macro_total);
+#undef MACRO_COMMAND
+    return 0;
+}
+
+static int test_batch(void)
+{
+    const char script[] = "set potato count to 42\r\n\nget potato\nbake lemons\nbake potato";
+    struct cli_batch_line lines[4];
+    const char *next;
+
+    ASSERT(4, parse_batch(&lang1, script, script + sizeof(script) - 1, lines, 4, &next));
+    ASSERT(parse_long_command_success, lines[0].parse);
+    ASSERT(match_command_success, lines[0].match);
+    ASSERT(cmd_set_potato_count, lines[0].command);
+    ASSERT(42, CLI_EXPR_NUMBER_TO_INT(lines[0].bytecode[4]));
+    ASSERT(parse_long_command_success, lines[1].parse);
+    ASSERT(1, CLI_EXPR_IS_TERMINAL(lines[1].bytecode[0]));
+    ASSERT(match_command_fail, lines[2].match);
+    ASSERT(parse_long_command_invalid_token, lines[3].parse);
+    ASSERT(match_command_fail, lines[3].match);
+    ASSERT(2, batch_errors(lines, 4));
+
+    /* Resumes where the last batch stopped, a final line needs no line break */
+    ASSERT(1, parse_batch(&lang1, next, script + sizeof(script) - 1, lines, 4, &next));
+    ASSERT(cmd_bake_potato, lines[0].command);
+    ASSERT(script + sizeof(script) - 1, next);
+    ASSERT(0, parse_batch(&lang1, next, next, lines, 4, &next));
+    return 0;
+}
+
+static int test_language_image(void)
+{
+    static const char *const commands[] = {
+        "true", "get potato count", "set lemon count to -42", "bake potato", "bake lemon", "get potato", "lemons", "",
+    };
+    static cli_command_handler *const handlers[] = { test_handler };
+    const unsigned char handler_ids[CLI_MAX_COMMANDS] = { 0 };
+    struct cli_keyword_index_node keyword_nodes[CLI_KEYWORD_INDEX_NODES(64)];
+    struct cli_command_tree_node command_nodes[CLI_COMMAND_TREE_NODES(16)];
+    struct cli_keyword_index keyword_index;
+    struct cli_command_tree command_tree;
+    struct cli_language_definition indexed = lang1;
+    /* Image storage must be 16-bit aligned for the indices to be used in place */
+    unsigned short storage[512];
+    unsigned char *data = (unsigned char *) storage;
+    unsigned long size;
+    struct cli_command_definition bound[16];
+    struct cli_language_image image;
+    const struct cli_command_definition *expect_def;
+    const struct cli_command_definition *actual_def;
+    cli_expression bytecode;
+
+    ASSERT(language_image_write_overflow, language_image_write(&lang1, handler_ids, data, 64, &size));
+    ASSERT(language_image_write_success, language_image_write(&lang1, handler_ids, data, sizeof(storage), &size));
+    ASSERT(language_image_load_success, language_image_load(&image, data, size, handlers, 1, bound, 16));
+    ASSERT(NULL, image.language.keyword_index);
+    ASSERT(test_handler, image.language.commands[cmd_true].handler);
+
+    /* With indices, used in place */
+    ASSERT(build_keyword_index_success, build_keyword_index(lang1.keywords, keyword_nodes, sizeof(keyword_nodes) / sizeof(keyword_nodes[0]), &keyword_index));
+    ASSERT(build_command_tree_success, build_command_tree(lang1.commands, command_nodes, sizeof(command_nodes) / sizeof(command_nodes[0]), &command_tree));
+    indexed.keyword_index = &keyword_index;
+    indexed.command_tree = &command_tree;
+    ASSERT(language_image_write_success, language_image_write(&indexed, handler_ids, data, sizeof(storage), &size));
+    ASSERT(language_image_load_success, language_image_load(&image, data, size, handlers, 1, bound, 16));
+    ASSERT(1, image.language.keyword_index && image.language.command_tree);
+    ASSERT(1, (const unsigned char *) image.language.keyword_index->nodes > data && (const unsigned char *) image.language.keyword_index->nodes < data + size);
+
+    for (unsigned long i = 0; i < sizeof(commands) / sizeof(commands[0]); ++i) {
+        ASSERT(1, compare_parse(&lang1, &image.language, commands[i]));
+        if (parse_long_command(&lang1, commands[i], NULL, &bytecode) == parse_long_command_success) {
+            ASSERT(match_command(&lang1, &bytecode, &expect_def), match_command(&image.language, &bytecode, &actual_def));
+            ASSERT(expect_def ? expect_def - lang1.commands : -1, actual_def ? actual_def - image.language.commands : -1);
+        }
+    }
+    ASSERT(CLI_COMMAND_READ_ONLY, image.language.commands[cmd_get_potato_count].flags);
+
+    /* Node links which could form a cycle or leave the index, in either index */
+    for (int offset = 20; offset <= 28; offset += 8) {
+        unsigned char *nodes = data + (data[offset] | data[offset + 1] << 8);
+        /* Keyword node: children past the last node, command tree node: sibling loop */
+        unsigned char *link = offset == 20 ? nodes + 6 + 3 : nodes + 6 + 4;
+        unsigned char other = link[0];
+        link[0] = offset == 20 ? 0xff : 1;
+        ASSERT(language_image_load_invalid_syntax, language_image_load(&image, data, size, handlers, 1, bound, 16));
+        link[0] = other;
+        link = offset == 20 ? nodes + 6 + 4 : nodes + 6 + 2;
+        unsigned char child = link[0];
+        link[0] = 1;
+        ASSERT(language_image_load_invalid_syntax, language_image_load(&image, data, size, handlers, 1, bound, 16));
+        link[0] = child;
+    }
+    ASSERT(language_image_load_success, language_image_load(&image, data, size, handlers, 1, bound, 16));
+
+    /* Rejected images */
+    ASSERT(language_image_load_bad_size, language_image_load(&image, data, size - 1, handlers, 1, bound, 16));
+    ASSERT(language_image_load_too_many_commands, language_image_load(&image, data, size, handlers, 1, bound, 9));
+    ASSERT(language_image_load_invalid_handler, language_image_load(&image, data, size, handlers, 0, bound, 16));
+    data[5] = CLI_MAX_TOKENS + 1;
+    ASSERT(language_image_load_incompatible, language_image_load(&image, data, size, handlers, 1, bound, 16));
+    data[0] = 0;
+    ASSERT(language_image_load_bad_header, language_image_load(&image, data, size, handlers, 1, bound, 16));
+
+    /* Swap */
+    const struct cli_language_definition *volatile active = &lang1;
+    language_publish(&active, &image.language);
+    ASSERT(&image.language, active);
+    return 0;
+}
+
+static int test_requests(void)
+{
+    struct cli_request_server server;
+    cli_expression bytecode;
+    unsigned char frame[CLI_FRAME_REQUEST_MAX_SIZE * 2];
+    unsigned char size;
+    unsigned char second;
+    unsigned char reply[CLI_FRAME_REPLY_SIZE];
+    struct cli_reply content;
+    request_server_init(&server, &lang1);
+
+    /* Two requests back to back, each answered as it completes */
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "set potato count to 42", NULL, &bytecode));
+    ASSERT(encode_frame_overflow, encode_request_frame(&bytecode, 7, frame, CLI_FRAME_SIZE(7), &size));
+    ASSERT(encode_frame_success, encode_request_frame(&bytecode, 7, frame, sizeof(frame), &size));
+    ASSERT(CLI_FRAME_SIZE(8), size);
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "false", NULL, &bytecode));
+    ASSERT(encode_frame_success, encode_request_frame(&bytecode, 8, frame + size, sizeof(frame) - size, &second));
+    for (unsigned char i = 0; i < size - 1; ++i) {
+        ASSERT(0, serve_request(&server, frame[i], reply));
+    }
+    ASSERT(CLI_FRAME_REPLY_SIZE, serve_request(&server, frame[size - 1], reply));
+    ASSERT(receive_frame_success, decode_reply_frame(reply, CLI_FRAME_REPLY_SIZE, &content));
+    ASSERT(7, content.sequence);
+    ASSERT(cli_reply_executed, content.status);
+    ASSERT(cli_command_success, content.code);
+    for (unsigned char i = 0; i < second - 1; ++i) {
+        ASSERT(0, serve_request(&server, frame[size + i], reply));
+    }
+    ASSERT(CLI_FRAME_REPLY_SIZE, serve_request(&server, frame[size + second - 1], reply));
+    ASSERT(receive_frame_success, decode_reply_frame(reply, CLI_FRAME_REPLY_SIZE, &content));
+    ASSERT(8, content.sequence);
+    ASSERT(cli_command_fail, content.code);
+
+    /* Errors are answered with their code, corrupt frames are not answered */
+    ASSERT(parse_long_command_success, parse_long_command(&lang1, "get potato", NULL, &bytecode));
+    ASSERT(encode_frame_success, encode_request_frame(&bytecode, 9, frame, sizeof(frame), &size));
+    for (unsigned char i = 0; i < size - 1; ++i) {
+        serve_request(&server, frame[i], reply);
+    }
+    ASSERT(CLI_FRAME_REPLY_SIZE, serve_request(&server, frame[size - 1], reply));
+    ASSERT(receive_frame_success, decode_reply_frame(reply, CLI_FRAME_REPLY_SIZE, &content));
+    ASSERT(cli_reply_no_match, content.status);
+    ASSERT(match_command_fail, content.code);
+    frame[size - 1] ^= 1;
+    for (unsigned char i = 0; i < size; ++i) {
+        ASSERT(0, serve_request(&server, frame[i], reply));
+    }
+    ASSERT(1, server.dropped);
+    ASSERT(3, server.requests);
+
+    /* A request without its sequence number is not answered (with the previous one) */
+    frame[0] = 1;
+    frame[1] = CLI_FRAME_REQUEST;
+    frame[2] = cli_crc8(cli_crc8(0, frame[0]), frame[1]);
+    for (unsigned char i = 0; i < 3; ++i) {
+        ASSERT(0, serve_request(&server, frame[i], reply));
+    }
+    ASSERT(2, server.dropped);
+    ASSERT(3, server.requests);
+
+    /* Plain frames still run, without a reply */
+    ASSERT(encode_frame_success, encode_frame(&bytecode, frame, sizeof(frame), &size));
+    for (unsigned char i = 0; i < size; ++i) {
+        ASSERT(0, serve_request(&server, frame[i], reply));
+    }
+    reply[1] = CLI_FRAME_TELEMETRY;
+    ASSERT(receive_frame_bad_crc, decode_reply_frame(reply, CLI_FRAME_REPLY_SIZE, &content));
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     (void) argc;
     (void) argv;
     const struct cli_command_definition *def;
+    struct cli_arguments arguments;
     cli_expression bytecode;
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "", NULL, &bytecode));
@@ -123,20 +1685,20 @@ int main(int argc, char *argv[])
     ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, "invalid", NULL, &bytecode));
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "true", NULL, &bytecode));
-    ASSERT(match_command_success, match_command(&lang1, &bytecode, &def));
-    ASSERT(cli_command_success, def->handler(&bytecode, def));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &bytecode, &def, &arguments));
+    ASSERT(cli_command_success, def->handler(&bytecode, &arguments, def));
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "false", NULL, &bytecode));
-    ASSERT(match_command_success, match_command(&lang1, &bytecode, &def));
-    ASSERT(cli_command_fail, def->handler(&bytecode, def));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &bytecode, &def, &arguments));
+    ASSERT(cli_command_fail, def->handler(&bytecode, &arguments, def));
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "set potato count to 42", NULL, &bytecode));
-    ASSERT(match_command_success, match_command(&lang1, &bytecode, &def));
-    ASSERT(cli_command_success, def->handler(&bytecode, def));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &bytecode, &def, &arguments));
+    ASSERT(cli_command_success, def->handler(&bytecode, &arguments, def));
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "set lemon count to -42", NULL, &bytecode));
-    ASSERT(match_command_success, match_command(&lang1, &bytecode, &def));
-    ASSERT(cli_command_success, def->handler(&bytecode, def));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &bytecode, &def, &arguments));
+    ASSERT(cli_command_success, def->handler(&bytecode, &arguments, def));
 
     ASSERT(parse_long_command_invalid_token, parse_long_command(&lang1, "set potato count to -1001", NULL, &bytecode));
 
@@ -145,13 +1707,37 @@ int main(int argc, char *argv[])
     ASSERT(parse_long_command_too_many_tokens, parse_long_command(&lang1, "bake set true potato count to false lemon count", NULL, &bytecode));
 
     ASSERT(parse_long_command_success, parse_long_command(&lang1, "truepotato", "truepotato" + 4, &bytecode));
-    ASSERT(match_command_success, match_command(&lang1, &bytecode, &def));
-    ASSERT(cli_command_success, def->handler(&bytecode, def));
+    ASSERT(match_command_success, match_command_arguments(&lang1, &bytecode, &def, &arguments));
+    ASSERT(cli_command_success, def->handler(&bytecode, &arguments, def));
+
+    ASSERT(0, test_keyword_index());
+    ASSERT(0, test_command_tree());
+    ASSERT(0, test_stream_parser());
+    ASSERT(0, test_frame());
+    ASSERT(0, test_generated_language());
+    ASSERT(0, test_next_tokens());
+    ASSERT(0, test_output());
+    ASSERT(0, test_wide_numbers());
+    ASSERT(0, test_tokenizer());
+    ASSERT(0, test_match_cache());
+    ASSERT(0, test_command_queue());
+    ASSERT(0, test_scheduler());
+#ifdef CLI_INSTRUMENT
+    ASSERT(0, test_instrument());
+#endif
+    ASSERT(0, test_telemetry());
+    ASSERT(0, test_short_format());
+    ASSERT(0, test_keyword_pool());
+    ASSERT(0, test_arguments());
+    ASSERT(0, test_macros());
+    ASSERT(0, test_batch());
+    ASSERT(0, test_language_image());
+    ASSERT(0, test_requests());
 
     return 0;
 }
 
-static enum cli_command_result test_handler(const cli_expression *bytecode, const struct cli_command_definition *def)
+enum cli_command_result test_handler(const cli_expression *bytecode, const struct cli_arguments *arguments, const struct cli_command_definition *def)
 {
     (void) bytecode;
     print_bytecode(&lang1, bytecode);
@@ -161,10 +1747,12 @@ static enum cli_command_result test_handler(const cli_expression *bytecode, cons
     } else if (idx == cmd_false) {
         return cli_command_fail;
     } else if (idx == cmd_set_potato_count) {
-        ASSERT(42, CLI_EXPR_NUMBER_TO_INT((*bytecode)[4]));
+        ASSERT(1, arguments->count);
+        ASSERT(42, arguments->value[0]);
         return cli_command_success;
     } else if (idx == cmd_set_lemon_count) {
-        ASSERT(-42, CLI_EXPR_NUMBER_TO_INT((*bytecode)[4]));
+        ASSERT(1, arguments->count);
+        ASSERT(-42, arguments->value[0]);
         return cli_command_success;
     } else {
         return cli_command_invalid_argument;
@@ -0,0 +1,515 @@
+/*
+ * Compile a language description into specialised C: constant tables,
+ * precomputed keyword index and command tree (for the stream parser), and
+ * switch-based keyword/command lookups which replace the table walks in
+ * parse_long_command and match_command.
+ *
+ * Usage: cli_gen [-o output.c] [-i image] input.cli
+ *
+ * -i also writes a language image (see serial_cli_image.h), whose handler IDs
+ * index the generated <name>_handlers table.
+ *
+ * Description format, one statement per line ('#' at line start is a comment):
+ *
+ *   language <name>              Name of the generated cli_language_definition
+ *   keywords <word> ...          Fix keyword order (other keywords are appended
+ *                                in order of first use)
+ *   <handler>: <token> ...       Command, '#' denotes a number
+ *   readonly <handler>: ...      Command without side effects (may be
+ *                                subscribed to by telemetry)
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "serial_cli_internal.h"
+#include "serial_cli_image.h"
+
+#define MAX_LINE (256)
+#define MAX_NAME (64)
+
+struct description
+{
+    char name[MAX_NAME];
+    char keywords[CLI_RANGE_KEYWORD][MAX_NAME];
+    cli_keyword keyword_list[CLI_RANGE_KEYWORD + 1];
+    int keyword_count;
+    char handlers[CLI_MAX_COMMANDS][MAX_NAME];
+    unsigned char flags[CLI_MAX_COMMANDS];
+    syntax_token syntax[CLI_MAX_COMMANDS][CLI_MAX_TOKENS];
+    int command_count;
+};
+
+static const char *input_name;
+static int input_line;
+
+static void fail(const char *message, const char *detail)
+{
+    fprintf(stderr, "%s:%d: %s%s%s" PRINTF_LINEBREAK, input_name, input_line, message, detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+static bool is_identifier(const char *str)
+{
+    if (!*str || (*str >= '0' && *str <= '9')) {
+        return FALSE;
+    }
+    for (; *str; ++str) {
+        if (!(*str == '_' || (*str >= 'a' && *str <= 'z') || (*str >= 'A' && *str <= 'Z') || (*str >= '0' && *str <= '9'))) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/*
+ * Find keyword index, adding the keyword if not found
+ */
+static int keyword_index(struct description *desc, const char *word)
+{
+    for (int i = 0; i < desc->keyword_count; ++i) {
+        if (strcmp(desc->keywords[i], word) == 0) {
+            return i;
+        }
+    }
+    if (desc->keyword_count == CLI_RANGE_KEYWORD) {
+        fail("Too many keywords", word);
+    }
+    if (strlen(word) >= MAX_NAME || strchr(word, '\'') || strchr(word, '\\') || strchr(word, '"')) {
+        fail("Invalid keyword", word);
+    }
+    strcpy(desc->keywords[desc->keyword_count], word);
+    return desc->keyword_count++;
+}
+
+static void read_description(struct description *desc, FILE *in)
+{
+    char line[MAX_LINE];
+    const char *delim = " \t\r\n";
+    while (fgets(line, sizeof(line), in)) {
+        ++input_line;
+        char *word = strtok(line, delim);
+        if (!word || *word == '#') {
+            continue;
+        }
+        if (strcmp(word, "language") == 0) {
+            word = strtok(NULL, delim);
+            if (!word || !is_identifier(word) || strlen(word) >= MAX_NAME - 16) {
+                fail("Invalid language name", word);
+            }
+            strcpy(desc->name, word);
+        } else if (strcmp(word, "keywords") == 0) {
+            while ((word = strtok(NULL, delim))) {
+                keyword_index(desc, word);
+            }
+        } else {
+            unsigned char flags = 0;
+            if (strcmp(word, "readonly") == 0) {
+                flags |= CLI_COMMAND_READ_ONLY;
+                word = strtok(NULL, delim);
+                if (!word) {
+                    fail("Expected '<handler>:'", NULL);
+                }
+            }
+            size_t length = strlen(word);
+            if (word[length - 1] != ':') {
+                fail("Expected 'language', 'keywords' or '<handler>:'", word);
+            }
+            word[length - 1] = '\0';
+            if (!is_identifier(word)) {
+                fail("Invalid handler name", word);
+            }
+            if (desc->command_count == CLI_MAX_COMMANDS) {
+                fail("Too many commands", NULL);
+            }
+            int command = desc->command_count++;
+            strcpy(desc->handlers[command], word);
+            desc->flags[command] = flags;
+            int tokens = 0;
+            while ((word = strtok(NULL, delim))) {
+                if (tokens == CLI_MAX_TOKENS) {
+                    fail("Too many tokens", word);
+                }
+                if (strcmp(word, "#") == 0) {
+                    desc->syntax[command][tokens++] = CLI_SPEC_NUMBER;
+                } else {
+                    desc->syntax[command][tokens++] = CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(keyword_index(desc, word));
+                }
+            }
+        }
+    }
+    if (!desc->name[0]) {
+        fail("Missing 'language' statement", NULL);
+    }
+    for (int i = 0; i < desc->keyword_count; ++i) {
+        desc->keyword_list[i] = desc->keywords[i];
+    }
+    desc->keyword_list[desc->keyword_count] = NULL;
+}
+
+/* Placeholder handler while building the command tree */
+static CLI_COMMAND_HANDLER(placeholder_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    return cli_command_fail;
+}
+
+static void indent(FILE *out, int depth)
+{
+    fprintf(out, "%*s", depth * 4, "");
+}
+
+/*
+ * Emit nested switch over character position for keywords of equal length
+ */
+static void emit_keyword_switch(FILE *out, const struct description *desc, const int *keywords, int count, int pos, int depth)
+{
+    if (count == 1) {
+        const char *keyword = desc->keywords[keywords[0]];
+        int length = strlen(keyword);
+        if (pos < length) {
+            indent(out, depth);
+            fprintf(out, "if (");
+            for (int i = pos; i < length; ++i) {
+                fprintf(out, "%sbegin[%d] == '%c'", i == pos ? "" : " && ", i, keyword[i]);
+            }
+            fprintf(out, ") {\n");
+            ++depth;
+        }
+        indent(out, depth);
+        fprintf(out, "*token = CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(%d);\n", keywords[0]);
+        indent(out, depth);
+        fprintf(out, "return 1;\n");
+        if (pos < length) {
+            indent(out, depth - 1);
+            fprintf(out, "}\n");
+            indent(out, depth - 1);
+            fprintf(out, "return 0;\n");
+        }
+        return;
+    }
+    indent(out, depth);
+    fprintf(out, "switch (begin[%d]) {\n", pos);
+    bool done[CLI_RANGE_KEYWORD] = { FALSE };
+    for (int i = 0; i < count; ++i) {
+        if (done[i]) {
+            continue;
+        }
+        char ch = desc->keywords[keywords[i]][pos];
+        int group[CLI_RANGE_KEYWORD];
+        int group_count = 0;
+        for (int j = i; j < count; ++j) {
+            if (desc->keywords[keywords[j]][pos] == ch) {
+                group[group_count++] = keywords[j];
+                done[j] = TRUE;
+            }
+        }
+        indent(out, depth);
+        fprintf(out, "case '%c':\n", ch);
+        emit_keyword_switch(out, desc, group, group_count, pos + 1, depth + 1);
+    }
+    indent(out, depth);
+    fprintf(out, "default:\n");
+    indent(out, depth + 1);
+    fprintf(out, "return 0;\n");
+    indent(out, depth);
+    fprintf(out, "}\n");
+}
+
+static void emit_keyword_lookup(FILE *out, const struct description *desc)
+{
+    fprintf(out, "static int %s_keyword_lookup(expression_token *token, const char *begin, const char *end)\n{\n", desc->name);
+    fprintf(out, "    switch (end - begin) {\n");
+    bool done[CLI_RANGE_KEYWORD] = { FALSE };
+    for (int i = 0; i < desc->keyword_count; ++i) {
+        if (done[i]) {
+            continue;
+        }
+        size_t length = strlen(desc->keywords[i]);
+        int group[CLI_RANGE_KEYWORD];
+        int group_count = 0;
+        for (int j = i; j < desc->keyword_count; ++j) {
+            if (strlen(desc->keywords[j]) == length) {
+                group[group_count++] = j;
+                done[j] = TRUE;
+            }
+        }
+        fprintf(out, "    case %zu:\n", length);
+        emit_keyword_switch(out, desc, group, group_count, 0, 2);
+    }
+    fprintf(out, "    default:\n        return 0;\n    }\n}\n\n");
+}
+
+/*
+ * Emit nested switch over bytecode tokens, following the command tree
+ */
+static void emit_command_switch(FILE *out, const struct description *desc, const struct cli_command_tree_node *nodes, unsigned short node, int pos, int depth)
+{
+    int command = nodes[node].command;
+    if (pos == CLI_MAX_TOKENS) {
+        indent(out, depth);
+        fprintf(out, "return &%s_commands[%d];\n", desc->name, command - 1);
+        return;
+    }
+    if (command) {
+        indent(out, depth);
+        fprintf(out, "if (CLI_EXPR_IS_TERMINAL((*value)[%d])) {\n", pos);
+        indent(out, depth + 1);
+        fprintf(out, "return &%s_commands[%d];\n", desc->name, command - 1);
+        indent(out, depth);
+        fprintf(out, "}\n");
+    }
+    bool keywords = FALSE;
+    for (unsigned short child = nodes[node].child; child; child = nodes[child].sibling) {
+        if (CLI_SPEC_IS_NUMBER(nodes[child].token)) {
+            indent(out, depth);
+            fprintf(out, "if (CLI_EXPR_IS_ANY_NUMBER((*value)[%d])) {\n", pos);
+            emit_command_switch(out, desc, nodes, child, pos + 1, depth + 1);
+            indent(out, depth);
+            fprintf(out, "}\n");
+        } else {
+            keywords = TRUE;
+        }
+    }
+    if (keywords) {
+        indent(out, depth);
+        fprintf(out, "switch ((*value)[%d]) {\n", pos);
+        for (unsigned short child = nodes[node].child; child; child = nodes[child].sibling) {
+            if (CLI_SPEC_IS_KEYWORD(nodes[child].token)) {
+                indent(out, depth);
+                fprintf(out, "case CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(%d): /* %s */\n", CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(nodes[child].token), desc->keywords[CLI_SPEC_KEYWORD_TO_KEYWORD_INDEX(nodes[child].token)]);
+                emit_command_switch(out, desc, nodes, child, pos + 1, depth + 1);
+            }
+        }
+        indent(out, depth);
+        fprintf(out, "default:\n");
+        indent(out, depth + 1);
+        fprintf(out, "return NULL;\n");
+        indent(out, depth);
+        fprintf(out, "}\n");
+    } else {
+        indent(out, depth);
+        fprintf(out, "return NULL;\n");
+    }
+}
+
+/*
+ * Language of a description, with indices precomputed by the library itself
+ * (in static storage, and with placeholder handlers)
+ */
+static void build_language(const struct description *desc, struct cli_language_definition *language)
+{
+    static struct cli_keyword_index_node keyword_nodes[CLI_KEYWORD_INDEX_NODES(CLI_RANGE_KEYWORD * MAX_NAME)];
+    static struct cli_command_tree_node command_nodes[CLI_COMMAND_TREE_NODES(CLI_MAX_COMMANDS)];
+    static struct cli_command_definition commands[CLI_MAX_COMMANDS + 1];
+    static struct cli_keyword_index keyword_index;
+    static struct cli_command_tree command_tree;
+    for (int i = 0; i < desc->command_count; ++i) {
+        memcpy((void *) commands[i].syntax, desc->syntax[i], sizeof(commands[i].syntax));
+        commands[i].handler = placeholder_handler;
+        commands[i].flags = desc->flags[i];
+    }
+    if (build_keyword_index(desc->keyword_list, keyword_nodes, sizeof(keyword_nodes) / sizeof(keyword_nodes[0]), &keyword_index) != build_keyword_index_success) {
+        fail("Failed to build keyword index", NULL);
+    }
+    if (build_command_tree(commands, command_nodes, sizeof(command_nodes) / sizeof(command_nodes[0]), &command_tree) != build_command_tree_success) {
+        fail("Failed to build command tree", NULL);
+    }
+    *language = (struct cli_language_definition) {
+        .keywords = desc->keyword_list,
+        .commands = commands,
+        .keyword_index = &keyword_index,
+        .command_tree = &command_tree,
+    };
+}
+
+/*
+ * Handler ID of a command: index of its handler among distinct handlers, in order of first use
+ */
+static int handler_id(const struct description *desc, int command)
+{
+    int id = 0;
+    for (int i = 0; i < command; ++i) {
+        bool declared = FALSE;
+        for (int j = 0; j < i && !declared; ++j) {
+            declared = strcmp(desc->handlers[i], desc->handlers[j]) == 0;
+        }
+        if (strcmp(desc->handlers[i], desc->handlers[command]) == 0) {
+            return id;
+        }
+        id += !declared;
+    }
+    return id;
+}
+
+static void emit_language(FILE *out, const struct description *desc)
+{
+    const char *name = desc->name;
+
+    struct cli_language_definition language;
+    build_language(desc, &language);
+    const struct cli_keyword_index keyword_index = *language.keyword_index;
+    const struct cli_command_tree command_tree = *language.command_tree;
+
+    fprintf(out, "/* Generated by cli_gen from %s, do not edit */\n\n", input_name);
+    fprintf(out, "#include \"serial_cli.h\"\n\n");
+    fprintf(out, "#ifndef NULL\n#define NULL ((void *) 0)\n#endif\n\n");
+
+    /* Host tools (host/cli_check.c, host/cli_sim.c) build with stub handlers, which succeed */
+    fprintf(out, "#ifdef CLI_STUB_HANDLERS\n");
+    for (int stub = 1; stub >= 0; --stub) {
+        for (int i = 0; i < desc->command_count; ++i) {
+            bool declared = FALSE;
+            for (int j = 0; j < i && !declared; ++j) {
+                declared = strcmp(desc->handlers[i], desc->handlers[j]) == 0;
+            }
+            if (!declared) {
+                fprintf(out, "CLI_COMMAND_HANDLER(%s, bytecode, arguments, def)%s\n", desc->handlers[i], stub ? " { (void) bytecode; (void) arguments; (void) def; return cli_command_success; }" : ";");
+            }
+        }
+        fprintf(out, stub ? "#else\n" : "#endif\n\n");
+    }
+
+    fprintf(out, "static const cli_keyword %s_keywords[] = {\n", name);
+    for (int i = 0; i < desc->keyword_count; ++i) {
+        fprintf(out, "    \"%s\",\n", desc->keywords[i]);
+    }
+    fprintf(out, "    NULL\n};\n\n");
+
+    fprintf(out, "static const struct cli_command_definition %s_commands[] = {\n", name);
+    for (int i = 0; i < desc->command_count; ++i) {
+        fprintf(out, "    {\n        .syntax = {");
+        for (int j = 0; j < CLI_MAX_TOKENS && !CLI_SPEC_IS_TERMINAL(desc->syntax[i][j]); ++j) {
+            fprintf(out, "%s0x%02x", j ? ", " : " ", desc->syntax[i][j]);
+        }
+        fprintf(out, " },\n        .handler = %s,\n", desc->handlers[i]);
+        if (desc->flags[i] & CLI_COMMAND_READ_ONLY) {
+            fprintf(out, "        .flags = CLI_COMMAND_READ_ONLY,\n");
+        }
+        fprintf(out, "    },\n");
+    }
+    fprintf(out, "    {\n        .handler = NULL,\n    },\n};\n\n");
+
+    fprintf(out, "static const struct cli_keyword_index_node %s_keyword_nodes[] = {\n", name);
+    for (unsigned short i = 0; i < keyword_index.count; ++i) {
+        const struct cli_keyword_index_node *node = &keyword_index.nodes[i];
+        if (i == 0) {
+            fprintf(out, "    { .ch = 0, .keyword = %d, .unique = %d, .children = %d, .child = %d },\n", node->keyword, node->unique, node->children, node->child);
+        } else {
+            fprintf(out, "    { .ch = '%c', .keyword = %d, .unique = %d, .children = %d, .child = %d },\n", node->ch, node->keyword, node->unique, node->children, node->child);
+        }
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const struct cli_keyword_index %s_keyword_index = {\n", name);
+    fprintf(out, "    .nodes = %s_keyword_nodes,\n    .count = %d,\n};\n\n", name, keyword_index.count);
+
+    fprintf(out, "static const struct cli_command_tree_node %s_command_nodes[] = {\n", name);
+    for (unsigned short i = 0; i < command_tree.count; ++i) {
+        const struct cli_command_tree_node *node = &command_tree.nodes[i];
+        fprintf(out, "    { .token = 0x%02x, .command = %d, .child = %d, .sibling = %d },\n", node->token, node->command, node->child, node->sibling);
+    }
+    fprintf(out, "};\n\n");
+    fprintf(out, "static const struct cli_command_tree %s_command_tree = {\n", name);
+    fprintf(out, "    .nodes = %s_command_nodes,\n    .count = %d,\n};\n\n", name, command_tree.count);
+
+    emit_keyword_lookup(out, desc);
+
+    fprintf(out, "static const struct cli_command_definition *%s_command_lookup(const cli_expression *value)\n{\n", name);
+    emit_command_switch(out, desc, command_tree.nodes, 0, 0, 1);
+    fprintf(out, "}\n\n");
+
+    /* Handler table for language images (see serial_cli_image.h), in handler ID order */
+    fprintf(out, "cli_command_handler *const %s_handlers[] = {\n", name);
+    for (int i = 0, next = 0; i < desc->command_count; ++i) {
+        if (handler_id(desc, i) == next) {
+            fprintf(out, "    %s,\n", desc->handlers[i]);
+            ++next;
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const struct cli_language_definition %s = {\n", name);
+    fprintf(out, "    .keywords = %s_keywords,\n", name);
+    fprintf(out, "    .commands = %s_commands,\n", name);
+    fprintf(out, "    .keyword_index = &%s_keyword_index,\n", name);
+    fprintf(out, "    .command_tree = &%s_command_tree,\n", name);
+    fprintf(out, "    .keyword_lookup = %s_keyword_lookup,\n", name);
+    fprintf(out, "    .command_lookup = %s_command_lookup,\n", name);
+    fprintf(out, "};\n");
+}
+
+/*
+ * Write the language image of a description
+ */
+static void emit_image(FILE *out, const struct description *desc)
+{
+    struct cli_language_definition language;
+    build_language(desc, &language);
+    unsigned char handler_ids[CLI_MAX_COMMANDS];
+    for (int i = 0; i < desc->command_count; ++i) {
+        handler_ids[i] = handler_id(desc, i);
+    }
+    static unsigned char image[0x10000];
+    unsigned long size;
+    if (language_image_write(&language, handler_ids, image, sizeof(image), &size) != language_image_write_success) {
+        fail("Failed to write language image", NULL);
+    }
+    fwrite(image, 1, size, out);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output_name = NULL;
+    const char *image_name = NULL;
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2) {
+        if (strcmp(argv[arg], "-o") == 0) {
+            output_name = argv[arg + 1];
+        } else if (strcmp(argv[arg], "-i") == 0) {
+            image_name = argv[arg + 1];
+        } else {
+            break;
+        }
+    }
+    if (arg + 1 != argc) {
+        fprintf(stderr, "Usage: %s [-o output.c] [-i image] input.cli" PRINTF_LINEBREAK, argv[0]);
+        return 1;
+    }
+    input_name = argv[arg];
+    FILE *in = fopen(input_name, "r");
+    if (!in) {
+        perror(input_name);
+        return 1;
+    }
+    static struct description desc;
+    read_description(&desc, in);
+    fclose(in);
+
+    if (image_name) {
+        FILE *image = fopen(image_name, "wb");
+        if (!image) {
+            perror(image_name);
+            return 1;
+        }
+        emit_image(image, &desc);
+        if (fclose(image) != 0) {
+            perror(image_name);
+            remove(image_name);
+            return 1;
+        }
+    }
+
+    FILE *out = output_name ? fopen(output_name, "w") : stdout;
+    if (!out) {
+        perror(output_name);
+        return 1;
+    }
+    emit_language(out, &desc);
+    if (out != stdout && fclose(out) != 0) {
+        perror(output_name);
+        remove(output_name);
+        return 1;
+    }
+    return 0;
+}
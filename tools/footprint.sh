@@ -0,0 +1,175 @@
+#!/bin/sh
+#
+# Flash/RAM footprint per function and per feature switch.
+#
+# Usage: footprint.sh [-b text,data,bss] [-f feature]... source.c...
+#
+# Builds the sources (an application and the library) with $CC $CFLAGS in
+# separate sections, linked with --gc-sections so only reachable code counts:
+# once as configured, once with each feature disabled (-DCLI_NO_<feature>) and
+# once with all of them disabled.  Prints text/data/bss of every function and
+# variable of the configured build, grouped by object, then the cost of each
+# feature, and exits non-zero if the configured build exceeds the budget.
+#
+# Read-only data is counted as text, as by size(1).  Only symbols defined by
+# the sources are counted, not the C library or startup code.  String literals
+# have no symbols: they are added to the function using them if it has its own
+# section, else listed per object as "(strings)", in both cases before merging.
+#
+set -eu
+
+cc=${CC:-cc}
+cflags=${CFLAGS:--Os}
+ldflags=${LDFLAGS:-}
+nm=${NM:-nm}
+size=${SIZE:-size}
+budget=
+features=
+
+usage() {
+    echo "usage: $0 [-b text,data,bss] [-f feature]... source.c..." >&2
+    exit 2
+}
+
+while getopts b:f: opt; do
+    case $opt in
+    b) budget=$OPTARG ;;
+    f) features="$features $OPTARG" ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || usage
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# build <name> <flags>: objects and linked image in $work/<name>, then one
+# "object symbol text data bss" line per symbol of the image in $work/<name>/sizes
+build() {
+    dir=$work/$1
+    mkdir "$dir"
+    objects=
+    for source in $sources; do
+        object=$dir/$(basename "$source" .c).o
+        # shellcheck disable=SC2086
+        $cc $cflags $2 -I. -ffunction-sections -fdata-sections -c -o "$object" "$source"
+        objects="$objects $object"
+    done
+    # shellcheck disable=SC2086
+    $cc $cflags $ldflags -Wl,--gc-sections -o "$dir/image" $objects
+    for object in $objects; do
+        $nm --defined-only "$object" | awk -v object="$(basename "$object")" 'NF == 3 { print $3, object }'
+    done > "$dir/owners"
+    $nm -S --defined-only "$dir/image" | awk '
+        function hex(digits,    value, i) {
+            value = 0
+            for (i = 1; i <= length(digits); ++i) {
+                value = value * 16 + index("0123456789abcdef", tolower(substr(digits, i, 1))) - 1
+            }
+            return value
+        }
+        FILENAME != "-" { if (!($1 in owner)) owner[$1] = $2; next }
+        NF == 4 && ($4 in owner) {
+            size = hex($2)
+            type = tolower($3)
+            if (type == "t" || type == "r" || type == "w") {
+                text = size; data = 0; bss = 0
+            } else if (type == "d" || type == "v") {
+                text = 0; data = size; bss = 0
+            } else if (type == "b") {
+                text = 0; data = 0; bss = size
+            } else {
+                next
+            }
+            print owner[$4], $4, text, data, bss
+        }' "$dir/owners" - > "$dir/symbols"
+    for object in $objects; do
+        $size -A "$object" | awk -v object="$(basename "$object")" '
+            FILENAME != "-" { if ($1 == object) linked[$2] = 1; next }
+            $1 ~ /^\.rodata\..*str[0-9]/ {
+                function_name = $1
+                sub(/^\.rodata\.?/, "", function_name)
+                sub(/\.?str[0-9.]*$/, "", function_name)
+                if (function_name == "") {
+                    strings += $2
+                } else if (function_name in linked) {
+                    print object, function_name, $2, 0, 0
+                }
+            }
+            END { if (strings) print object, "(strings)", strings, 0, 0 }' "$dir/symbols" -
+    done > "$dir/strings"
+    awk '
+        { key = $1 " " $2; text[key] += $3; data[key] += $4; bss[key] += $5 }
+        END { for (key in text) print key, text[key], data[key], bss[key] }' "$dir/symbols" "$dir/strings" > "$dir/sizes"
+}
+
+# totals <name>: "text data bss" of a build
+totals() {
+    awk '{ text += $3; data += $4; bss += $5 } END { printf "%d %d %d\n", text, data, bss }' "$work/$1/sizes"
+}
+
+sources="$*"
+
+build configured ""
+all=
+for feature in $features; do
+    build "$feature" "-DCLI_NO_$feature"
+    all="$all -DCLI_NO_$feature"
+done
+if [ -n "$features" ]; then
+    build minimal "$all"
+fi
+
+sort -k1,1 -k3,3nr -k2,2 "$work/configured/sizes" | awk '
+    BEGIN { printf "%-40s %7s %7s %7s\n", "function", "text", "data", "bss" }
+    $1 != object {
+        if (object != "") {
+            printf "%-40s %7d %7d %7d\n\n", "  (" object ")", otext, odata, obss
+        }
+        object = $1; otext = odata = obss = 0
+        print object
+    }
+    {
+        printf "  %-38s %7d %7d %7d\n", $2, $3, $4, $5
+        otext += $3; odata += $4; obss += $5
+        text += $3; data += $4; bss += $5
+    }
+    END {
+        printf "%-40s %7d %7d %7d\n\n", "  (" object ")", otext, odata, obss
+        printf "%-40s %7d %7d %7d\n", "total", text, data, bss
+    }'
+
+set -- $(totals configured)
+text=$1 data=$2 bss=$3
+
+if [ -n "$features" ]; then
+    echo
+    printf "%-40s %7s %7s %7s\n" "feature (cost)" "text" "data" "bss"
+    for feature in $features minimal; do
+        set -- $(totals "$feature")
+        label=CLI_NO_$feature
+        [ "$feature" = minimal ] && label="all disabled"
+        printf "%-40s %7d %7d %7d\n" "$label" $((text - $1)) $((data - $2)) $((bss - $3))
+    done
+fi
+
+if [ -n "$budget" ]; then
+    old_ifs=$IFS
+    IFS=,
+    set -- $budget
+    IFS=$old_ifs
+    status=0
+    for section in text:$text:${1:-} data:$data:${2:-} bss:$bss:${3:-}; do
+        name=${section%%:*}
+        limit=${section##*:}
+        used=${section#*:}
+        used=${used%%:*}
+        if [ -n "$limit" ] && [ "$used" -gt "$limit" ]; then
+            echo "footprint: $name $used exceeds budget $limit" >&2
+            status=1
+        fi
+    done
+    [ $status -eq 0 ] && echo "footprint: within budget ($budget)"
+    exit $status
+fi
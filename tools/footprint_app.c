@@ -0,0 +1,203 @@
+/*
+ * Minimal firmware measured by make footprint (see tools/footprint.sh): a
+ * line console with a help listing and '?' hints, over stdin/stdout in place
+ * of a UART.  Built once per feature configuration, so every optional path is
+ * behind the same switch as in the library.
+ */
+#include <stdio.h>
+
+#include "serial_cli_internal.h"
+#include "serial_cli_output.h"
+#include "serial_cli_stream.h"
+
+enum keywords
+{
+    kw_led,
+    kw_on,
+    kw_off,
+    kw_set,
+    kw_get,
+    kw_rate,
+    kw_help,
+};
+
+static const cli_keyword keywords[] = { "led", "on", "off", "set", "get", "rate", "help", NULL };
+
+#define KWIDX(name) CLI_KEYWORD_INDEX_TO_SPEC_KEYWORD(kw_##name)
+
+static const struct cli_language_definition language;
+
+static unsigned char led;
+static int rate = 100;
+
+static struct cli_output console;
+
+static CLI_COMMAND_HANDLER(led_handler, bytecode, arguments, def)
+{
+    (void) arguments;
+    (void) def;
+    led = (*bytecode)[1] == CLI_KEYWORD_INDEX_TO_EXPR_KEYWORD(kw_on);
+    return cli_command_success;
+}
+
+static CLI_COMMAND_HANDLER(set_rate_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) def;
+    long value = arguments->value[0];
+    if (value <= 0) {
+        return cli_command_invalid_argument;
+    }
+    rate = value;
+    return cli_command_success;
+}
+
+static CLI_COMMAND_HANDLER(get_rate_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    output_int(&console, rate);
+    output_string(&console, PRINTF_LINEBREAK);
+    return cli_command_success;
+}
+
+#ifndef CLI_NO_LIST
+static CLI_COMMAND_HANDLER(help_handler, bytecode, arguments, def)
+{
+    (void) bytecode;
+    (void) arguments;
+    (void) def;
+    list_all_commands_to(&language, &console);
+    return cli_command_success;
+}
+#endif
+
+static const struct cli_command_definition commands[] = {
+    { .syntax = { KWIDX(led), KWIDX(on) }, .handler = led_handler },
+    { .syntax = { KWIDX(led), KWIDX(off) }, .handler = led_handler },
+    { .syntax = { KWIDX(set), KWIDX(rate), CLI_SPEC_NUMBER }, .handler = set_rate_handler },
+    { .syntax = { KWIDX(get), KWIDX(rate) }, .handler = get_rate_handler, .flags = CLI_COMMAND_READ_ONLY },
+#ifndef CLI_NO_LIST
+    { .syntax = { KWIDX(help) }, .handler = help_handler, .flags = CLI_COMMAND_READ_ONLY },
+#endif
+    { .handler = NULL },
+};
+
+/* Indices are built into RAM at startup, as without tools/cli_gen */
+#ifndef CLI_NO_KEYWORD_INDEX
+static struct cli_keyword_index_node keyword_nodes[CLI_KEYWORD_INDEX_NODES(22)];
+static struct cli_keyword_index keyword_index;
+#endif
+
+#ifndef CLI_NO_COMMAND_TREE
+static struct cli_command_tree_node command_nodes[CLI_COMMAND_TREE_NODES(5)];
+static struct cli_command_tree command_tree;
+#endif
+
+#ifndef CLI_NO_MATCH_CACHE
+static struct cli_match_cache match_cache;
+#endif
+
+static const struct cli_language_definition language = {
+    .keywords = keywords,
+    .commands = commands,
+#ifndef CLI_NO_KEYWORD_INDEX
+    .keyword_index = &keyword_index,
+#endif
+#ifndef CLI_NO_COMMAND_TREE
+    .command_tree = &command_tree,
+#endif
+#ifndef CLI_NO_MATCH_CACHE
+    .match_cache = &match_cache,
+#endif
+};
+
+static unsigned short console_write(void *context, const char *data, unsigned short size)
+{
+    return fwrite(data, 1, size, (FILE *) context);
+}
+
+#ifndef CLI_NO_COMPLETION
+/*
+ * Print what may follow the tokens so far, or complete the partial word
+ */
+static void print_hints(const cli_expression *line, int length, const char *word, int word_length)
+{
+    struct cli_next_tokens next;
+    enum cli_next_token types = next_tokens(&language, line, length, &next);
+    int completion;
+    int common;
+    if (word_length) {
+        if (complete_keyword(&language, &next, word, word + word_length, &completion, &common)) {
+            unsigned char keyword_length;
+            const char *text = keyword_text(&language, completion, &keyword_length);
+            output_chars(&console, text + word_length, common - word_length);
+        }
+        return;
+    }
+    for (int index = 0; index < CLI_RANGE_KEYWORD; ++index) {
+        if (next.keywords[index / 8] & (1 << (index % 8))) {
+            output_string(&console, keywords[index]);
+            output_char(&console, ' ');
+        }
+    }
+    if (types & cli_next_number) {
+        output_string(&console, "# ");
+    }
+    if (types & cli_next_terminal) {
+        output_string(&console, "<cr>");
+    }
+    output_string(&console, PRINTF_LINEBREAK);
+}
+#endif
+
+int main(void)
+{
+#ifndef CLI_NO_KEYWORD_INDEX
+    if (build_keyword_index(keywords, keyword_nodes, sizeof(keyword_nodes) / sizeof(keyword_nodes[0]), &keyword_index) != build_keyword_index_success) {
+        return 1;
+    }
+#endif
+#ifndef CLI_NO_COMMAND_TREE
+    if (build_command_tree(commands, command_nodes, sizeof(command_nodes) / sizeof(command_nodes[0]), &command_tree) != build_command_tree_success) {
+        return 1;
+    }
+#endif
+    char buffer[32];
+    output_init(&console, console_write, stdout, buffer, sizeof(buffer));
+    cli_expression line;
+    struct cli_stream_parser parser;
+    stream_parser_init(&parser, &language, &line);
+#ifndef CLI_NO_COMPLETION
+    char word[8];
+    int word_length = 0;
+#endif
+    for (int ch; (ch = getchar()) != EOF;) {
+#ifndef CLI_NO_COMPLETION
+        if (ch == '?') {
+            print_hints(&line, parser.length, word, word_length);
+            output_flush(&console);
+            continue;
+        }
+        if (ch == CLI_LONG_SPACE || ch == CLI_STREAM_LINE_BREAK) {
+            word_length = 0;
+        } else if (word_length < (int) sizeof(word)) {
+            word[word_length++] = ch;
+        }
+#endif
+        enum stream_parser_result result = stream_parser_feed(&parser, ch);
+        if (result == stream_parser_pending) {
+            continue;
+        }
+        enum cli_command_result command;
+        if (result == stream_parser_success && execute_command(&language, &line, &command) == match_command_success) {
+            output_string(&console, command == cli_command_success ? "OK" : "FAIL");
+        } else {
+            output_string(&console, "ERROR");
+        }
+        output_string(&console, PRINTF_LINEBREAK);
+        output_flush(&console);
+    }
+    return 0;
+}